@@ -0,0 +1,138 @@
+#include "batch.h"
+#include "parallel.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QTextStream>
+#include <QStringList>
+#include <QVector>
+#include <QPair>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QElapsedTimer>
+
+#include <STEPCAFControl_Controller.hxx>
+
+#include <stdio.h>
+
+#include <algorithm>
+
+typedef struct {
+    QString input;
+    QString output;
+    bool ok;
+    int solids;
+    double seconds;
+    qint64 inputBytes;
+    qint64 outputBytes;
+} BatchJob;
+
+static bool readManifest(QString manifest, QVector<BatchJob>& jobs)
+{
+    QFile file(manifest);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return false;
+    }
+    QDir base = QFileInfo(manifest).absoluteDir();
+    QTextStream in(&file);
+    int lineNumber = 0;
+    while (!in.atEnd()) {
+        QString line = in.readLine().trimmed();
+        lineNumber++;
+        if (line.isEmpty() || line.startsWith('#')) {
+            continue;
+        }
+        QStringList fields = line.split('\t', QString::SkipEmptyParts);
+        if (fields.size() != 2) {
+            fields = line.split(' ', QString::SkipEmptyParts);
+        }
+        if (fields.size() != 2) {
+            printf("%s:%d: expected an input and an output file\n",
+                   manifest.toUtf8().data(), lineNumber);
+            return false;
+        }
+        BatchJob job;
+        job.input = base.absoluteFilePath(fields[0].trimmed());
+        job.output = base.absoluteFilePath(fields[1].trimmed());
+        job.ok = false;
+        job.solids = 0;
+        job.seconds = 0.0;
+        job.inputBytes = QFileInfo(job.input).size();
+        job.outputBytes = 0;
+        jobs.append(job);
+    }
+    return true;
+}
+
+static bool writeResults(QString results, const QVector<BatchJob>& jobs)
+{
+    QFile file(results);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate |
+                   QIODevice::Text)) {
+        return false;
+    }
+    QTextStream out(&file);
+    out << "# status\tseconds\tinput_bytes\toutput_bytes\tsolids\tinput\toutput\n";
+    for (int j = 0; j < jobs.size(); j++) {
+        const BatchJob& job = jobs[j];
+        out << (job.ok ? "ok" : "failed") << '\t'
+            << QString::number(job.seconds, 'f', 3) << '\t'
+            << job.inputBytes << '\t' << job.outputBytes << '\t'
+            << job.solids << '\t' << job.input << '\t' << job.output << '\n';
+    }
+    out.flush();
+    return file.error() == QFile::NoError;
+}
+
+int runBatch(QString manifest, QString results, const ExportOptions& options)
+{
+    QVector<BatchJob> jobs;
+    if (!readManifest(manifest, jobs)) {
+        printf("Could not read the manifest %s.\n", manifest.toUtf8().data());
+        return -1;
+    }
+
+    // Set up the reader's static state once, not racily in every job.
+    STEPCAFControl_Controller::Init();
+
+    // Big jobs first, so that they do not start last and run alone.
+    QVector<QPair<qint64, int> > bySize;
+    for (int j = 0; j < jobs.size(); j++) {
+        bySize.append(QPair<qint64, int>(-jobs[j].inputBytes, j));
+    }
+    std::sort(bySize.begin(), bySize.end());
+
+    QMutex lock;
+    int done = 0;
+    BatchJob* jobData = jobs.data();
+    stealingFor(jobs.size(), [&](int k) {
+        BatchJob& job = jobData[bySize[k].second];
+        QElapsedTimer timer;
+        timer.start();
+        try {
+            job.ok = Translator::convert(job.input, job.output, options,
+                                         &job.solids);
+        } catch (...) {
+            job.ok = false;
+        }
+        job.seconds = timer.elapsed() / 1000.0;
+        job.outputBytes = job.ok ? QFileInfo(job.output).size() : 0;
+
+        QMutexLocker locker(&lock);
+        done++;
+        printf("[%d/%d] %s %s (%.1f s)\n", done, jobs.size(),
+               job.ok ? "ok" : "FAILED", job.input.toUtf8().data(),
+               job.seconds);
+    }, options.threads);
+
+    if (!writeResults(results, jobs)) {
+        printf("Could not write the results to %s.\n", results.toUtf8().data());
+    }
+    int failed = 0;
+    for (int j = 0; j < jobs.size(); j++) {
+        failed += jobs[j].ok ? 0 : 1;
+    }
+    printf("%d of %d jobs failed.\n", failed, jobs.size());
+    return failed;
+}
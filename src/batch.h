@@ -0,0 +1,17 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "translate.h"
+
+#include <QString>
+
+// Converts every job of a manifest: lines holding an input STEP file and an
+// output GDML file, separated by a tab (or by spaces, if neither path holds
+// any). Blank lines and lines starting with '#' are skipped; relative paths
+// are taken from the manifest's directory. Jobs run side by side on a
+// work-stealing pool, largest input first, and each one's status, time and
+// sizes go to the results file, in manifest order. Returns the number of
+// failed jobs, or -1 if the manifest could not be read.
+int runBatch(QString manifest, QString results, const ExportOptions& options);
+
+#endif // BATCH_H
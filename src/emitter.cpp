@@ -0,0 +1,471 @@
+#include "emitter.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QQueue>
+
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Disk space is reserved at least this far ahead of the writes.
+static const quint64 reserveStep = 64 << 20;
+
+FileSink::FileSink(QString path, bool preallocate) :
+    preallocate(preallocate), written(0), reserved(0)
+{
+    fd = open(path.toUtf8().constData(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+}
+
+FileSink::~FileSink()
+{
+    if (fd >= 0) {
+        close(fd);
+    }
+}
+
+bool FileSink::isOpen() const
+{
+    return fd >= 0;
+}
+
+bool FileSink::write(const char* data, size_t size)
+{
+    if (fd < 0) {
+        return false;
+    }
+    if (preallocate && written + size > reserved) {
+        // Purely advisory; on filesystems without support we carry on.
+        quint64 target = written + size + qMax(reserveStep, reserved / 4);
+        if (posix_fallocate(fd, reserved, target - reserved) == 0) {
+            reserved = target;
+        } else {
+            preallocate = false;
+        }
+    }
+    written += size;
+    while (size > 0) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool FileSink::finish(quint64 total)
+{
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = true;
+    if (reserved > total) {
+        ok = ftruncate(fd, total) == 0;
+    }
+    ok = close(fd) == 0 && ok;
+    fd = -1;
+    return ok;
+}
+
+// Compressed output is passed on in blocks of this size.
+static const int compressedBlock = 1 << 20;
+// Uncompressed buffers which may wait for the compressor.
+static const int maxQueued = 4;
+
+class Compressor
+{
+public:
+    virtual ~Compressor() {}
+    virtual bool isValid() const = 0;
+    // Compresses data into target, counting the bytes produced. With last
+    // set, ends the stream instead.
+    virtual bool compress(const char* data, size_t size, bool last,
+                          OutputSink* target, quint64& produced) = 0;
+};
+
+class GzipCompressor : public Compressor
+{
+public:
+    GzipCompressor() : out(compressedBlock, Qt::Uninitialized)
+    {
+        memset(&stream, 0, sizeof(stream));
+        // 16 more window bits ask for a gzip header and trailer.
+        valid = deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                             15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+    }
+    virtual ~GzipCompressor()
+    {
+        if (valid) {
+            deflateEnd(&stream);
+        }
+    }
+    virtual bool isValid() const
+    {
+        return valid;
+    }
+    virtual bool compress(const char* data, size_t size, bool last,
+                          OutputSink* target, quint64& produced)
+    {
+        // zlib counts in 32 bits.
+        while (size > (1u << 30)) {
+            if (!compress(data, 1u << 30, false, target, produced)) {
+                return false;
+            }
+            data += 1u << 30;
+            size -= 1u << 30;
+        }
+        stream.next_in = (Bytef*)data;
+        stream.avail_in = (uInt)size;
+        for (;;) {
+            stream.next_out = (Bytef*)out.data();
+            stream.avail_out = out.size();
+            int status = deflate(&stream, last ? Z_FINISH : Z_NO_FLUSH);
+            if (status == Z_STREAM_ERROR) {
+                return false;
+            }
+            size_t n = out.size() - stream.avail_out;
+            if (n > 0 && !target->write(out.constData(), n)) {
+                return false;
+            }
+            produced += n;
+            if (last ? status == Z_STREAM_END : stream.avail_out != 0) {
+                return true;
+            }
+        }
+    }
+private:
+    z_stream stream;
+    QByteArray out;
+    bool valid;
+};
+
+#ifdef HAVE_ZSTD
+class ZstdCompressor : public Compressor
+{
+public:
+    ZstdCompressor() : out(compressedBlock, Qt::Uninitialized)
+    {
+        stream = ZSTD_createCStream();
+        valid = stream && !ZSTD_isError(ZSTD_initCStream(stream, 3));
+    }
+    virtual ~ZstdCompressor()
+    {
+        ZSTD_freeCStream(stream);
+    }
+    virtual bool isValid() const
+    {
+        return valid;
+    }
+    virtual bool compress(const char* data, size_t size, bool last,
+                          OutputSink* target, quint64& produced)
+    {
+        ZSTD_inBuffer in = {data, size, 0};
+        size_t remaining = 1;
+        while (last ? remaining > 0 : in.pos < in.size) {
+            ZSTD_outBuffer o = {out.data(), (size_t)out.size(), 0};
+            remaining = last ? ZSTD_endStream(stream, &o) :
+                        ZSTD_compressStream(stream, &o, &in);
+            if (ZSTD_isError(remaining)) {
+                return false;
+            }
+            if (o.pos > 0 && !target->write(out.constData(), o.pos)) {
+                return false;
+            }
+            produced += o.pos;
+        }
+        return true;
+    }
+private:
+    ZSTD_CStream* stream;
+    QByteArray out;
+    bool valid;
+};
+#endif
+
+class CompressorThread : public QThread
+{
+public:
+    CompressorThread(Compressor* compressor, OutputSink* target) :
+        compressor(compressor), target(target), closing(false), ok(true),
+        produced(0)
+    {
+    }
+
+    // Queues a buffer, waiting while the queue is full.
+    void push(const QByteArray& buffer)
+    {
+        QMutexLocker locker(&lock);
+        while (queue.size() >= maxQueued) {
+            spaceFree.wait(&lock);
+        }
+        queue.enqueue(buffer);
+        bufferReady.wakeOne();
+    }
+    // Ends the stream and waits for the thread; false if anything failed.
+    bool close()
+    {
+        {
+            QMutexLocker locker(&lock);
+            closing = true;
+            bufferReady.wakeOne();
+        }
+        wait();
+        return ok;
+    }
+    // Compressed bytes written; only valid after close().
+    quint64 written() const
+    {
+        return produced;
+    }
+protected:
+    virtual void run()
+    {
+        for (;;) {
+            QByteArray buffer;
+            {
+                QMutexLocker locker(&lock);
+                while (queue.isEmpty() && !closing) {
+                    bufferReady.wait(&lock);
+                }
+                if (queue.isEmpty()) {
+                    break;
+                }
+                buffer = queue.dequeue();
+                spaceFree.wakeOne();
+            }
+            // After a failure, keep draining so writers never block.
+            ok = ok && compressor->compress(buffer.constData(), buffer.size(),
+                                            false, target, produced);
+        }
+        ok = ok && compressor->compress(NULL, 0, true, target, produced);
+    }
+private:
+    Compressor* compressor;
+    OutputSink* target;
+    QMutex lock;
+    QWaitCondition bufferReady;
+    QWaitCondition spaceFree;
+    QQueue<QByteArray> queue;
+    bool closing;
+    bool ok;
+    quint64 produced;
+};
+
+CompressingSink::CompressingSink(OutputSink* target, Format format) :
+    target(target), compressor(NULL), thread(NULL)
+{
+    if (format == Gzip) {
+        compressor = new GzipCompressor();
+    }
+#ifdef HAVE_ZSTD
+    if (format == Zstd) {
+        compressor = new ZstdCompressor();
+    }
+#endif
+    if (isValid()) {
+        thread = new CompressorThread(compressor, target);
+        thread->start();
+    }
+}
+
+CompressingSink::~CompressingSink()
+{
+    if (thread) {
+        if (thread->isRunning()) {
+            thread->close();
+        }
+        delete thread;
+    }
+    delete compressor;
+    delete target;
+}
+
+bool CompressingSink::isValid() const
+{
+    return compressor && compressor->isValid();
+}
+
+bool CompressingSink::write(const char* data, size_t size)
+{
+    if (!thread) {
+        return false;
+    }
+    thread->push(QByteArray(data, size));
+    return true;
+}
+
+bool CompressingSink::finish(quint64)
+{
+    if (!thread) {
+        return false;
+    }
+    bool ok = thread->close();
+    return target->finish(thread->written()) && ok;
+}
+
+OutputSink* openOutput(QString path, bool preallocate)
+{
+    FileSink* file = new FileSink(path, preallocate);
+    if (!file->isOpen()) {
+        delete file;
+        return NULL;
+    }
+    CompressingSink* compressed = NULL;
+    if (path.endsWith(".gz")) {
+        compressed = new CompressingSink(file, CompressingSink::Gzip);
+    } else if (path.endsWith(".zst")) {
+        compressed = new CompressingSink(file, CompressingSink::Zstd);
+    } else {
+        return file;
+    }
+    if (!compressed->isValid()) {
+        qWarning("Cannot compress %s; zstd may not be built in.",
+                 path.toUtf8().constData());
+        delete compressed;
+        return NULL;
+    }
+    return compressed;
+}
+
+Emitter::Emitter(OutputSink* sink, size_t capacity) :
+    sink(sink), flushed(0), ok(true)
+{
+    buf = (char*)malloc(capacity);
+    cur = buf;
+    end = buf + capacity;
+}
+
+Emitter::~Emitter()
+{
+    flush();
+    free(buf);
+}
+
+quint64 Emitter::written() const
+{
+    return flushed + (cur - buf);
+}
+
+bool Emitter::flush()
+{
+    if (sink && cur != buf) {
+        ok = sink->write(buf, cur - buf) && ok;
+        flushed += cur - buf;
+        cur = buf;
+    }
+    return ok;
+}
+
+QByteArray Emitter::take()
+{
+    QByteArray data(buf, cur - buf);
+    flushed += cur - buf;
+    cur = buf;
+    return data;
+}
+
+void Emitter::overflow(const char* data, size_t size)
+{
+    size_t capacity = end - buf;
+    if (sink) {
+        flush();
+        if (size >= capacity) {
+            // Too big to be worth copying; pass it straight through.
+            ok = sink->write(data, size) && ok;
+            flushed += size;
+            return;
+        }
+    } else {
+        size_t used = cur - buf;
+        while (capacity < used + size) {
+            capacity *= 2;
+        }
+        buf = (char*)realloc(buf, capacity);
+        cur = buf + used;
+        end = buf + capacity;
+    }
+    memcpy(cur, data, size);
+    cur += size;
+}
+
+// Writes the decimal digits of value, right-aligned, ending just before p.
+static char* formatDigits(char* p, quint64 value)
+{
+    do {
+        *--p = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    return p;
+}
+
+void Emitter::integer(qint64 value)
+{
+    char tmp[24];
+    char* e = tmp + sizeof(tmp);
+    quint64 mag = value < 0 ? 0 - quint64(value) : quint64(value);
+    char* p = formatDigits(e, mag);
+    if (value < 0) {
+        *--p = '-';
+    }
+    text(p, e - p);
+}
+
+void Emitter::real(double value)
+{
+    // Up to 1e15 the integral part is exact, and the fraction left over is
+    // too. Past that, and for inf/nan, defer to printf.
+    double mag = fabs(value);
+    quint64 whole = 0, frac = 0;
+    bool exact = mag < 1e15;
+    if (exact) {
+        whole = quint64(mag);
+        // Scaling rounds, by at most 1e6 * 2^-53 < 2e-10; only when that
+        // could move the fraction across a tie is it rounded inexactly.
+        double scaled = (mag - double(whole)) * 1e6;
+        frac = quint64(scaled);
+        double rest = scaled - double(frac);
+        exact = fabs(rest - 0.5) > 1e-9;
+        if (rest > 0.5) {
+            frac += 1;
+        }
+        if (frac >= 1000000) {
+            whole += 1;
+            frac -= 1000000;
+        }
+    }
+    if (!exact) {
+        char tmp[400];
+        int n = snprintf(tmp, sizeof(tmp), "%f", value);
+        text(tmp, n);
+        return;
+    }
+
+    char tmp[32];
+    char* e = tmp + sizeof(tmp);
+    char* p = e;
+    for (int i = 0; i < 6; i++) {
+        *--p = '0' + frac % 10;
+        frac /= 10;
+    }
+    *--p = '.';
+    p = formatDigits(p, whole);
+    if (signbit(value)) {
+        *--p = '-';
+    }
+    text(p, e - p);
+}
@@ -0,0 +1,136 @@
+#ifndef EMITTER_H
+#define EMITTER_H
+
+#include <QString>
+#include <QByteArray>
+
+#include <string.h>
+
+// Destination for the bytes an Emitter produces.
+class OutputSink
+{
+public:
+    virtual ~OutputSink() {}
+    // Returns false once anything failed to be written.
+    virtual bool write(const char* data, size_t size) = 0;
+    // Called once after the last write; returns false on failure.
+    virtual bool finish(quint64 total) = 0;
+};
+
+// Writes straight to a file descriptor, one write() per block.
+class FileSink : public OutputSink
+{
+public:
+    // Check isOpen() to see whether the file could be created. With
+    // preallocate set, disk space is reserved in large steps ahead of the
+    // writes, so the filesystem can lay the file out contiguously; the
+    // excess is trimmed off by finish().
+    explicit FileSink(QString path, bool preallocate = false);
+    virtual ~FileSink();
+
+    bool isOpen() const;
+
+    virtual bool write(const char* data, size_t size);
+    virtual bool finish(quint64 total);
+private:
+    int fd;
+    bool preallocate;
+    quint64 written;
+    quint64 reserved;
+};
+
+class Compressor;
+class CompressorThread;
+
+// Compresses everything written on a background thread, and passes the
+// result on to another sink, which it owns. Writes only block once a few
+// buffers are waiting to be compressed.
+class CompressingSink : public OutputSink
+{
+public:
+    enum Format {
+        Gzip,
+        Zstd
+    };
+
+    CompressingSink(OutputSink* target, Format format);
+    virtual ~CompressingSink();
+
+    // False if the compressor could not be set up, or is not built in.
+    bool isValid() const;
+
+    virtual bool write(const char* data, size_t size);
+    virtual bool finish(quint64 total);
+private:
+    CompressingSink(const CompressingSink&);
+    void operator=(const CompressingSink&);
+
+    OutputSink* target;
+    Compressor* compressor;
+    CompressorThread* thread;
+};
+
+// Creates the file at path, compressing it if the name ends in .gz or
+// .zst. Returns NULL if that is not possible.
+OutputSink* openOutput(QString path, bool preallocate = false);
+
+// A buffered text writer with hand-written number formatting. This avoids
+// the format parsing, locale lookups and stream locking of stdio, which
+// dominate the cost of writing large meshes.
+class Emitter
+{
+public:
+    // Flushes to the sink (which it does not own) whenever the buffer fills.
+    // Without a sink, the buffer grows instead; see take().
+    explicit Emitter(OutputSink* sink = NULL, size_t capacity = 1 << 20);
+    ~Emitter();
+
+    template <size_t N> void text(const char (&literal)[N])
+    {
+        text(literal, N - 1);
+    }
+    void text(const char* data, size_t size)
+    {
+        if (size > size_t(end - cur)) {
+            overflow(data, size);
+            return;
+        }
+        memcpy(cur, data, size);
+        cur += size;
+    }
+    void text(const QByteArray& data)
+    {
+        text(data.constData(), data.size());
+    }
+    void character(char c)
+    {
+        if (cur == end) {
+            overflow(&c, 1);
+            return;
+        }
+        *cur++ = c;
+    }
+    void integer(qint64 value);
+    // Formats like printf("%f"): fixed point with six decimals.
+    void real(double value);
+
+    // Bytes emitted so far, flushed or not.
+    quint64 written() const;
+    // Passes everything buffered on to the sink; false if the sink failed.
+    bool flush();
+    // Without a sink: returns everything emitted so far, and starts afresh.
+    QByteArray take();
+private:
+    Emitter(const Emitter&);
+    void operator=(const Emitter&);
+    void overflow(const char* data, size_t size);
+
+    OutputSink* sink;
+    char* buf;
+    char* cur;
+    char* end;
+    quint64 flushed;
+    bool ok;
+};
+
+#endif // EMITTER_H
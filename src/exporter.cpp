@@ -0,0 +1,84 @@
+#include "exporter.h"
+#include "parallel.h"
+
+#include <QMutexLocker>
+
+Exporter::Exporter(QString path, const Model& model,
+                   const ExportOptions& options) :
+    path(path), model(model.snapshot()), options(options), cancelled(0),
+    holding(1), ok(false), lastStage(NULL), lastPercent(-1)
+{
+    // OpenCASCADE is about to be used from two threads.
+    workerCount(1);
+    this->options.progress = this;
+}
+
+Exporter::~Exporter()
+{
+    delete options.keep;
+}
+
+QString Exporter::fileName() const
+{
+    return path;
+}
+
+void Exporter::cancel()
+{
+    cancelled.fetchAndStoreOrdered(1);
+}
+
+bool Exporter::isCancelled()
+{
+    return cancelled.loadAcquire() != 0;
+}
+
+bool Exporter::succeeded()
+{
+    QMutexLocker locker(&lock);
+    return ok;
+}
+
+MeshSet* Exporter::takeKept()
+{
+    QMutexLocker locker(&lock);
+    if (!ok || !options.keep || options.keep->key.isEmpty()) {
+        return NULL;
+    }
+    MeshSet* kept = options.keep;
+    options.keep = NULL;
+    return kept;
+}
+
+bool Exporter::holdsShapes()
+{
+    return holding.loadAcquire() != 0;
+}
+
+void Exporter::shapesDone()
+{
+    holding.fetchAndStoreOrdered(0);
+    emit shapesReleased();
+}
+
+void Exporter::progress(const char* stage, double fraction)
+{
+    int percent = qBound(0, int(fraction * 100.0), 100);
+    if (stage == lastStage && percent == lastPercent) {
+        return;
+    }
+    lastStage = stage;
+    lastPercent = percent;
+    emit progressed(QString(stage), percent);
+}
+
+void Exporter::run()
+{
+    bool done = Translator::exportGDML(path, model, options);
+    // Also when it gave up early.
+    if (holdsShapes()) {
+        shapesDone();
+    }
+    QMutexLocker locker(&lock);
+    ok = done && !isCancelled();
+}
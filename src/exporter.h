@@ -0,0 +1,61 @@
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include "translate.h"
+#include "gdmlwriter.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QAtomicInt>
+
+// Exports a GDML file on a thread of its own, from a snapshot of the model
+// taken on construction, so the window stays usable and the model may be
+// edited meanwhile. The shapes are only copied on that thread, and must not
+// be meshed elsewhere until then.
+class Exporter : public QThread, public ExportProgress
+{
+    Q_OBJECT
+public:
+    // Takes ownership of options.keep; what options points to otherwise
+    // must stay untouched until the thread has finished.
+    Exporter(QString path, const Model& model, const ExportOptions& options);
+    virtual ~Exporter();
+
+    QString fileName() const;
+    // Asks the export to stop soon; the file is then left as it was.
+    void cancel();
+    // Both only valid once the thread has finished. takeKept() hands over
+    // the kept meshes if the export succeeded and recorded any, else NULL.
+    bool succeeded();
+    MeshSet* takeKept();
+    // Whether the export may still read the shapes.
+    bool holdsShapes();
+
+    virtual void progress(const char* stage, double fraction);
+    virtual bool isCancelled();
+    virtual void shapesDone();
+
+signals:
+    void progressed(QString stage, int percent);
+    // The shapes may be meshed elsewhere again.
+    void shapesReleased();
+
+protected:
+    virtual void run();
+
+private:
+    QString path;
+    Model model;
+    ExportOptions options;
+    QAtomicInt cancelled;
+    QAtomicInt holding;
+
+    QMutex lock;
+    bool ok;
+
+    // Only touched by the exporting thread.
+    const char* lastStage;
+    int lastPercent;
+};
+
+#endif // EXPORTER_H
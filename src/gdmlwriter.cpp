@@ -1,24 +1,40 @@
 #include "gdmlwriter.h"
+#include "emitter.h"
+#include "parallel.h"
+#include "primitives.h"
+#include "stats.h"
+#include "trace.h"
 
 #include <QSet>
 #include <QMap>
+#include <QPair>
+#include <QVector>
+#include <QElapsedTimer>
+#include <QTemporaryFile>
 
 #include <BRepBndLib.hxx>
 #include <StlAPI_Writer.hxx>
 #include <Standard_Version.hxx>
-#include <Poly_CoherentTriangulation.hxx> // Since 0x060300 ?
+#include <gp_Mat.hxx>
+#include <gp_Vec.hxx>
+
+#include <stdio.h>
+#include <math.h>
+
+#include <algorithm>
 
 QString GdmlWriter::defaultMaterial()
 {
     return QString("VACUUM");
 }
 
-GdmlWriter::GdmlWriter(QString filename)
+GdmlWriter::GdmlWriter(QString filename, bool preallocate)
 {
-    f = fopen(filename.toUtf8().data(), "w");
-    if (!f) {
+    sink = openOutput(filename, preallocate);
+    if (!sink) {
         throw "FAIL";
     }
+    out = new Emitter(sink);
 
     bounds = Bnd_Box();
 }
@@ -38,10 +54,44 @@ static QByteArray convName(const QString& name) {
 
 GdmlWriter::~GdmlWriter()
 {
-    fclose(f);
+    if (out) {
+        close();
+    }
+}
+
+bool GdmlWriter::close()
+{
+    StatsPhase phase(stats, "finish");
+    bool ok = out->flush() && !spillFailed;
+    ok = sink->finish(out->written()) && ok;
+    if (!ok) {
+        qWarning("Failed to write GDML file.");
+    }
+    delete out;
+    delete sink;
+    out = NULL;
+    sink = NULL;
+    return ok;
 }
 
-#define _(...) fprintf (f, __VA_ARGS__)
+void GdmlWriter::setProgress(ExportProgress* p)
+{
+    progress = p;
+}
+
+void GdmlWriter::report(const char* stage, int done, int total)
+{
+    if (progress) {
+        progress->progress(stage, total > 0 ? double(done) / total : 1.0);
+    }
+}
+
+bool GdmlWriter::isCancelled() const
+{
+    return progress && progress->isCancelled();
+}
+
+#define _(literal) out->text(literal)
 
 void GdmlWriter::writeMaterials()
 {
@@ -57,6 +107,11 @@ void GdmlWriter::writeMaterials()
     _("  </materials>\n");
 }
 
+void GdmlWriter::setStats(Stats* theStats)
+{
+    stats = theStats;
+}
+
 void GdmlWriter::writeIntro()
 {
     _("<?xml version=\"1.0\" encoding=\"UTF-8\" ?>\n");
@@ -76,38 +131,483 @@ bool operator <(const gp_XYZ& a, const gp_XYZ& b)
     return a.X() < b.X();
 }
 
-Handle_Poly_CoherentTriangulation triangulateShape(TopoDS_Shape shape);
-void GdmlWriter::addSolid(TopoDS_Shape shape, QString name, QString material)
+// Vertex names are the index of their solid and their index within it, in
+// base 32, joined by a W; so a solid's text does not depend on any other.
+// Uppercase, as Geant4 strips "0x" pointer suffixes from some names; and
+// no other position name may be purely alphanumeric.
+static void writeVertexName(Emitter* out, int solid, int index)
+{
+    static const char digits[] = "0123456789ABCDEFGHIJKLMNOPQRSTUV";
+    char buf[16];
+    char* e = buf + sizeof(buf);
+    char* p = e;
+    unsigned value = index;
+    do {
+        *--p = digits[value % 32];
+        value /= 32;
+    } while (value);
+    *--p = 'W';
+    value = solid;
+    do {
+        *--p = digits[value % 32];
+        value /= 32;
+    } while (value);
+    out->text(p, e - p);
+}
+
+static void writePositions(Emitter* out, const TriangleMesh& aMesh,
+                           int solid)
 {
-    Handle_Poly_CoherentTriangulation aMesh = triangulateShape(shape);
+    for (int i = 0; i < aMesh.nodeCount(); i++) {
+        const double* vert = &aMesh.nodes[3 * i];
+        _("    <position name=\"");
+        writeVertexName(out, solid, i);
+        _("\" x=\"");
+        out->real(vert[0]);
+        _("\" y=\"");
+        out->real(vert[1]);
+        _("\" z=\"");
+        out->real(vert[2]);
+        _("\"/>\n");
+    }
+}
+
+// The solid elements are written up to the name by the caller, as names
+// may change between exports while the rest of the element does not.
+static void writeTessellated(Emitter* out, const TriangleMesh& aMesh,
+                             int solid)
+{
+    _("\">\n");
+    for (int i = 0; i < aMesh.triangleCount(); i++) {
+        const int* tri = &aMesh.triangles[3 * i];
+        _("      <triangular vertex1=\"");
+        writeVertexName(out, solid, tri[0]);
+        _("\" vertex2=\"");
+        writeVertexName(out, solid, tri[1]);
+        _("\" vertex3=\"");
+        writeVertexName(out, solid, tri[2]);
+        _("\" type=\"ABSOLUTE\"/>\n");
+    }
+    _("    </tessellated>\n");
+}
+
+static const char* primitiveName(const Primitive& primitive)
+{
+    switch (primitive.kind) {
+    case Primitive::Box:
+        return "box";
+    case Primitive::Tube:
+        return "tube";
+    case Primitive::Cone:
+        return "cone";
+    case Primitive::Sphere:
+        return "sphere";
+    case Primitive::Extrusion:
+        return "xtru";
+    case Primitive::Revolution:
+        return "genericPolycone";
+    default:
+        return "tessellated";
+    }
+}
+
+static void writePrimitive(Emitter* out, const Primitive& primitive)
+{
+    switch (primitive.kind) {
+    case Primitive::Box:
+        _("\" x=\"");
+        out->real(primitive.dx);
+        _("\" y=\"");
+        out->real(primitive.dy);
+        _("\" z=\"");
+        out->real(primitive.dz);
+        _("\" lunit=\"mm\"/>\n");
+        return;
+    case Primitive::Tube:
+        _("\" rmin=\"");
+        out->real(primitive.rmin1);
+        _("\" rmax=\"");
+        out->real(primitive.rmax1);
+        _("\" z=\"");
+        out->real(primitive.dz);
+        break;
+    case Primitive::Cone:
+        _("\" rmin1=\"");
+        out->real(primitive.rmin1);
+        _("\" rmax1=\"");
+        out->real(primitive.rmax1);
+        _("\" rmin2=\"");
+        out->real(primitive.rmin2);
+        _("\" rmax2=\"");
+        out->real(primitive.rmax2);
+        _("\" z=\"");
+        out->real(primitive.dz);
+        break;
+    case Primitive::Sphere:
+        _("\" rmin=\"");
+        out->real(primitive.rmin1);
+        _("\" rmax=\"");
+        out->real(primitive.rmax1);
+        _("\" starttheta=\"0\" deltatheta=\"180");
+        break;
+    case Primitive::Extrusion:
+        _("\" lunit=\"mm\">\n");
+        for (int i = 0; i < primitive.polygon.size(); i++) {
+            _("      <twoDimVertex x=\"");
+            out->real(primitive.polygon[i].X());
+            _("\" y=\"");
+            out->real(primitive.polygon[i].Y());
+            _("\"/>\n");
+        }
+        _("      <section zOrder=\"0\" zPosition=\"");
+        out->real(-primitive.dz / 2);
+        _("\" xOffset=\"0\" yOffset=\"0\" scalingFactor=\"1\"/>\n");
+        _("      <section zOrder=\"1\" zPosition=\"");
+        out->real(primitive.dz / 2);
+        _("\" xOffset=\"0\" yOffset=\"0\" scalingFactor=\"1\"/>\n");
+        _("    </xtru>\n");
+        return;
+    case Primitive::Revolution:
+        _("\" startphi=\"0\" deltaphi=\"360\" aunit=\"deg\" lunit=\"mm\">\n");
+        for (int i = 0; i < primitive.polygon.size(); i++) {
+            _("      <rzpoint r=\"");
+            out->real(primitive.polygon[i].X());
+            _("\" z=\"");
+            out->real(primitive.polygon[i].Y());
+            _("\"/>\n");
+        }
+        _("    </genericPolycone>\n");
+        return;
+    default:
+        break;
+    }
+    _("\" startphi=\"0\" deltaphi=\"360\" aunit=\"deg\" lunit=\"mm\"/>\n");
+}
+
+// Starting size of the per-solid chunk buffers.
+static const size_t chunkCapacity = 64 << 10;
+
+QVector<bool> SolidChunks::fitting(const Mesher& mesher) const
+{
+    QVector<bool> fit(mesher.count(), false);
+    if (keys.size() != mesher.count()) {
+        return fit;
+    }
+    QVector<QByteArray> wanted = mesher.solidKeys();
+    for (int s = 0; s < fit.size(); s++) {
+        fit[s] = !keys[s].isEmpty() && keys[s] == wanted[s];
+    }
+    return fit;
+}
 
+void SolidChunks::resize(int count)
+{
+    keys.resize(count);
+    positions.resize(count);
+    kinds.resize(count);
+    bodies.resize(count);
+    boxes.resize(count);
+    frames.resize(count);
+    primitive.resize(count);
+    vertices.resize(count);
+    triangles.resize(count);
+    undecimated.resize(count);
+}
+
+qint64 SolidChunks::size() const
+{
+    qint64 total = 0;
+    for (int s = 0; s < keys.size(); s++) {
+        total += positions[s].size() + bodies[s].size();
+    }
+    return total;
+}
+
+static void reportSolid(const SolidChunks& solids, int s,
+                        const QByteArray& name, int uses)
+{
+    QByteArray instances;
+    if (uses > 1) {
+        instances = " (x" + QByteArray::number(uses) + ")";
+    }
+    if (solids.primitive[s]) {
+        printf("%34s <- %s%s\n", solids.kinds[s].data(), name.data(),
+               instances.data());
+    } else if (solids.undecimated[s] != solids.triangles[s]) {
+        printf("% 6d vertices, % 6d triangles (from % 6d) <- %s%s\n",
+               solids.vertices[s], solids.triangles[s], solids.undecimated[s],
+               name.data(), instances.data());
+    } else {
+        printf("% 6d vertices, % 6d triangles <- %s%s\n", solids.vertices[s],
+               solids.triangles[s], name.data(), instances.data());
+    }
+}
+
+static void recordSolids(Stats* stats, const SolidChunks& solids,
+                         const QVector<QByteArray>& names,
+                         const QVector<int>& uses,
+                         const QVector<qint64>& meshTimes,
+                         const QVector<qint64>& bytes)
+{
+    stats->setSolidCount(names.size());
+    for (int s = 0; s < names.size(); s++) {
+        stats->setSolid(s, names[s], solids.kinds[s].constData(), uses[s]);
+        stats->setMesh(s, solids.vertices[s], solids.triangles[s], meshTimes[s]);
+        stats->addBytes(s, bytes[s]);
+    }
+}
+
+void GdmlWriter::writeSolidHead(const SolidChunks& solids, int s)
+{
+    _("    <");
+    out->text(solids.kinds[s]);
+    _(" name=\"T-");
+    out->text(solidNames[s]);
+}
+
+void GdmlWriter::writeSolids(Mesher& mesher, const QList<QString>& shapeNames,
+                             const QList<QString>& shapeMaterials, int threads,
+                             SolidChunks* chunks)
+{
+    names = shapeNames;
+    materials = shapeMaterials;
+
+    // A solid is named after the first shape using it.
+    int count = mesher.count();
+    solidNames.fill(QByteArray(), count);
+    solidOf.resize(mesher.shapeCount());
+    placements.resize(mesher.shapeCount());
+    QVector<int> uses(count, 0);
+    for (int i = 0; i < mesher.shapeCount(); i++) {
+        int s = mesher.solidOf(i);
+        solidOf[i] = s;
+        placements[i] = mesher.placement(i);
+        if (uses[s]++ == 0) {
+            solidNames[s] = convName(names[i]);
+        }
+    }
+
+    QVector<bool> reused(count, false);
+    if (chunks) {
+        reused = chunks->fitting(mesher);
+    }
+    if (count > 0 && !reused.contains(false)) {
+        report("Writing solids", 0, 1);
+        spliceSolids(*chunks, uses);
+        return;
+    }
+    // Without chunks to fill, only the small per-solid facts are kept.
+    SolidChunks fresh;
+    SolidChunks& made = chunks ? *chunks : fresh;
+    made.resize(count);
+
+    // Positions must all come before the solids using them, so this takes
+    // two passes. The first meshes and formats solids on worker threads,
+    // while this thread writes their positions in order, or the reused
+    // ones, and puts the rest aside; meshes never outlive the pipeline's
+    // window. The second writes the solids put aside. Solids which are
+    // exactly a GDML primitive are written as such, and not meshed at all.
+    QVector<Primitive> primitives(count);
+    QVector<Bnd_Box> boxes(count);
+    QVector<int> nodeCounts(count, 0);
+    QVector<int> triangleCounts(count, 0);
+    Primitive* primitiveData = primitives.data();
+    Bnd_Box* boxData = boxes.data();
+    int* nodeCountData = nodeCounts.data();
+    int* triangleCountData = triangleCounts.data();
+
+    QVector<qint64> meshTimes(count, 0);
+    QVector<qint64> bytes(count, 0);
+    qint64* meshTimeData = meshTimes.data();
+
+    QVector<bool> skip(count);
+    {
+        StatsPhase phase(stats, "recognize");
+        report("Recognizing primitives", 0, 1);
+        parallelFor(count, [&](int s) {
+            if (!reused[s] && !isCancelled()) {
+                primitiveData[s] = recognizePrimitive(mesher.solid(s));
+            }
+        }, threads);
+    }
+    for (int s = 0; s < count; s++) {
+        skip[s] = reused[s] || primitives[s].kind != Primitive::None;
+    }
+    {
+        StatsPhase phase(stats, "budget");
+        report("Fitting the triangle budget", 0, 1);
+        mesher.fitBudget(skip, threads);
+    }
+
+    // Bodies wait in a temporary file for the second pass, unless they are
+    // kept as chunks anyway, or there is no such file to be had.
+    QTemporaryFile spill;
+    bool spilling = !chunks && spill.open();
+    QVector<qint64> bodySizes(count, 0);
+    QVector<int> splits(count, 0);
+    int* splitData = splits.data();
+
+    // The pipeline overlaps meshing, formatting and writing, which are
+    // timed as work on their own.
+    {
+        StatsPhase phase(stats, "positions");
+        _("  <define>\n");
+        orderedPipeline(count, [&](int s) {
+            if (reused[s]) {
+                return QByteArray();
+            }
+            if (isCancelled()) {
+                // The file is thrown away; only keep the pipeline moving.
+                return QByteArray();
+            }
+            Emitter chunk(NULL, chunkCapacity);
+            if (primitiveData[s].kind != Primitive::None) {
+                boxData[s] = primitiveData[s].bounds();
+                StatsWork work(stats, "format");
+                writePrimitive(&chunk, primitiveData[s]);
+                return chunk.take();
+            }
+
+            TRACE_SPAN("meshSolid");
+            QElapsedTimer timer;
+            timer.start();
+            TriangleMesh aMesh;
+            {
+                StatsWork work(stats, "mesh");
+                aMesh = mesher.mesh(s);
+            }
+            // With a budget, the meshing itself was done while fitting it.
+            meshTimeData[s] = timer.nsecsElapsed() + mesher.budgetTime(s);
+            nodeCountData[s] = aMesh.nodeCount();
+            triangleCountData[s] = aMesh.triangleCount();
+            for (int j = 0; j < aMesh.nodeCount(); j++) {
+                const double* vert = &aMesh.nodes[3 * j];
+                boxData[s].Update(vert[0], vert[1], vert[2]);
+            }
+
+            StatsWork work(stats, "format");
+            writePositions(&chunk, aMesh, s);
+            splitData[s] = int(chunk.written());
+            writeTessellated(&chunk, aMesh, s);
+            return chunk.take();
+        }, [&](int s, const QByteArray & chunk) {
+            StatsWork work(stats, "write");
+            if (reused[s]) {
+                out->text(made.positions[s]);
+                bytes[s] += made.positions[s].size();
+                boxData[s] = made.boxes[s];
+            } else {
+                QByteArray positions = chunk.left(splits[s]);
+                QByteArray body = chunk.mid(splits[s]);
+                out->text(positions);
+                bytes[s] += positions.size();
+                bodySizes[s] = body.size();
+                if (spilling) {
+                    if (spill.write(body) != body.size()) {
+                        spillFailed = true;
+                    }
+                } else {
+                    made.bodies[s] = body;
+                }
+                const Primitive& primitive = primitiveData[s];
+                made.positions[s] = chunks ? positions : QByteArray();
+                made.kinds[s] = primitiveName(primitive);
+                made.primitive[s] = primitive.kind != Primitive::None;
+                made.frames[s] = primitive.frame;
+                made.vertices[s] = nodeCounts[s];
+                made.triangles[s] = triangleCounts[s];
+                made.undecimated[s] = made.primitive[s] ? 0 :
+                                      mesher.undecimatedCount(s);
+            }
+            reportSolid(made, s, solidNames[s], uses[s]);
+            report("Meshing", s + 1, count);
+        }, threads);
+        _("  </define>\n");
+    }
+
+    made.boxes = boxes;
+    placeSolids(made);
+
+    {
+        StatsPhase phase(stats, "solids");
+        _("  <solids>\n");
+        if (spilling && !spill.seek(0)) {
+            spillFailed = true;
+        }
+        for (int s = 0; s < count; s++) {
+            quint64 before = out->written();
+            writeSolidHead(made, s);
+            if (spilling && !reused[s]) {
+                QByteArray body = spill.read(bodySizes[s]);
+                if (body.size() != bodySizes[s]) {
+                    spillFailed = true;
+                }
+                out->text(body);
+            } else {
+                out->text(made.bodies[s]);
+            }
+            bytes[s] += out->written() - before;
+            report("Writing solids", s + 1, count);
+        }
+        writeEnvelopes();
+        _("  </solids>\n");
+    }
+
+    // Skipped solids were left empty; never splice them in.
+    if (isCancelled()) {
+        made.keys.fill(QByteArray());
+    } else {
+        made.keys = mesher.solidKeys();
+    }
+    if (stats) {
+        recordSolids(stats, made, solidNames, uses, meshTimes, bytes);
+    }
+}
+
+void GdmlWriter::placeSolids(const SolidChunks& solids)
+{
+    // Primitives sit at the origin of their own frame.
+    for (int i = 0; i < solidOf.size(); i++) {
+        if (solids.primitive[solidOf[i]]) {
+            placements[i] = placements[i] * solids.frames[solidOf[i]];
+        }
+    }
+    solidBoxes = solids.boxes;
+    layoutAssemblies();
+}
+
+void GdmlWriter::spliceSolids(const SolidChunks& solids,
+                              const QVector<int>& uses)
+{
+    StatsPhase phase(stats, "splice");
+    QVector<qint64> bytes(solids.bodies.size(), 0);
     _("  <define>\n");
-    for (int i = 0; i < aMesh->NNodes(); i++) {
-        const Poly_CoherentNode& vert = aMesh->Node(i);
-        _("    <position name=\"%d\" x=\"%f\" y=\"%f\" z=\"%f\" unit=\"mm\"/>\n",
-          i, vert.X(), vert.Y(), vert.Z());
+    for (int s = 0; s < solids.positions.size(); s++) {
+        out->text(solids.positions[s]);
+        bytes[s] += solids.positions[s].size();
+        reportSolid(solids, s, solidNames[s], uses[s]);
     }
     _("  </define>\n");
 
+    placeSolids(solids);
+
     _("  <solids>\n");
-    _("    <tessellated name=\"T-%s\">\n", convName(name).data());
-    for (int i=0;i<aMesh->NTriangles();i++) {
-        const Poly_CoherentTriangle& tri = aMesh->Triangle(i);
-         _("      <triangular vertex1=\"%d\" vertex2=\"%d\" vertex3=\"%d\" type=\"ABSOLUTE\"/>\n",
-              tri.Node(0), tri.Node(1), tri.Node(2));
+    for (int s = 0; s < solids.bodies.size(); s++) {
+        quint64 before = out->written();
+        writeSolidHead(solids, s);
+        out->text(solids.bodies[s]);
+        bytes[s] += out->written() - before;
     }
-    _("    </tessellated>\n");
+    writeEnvelopes();
     _("  </solids>\n");
 
-    names.append(name);
-    materials.append(material);
-    BRepBndLib::Add(shape, bounds);
-
-    printf("% 6d vertices, % 6d triangles <- %s\n", aMesh->NNodes(), aMesh->NTriangles(),
-           convName(name).data());
+    if (stats) {
+        recordSolids(stats, solids, solidNames, uses,
+                     QVector<qint64>(bytes.size(), 0), bytes);
+    }
 }
 
-void GdmlWriter::writeWorldBox()
+static void worldExtent(const Bnd_Box& bounds, double c[3], double sz[3])
 {
     const Standard_Real buffer = 5.0;
     Standard_Real xMin, xMax, yMin, yMax, zMin, zMax;
@@ -119,49 +619,357 @@ void GdmlWriter::writeWorldBox()
     yMax += buffer;
     zMax += buffer;
 
-    double cx, cy, cz, sx, sy, sz;
-    cx = (xMin + xMax) / 2;
-    cy = (yMin + yMax) / 2;
-    cz = (zMin + zMax) / 2;
-    sx = (xMax - xMin);
-    sy = (yMax - yMin);
-    sz = (zMax - zMin);
+    c[0] = (xMin + xMax) / 2;
+    c[1] = (yMin + yMax) / 2;
+    c[2] = (zMin + zMax) / 2;
+    sz[0] = (xMax - xMin);
+    sz[1] = (yMax - yMin);
+    sz[2] = (zMax - zMin);
+}
 
-    _("  <define>\n");
-    _("    <position name=\"center\" x=\"%f\" y=\"%f\" z=\"%f\" unit=\"mm\"/>\n",
-      -cx, -cy, -cz);
-    _("  </define>\n");
+static bool isRigid(const gp_Trsf& trsf)
+{
+    return fabs(trsf.ScaleFactor() - 1.0) < 1e-9 && !trsf.IsNegative();
+}
 
-    _("  <solids>\n");
-    _("    <box name=\"worldbox\" x=\"%f\" y=\"%f\" z=\"%f\" lunit=\"mm\"/>\n", sx,
-      sy, sz);
-    _("  </solids>\n");
+// Room left around the contents of an assembly's envelope, in mm.
+static const Standard_Real envelopeMargin = 1e-3;
+
+// Whether the interiors of two boxes intersect; boxes which merely touch
+// may sit side by side in one mother.
+static bool overlaps(const Bnd_Box& a, const Bnd_Box& b)
+{
+    const Standard_Real tolerance = 1e-6;
+    if (a.IsVoid() || b.IsVoid()) {
+        return false;
+    }
+    Standard_Real aMin[3], aMax[3], bMin[3], bMax[3];
+    a.Get(aMin[0], aMin[1], aMin[2], aMax[0], aMax[1], aMax[2]);
+    b.Get(bMin[0], bMin[1], bMin[2], bMax[0], bMax[1], bMax[2]);
+    for (int k = 0; k < 3; k++) {
+        if (aMin[k] >= bMax[k] - tolerance || bMin[k] >= aMax[k] - tolerance) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Box grown by margin on every side.
+static Bnd_Box grown(const Bnd_Box& box, Standard_Real margin)
+{
+    Standard_Real xMin, xMax, yMin, yMax, zMin, zMax;
+    box.Get(xMin, yMin, zMin, xMax, yMax, zMax);
+    Bnd_Box result;
+    result.Update(xMin - margin, yMin - margin, zMin - margin,
+                  xMax + margin, yMax + margin, zMax + margin);
+    return result;
+}
+
+void GdmlWriter::setAssemblies(const QVector<AssemblyMetadata>& theAssemblies,
+                               const QVector<int>& theAssemblyOf)
+{
+    assemblies = theAssemblies;
+    assemblyOf = theAssemblyOf;
+}
+
+// Nearest ancestor of assembly a (itself included) which is kept.
+static int keptAncestor(const QVector<AssemblyMetadata>& assemblies,
+                        const QVector<bool>& kept, int a)
+{
+    while (a >= 0 && !kept[a]) {
+        a = assemblies[a].parent;
+    }
+    return a;
+}
+
+void GdmlWriter::layoutAssemblies()
+{
+    int count = assemblies.size();
+    if (assemblyOf.size() != names.size()) {
+        assemblyOf.fill(-1, names.size());
+    }
+
+    // Subassemblies are handled before the assemblies holding them.
+    QVector<QPair<int, int> > byDepth;
+    for (int a = 0; a < count; a++) {
+        int depth = 0;
+        for (int p = assemblies[a].parent; p >= 0; p = assemblies[p].parent) {
+            depth++;
+        }
+        byDepth.append(QPair<int, int>(-depth, a));
+    }
+    std::sort(byDepth.begin(), byDepth.end());
+    order.clear();
+    for (int k = 0; k < count; k++) {
+        order.append(byDepth[k].second);
+    }
+
+    // Every assembly becomes an envelope box in its own frame. One which
+    // would overlap a sibling is dissolved into its parent instead, which
+    // may in turn cause further overlaps, so repeat until nothing changes.
+    kept.fill(true, count);
+    for (int a = 0; a < count; a++) {
+        kept[a] = isRigid(assemblies[a].location);
+    }
+    QVector<Bnd_Box> local;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        motherOf.resize(count);
+        for (int a = 0; a < count; a++) {
+            motherOf[a] = keptAncestor(assemblies, kept, assemblies[a].parent);
+        }
+        containerOf.resize(names.size());
+        for (int i = 0; i < names.size(); i++) {
+            containerOf[i] = keptAncestor(assemblies, kept, assemblyOf[i]);
+        }
+
+        // Boxes of the contents of each mother, in its frame; the world is
+        // the last entry.
+        QVector<QVector<QPair<Bnd_Box, int> > > contents(count + 1);
+        local.fill(Bnd_Box(), count);
+        for (int i = 0; i < names.size(); i++) {
+            int m = containerOf[i];
+            gp_Trsf trsf = placements[i];
+            if (m >= 0) {
+                trsf = assemblies[m].location.Inverted() * trsf;
+            }
+            Bnd_Box box = solidBoxes[solidOf[i]].Transformed(trsf);
+            contents[m >= 0 ? m : count].append(QPair<Bnd_Box, int>(box, -1));
+            if (m >= 0) {
+                local[m].Add(box);
+            }
+        }
+        for (int k = 0; k < count; k++) {
+            int a = order[k];
+            if (!kept[a]) {
+                continue;
+            }
+            if (local[a].IsVoid()) {
+                kept[a] = false;
+                continue;
+            }
+            // Contents touching their envelope's walls trip overlap checks,
+            // so leave some room; siblings are checked against the box as
+            // grown, which is what gets written.
+            local[a] = grown(local[a], envelopeMargin);
+            int m = motherOf[a];
+            gp_Trsf trsf = assemblies[a].location;
+            if (m >= 0) {
+                trsf = assemblies[m].location.Inverted() * trsf;
+            }
+            Bnd_Box box = local[a].Transformed(trsf);
+            contents[m >= 0 ? m : count].append(QPair<Bnd_Box, int>(box, a));
+            if (m >= 0) {
+                local[m].Add(box);
+            }
+        }
+
+        for (int m = 0; m <= count; m++) {
+            const QVector<QPair<Bnd_Box, int> >& siblings = contents[m];
+            for (int j = 0; j < siblings.size(); j++) {
+                if (siblings[j].second < 0) {
+                    continue;
+                }
+                for (int k = 0; k < siblings.size(); k++) {
+                    if (k != j && overlaps(siblings[j].first, siblings[k].first)) {
+                        kept[siblings[j].second] = false;
+                        changed = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    // Envelopes are centered on their contents.
+    frames.resize(count);
+    envelopes.resize(count);
+    bounds = Bnd_Box();
+    for (int a = 0; a < count; a++) {
+        if (!kept[a]) {
+            continue;
+        }
+        Standard_Real xMin, xMax, yMin, yMax, zMin, zMax;
+        local[a].Get(xMin, yMin, zMin, xMax, yMax, zMax);
+        gp_Trsf center;
+        center.SetTranslation(gp_Vec((xMin + xMax) / 2, (yMin + yMax) / 2,
+                                     (zMin + zMax) / 2));
+        frames[a] = assemblies[a].location * center;
+        envelopes[a] = gp_XYZ(xMax - xMin, yMax - yMin, zMax - zMin);
+        if (motherOf[a] < 0) {
+            bounds.Add(local[a].Transformed(assemblies[a].location));
+        }
+    }
+    for (int i = 0; i < names.size(); i++) {
+        if (containerOf[i] < 0) {
+            bounds.Add(solidBoxes[solidOf[i]].Transformed(placements[i]));
+        }
+    }
+
+    // Subassemblies are often instanced, so their names repeat.
+    QSet<QByteArray> used;
+    assemblyNames.fill(QByteArray(), count);
+    for (int a = 0; a < count; a++) {
+        QByteArray name = convName(assemblies[a].name);
+        for (int n = 2; used.contains(name); n++) {
+            name = convName(assemblies[a].name) + "_" + QByteArray::number(n);
+        }
+        used.insert(name);
+        assemblyNames[a] = name;
+    }
+}
+
+void GdmlWriter::writeEnvelopes()
+{
+    for (int k = 0; k < order.size(); k++) {
+        int a = order[k];
+        if (!kept[a]) {
+            continue;
+        }
+        _("    <box name=\"E-");
+        out->text(assemblyNames[a]);
+        _("\" x=\"");
+        out->real(envelopes[a].X());
+        _("\" y=\"");
+        out->real(envelopes[a].Y());
+        _("\" z=\"");
+        out->real(envelopes[a].Z());
+        _("\" lunit=\"mm\"/>\n");
+    }
+
+    double c[3], sz[3];
+    worldExtent(bounds, c, sz);
+    _("    <box name=\"worldbox\" x=\"");
+    out->real(sz[0]);
+    _("\" y=\"");
+    out->real(sz[1]);
+    _("\" z=\"");
+    out->real(sz[2]);
+    _("\" lunit=\"mm\"/>\n");
+}
+
+// Writes a physvol of the named volume, placed by trsf in its mother.
+static void writePhysvol(Emitter* out, const QByteArray& name,
+                         const QByteArray& volume, const gp_Trsf& trsf)
+{
+    _("      <physvol name=\"P-");
+    out->text(name);
+    _("\">\n        <volumeref ref=\"");
+    out->text(volume);
+    _("\"/>\n");
+
+    gp_XYZ t = trsf.TranslationPart();
+    _("        <position x=\"");
+    out->real(t.X());
+    _("\" y=\"");
+    out->real(t.Y());
+    _("\" z=\"");
+    out->real(t.Z());
+    _("\"/>\n");
+
+    if (trsf.Form() != gp_Identity && trsf.Form() != gp_Translation) {
+        // Geant4 places daughters with the inverse of Rz(z) Ry(y) Rx(x), so
+        // decompose the transpose of the rotation in that order.
+        gp_Mat r = trsf.VectorialPart();
+        double x, y, z;
+        double cosb = sqrt(r(1, 1) * r(1, 1) + r(1, 2) * r(1, 2));
+        if (cosb > 1e-12) {
+            x = atan2(r(2, 3), r(3, 3));
+            y = atan2(-r(1, 3), cosb);
+            z = atan2(r(1, 2), r(1, 1));
+        } else {
+            x = atan2(-r(3, 2), r(2, 2));
+            y = atan2(-r(1, 3), cosb);
+            z = 0.0;
+        }
+        _("        <rotation x=\"");
+        out->real(x * 180.0 / M_PI);
+        _("\" y=\"");
+        out->real(y * 180.0 / M_PI);
+        _("\" z=\"");
+        out->real(z * 180.0 / M_PI);
+        _("\" unit=\"deg\"/>\n");
+    }
+    _("      </physvol>\n");
 }
 
 void GdmlWriter::writeStructures()
 {
     _("  <structure>\n");
 
-    int sz = names.size();
-    for (int i = 0; i < sz; i++) {
-        _("    <volume name=\"V-%s\">\n", convName(names[i]).data());
-        _("      <materialref ref=\"%s\"/>\n", materials[i].toUtf8().data());
-        _("      <solidref ref=\"T-%s\"/>\n", convName(names[i]).data());
-        _("    </volume>\n");
+    // One volume per solid and material, named after its first shape.
+    QMap<QPair<int, QString>, QByteArray> volumes;
+    QVector<QByteArray> volumeOf(names.size());
+    for (int i = 0; i < names.size(); i++) {
+        QPair<int, QString> key(solidOf[i], materials[i]);
+        if (!volumes.contains(key)) {
+            QByteArray name = convName(names[i]);
+            volumes.insert(key, name);
+            _("    <volume name=\"V-");
+            out->text(name);
+            _("\">\n      <materialref ref=\"");
+            out->text(materials[i].toUtf8());
+            _("\"/>\n      <solidref ref=\"T-");
+            out->text(solidNames[solidOf[i]]);
+            _("\"/>\n    </volume>\n");
+        }
+        volumeOf[i] = "V-" + volumes.value(key);
     }
 
-    _("    <volume name=\"World\">\n");
-    _("      <materialref ref=\"VACUUM\"/>\n");
-    _("      <solidref ref=\"worldbox\"/>\n");
-
-    for (int i = 0; i < sz; i++) {
-        _("      <physvol name=\"P-%s\">\n", convName(names[i]).data());
-        _("        <volumeref ref=\"V-%s\"/>\n", convName(names[i]).data());
-        _("        <positionref ref=\"center\"/>\n");
-        _("      </physvol>\n");
+    // The daughters of each assembly; the world is the last entry.
+    int count = assemblies.size();
+    QVector<QVector<int> > shapesIn(count + 1), assembliesIn(count + 1);
+    for (int i = 0; i < names.size(); i++) {
+        shapesIn[containerOf[i] >= 0 ? containerOf[i] : count].append(i);
+    }
+    for (int k = 0; k < count; k++) {
+        int a = order[k];
+        if (kept[a]) {
+            assembliesIn[motherOf[a] >= 0 ? motherOf[a] : count].append(a);
+        }
     }
 
-    _("    </volume>\n");
+    double c[3], sz[3];
+    worldExtent(bounds, c, sz);
+    gp_Trsf world;
+    world.SetTranslation(gp_Vec(c[0], c[1], c[2]));
+
+    // Inner assemblies come first, as volumes must be defined before use.
+    for (int k = 0; k <= count; k++) {
+        int m = k < count ? order[k] : count;
+        gp_Trsf inverse;
+        if (m < count) {
+            if (!kept[m]) {
+                continue;
+            }
+            _("    <volume name=\"A-");
+            out->text(assemblyNames[m]);
+            _("\">\n      <materialref ref=\"");
+            out->text(defaultMaterial().toUtf8());
+            _("\"/>\n      <solidref ref=\"E-");
+            out->text(assemblyNames[m]);
+            _("\"/>\n");
+            inverse = frames[m].Inverted();
+        } else {
+            _("    <volume name=\"World\">\n");
+            _("      <materialref ref=\"VACUUM\"/>\n");
+            _("      <solidref ref=\"worldbox\"/>\n");
+            inverse = world.Inverted();
+        }
+
+        for (int j = 0; j < assembliesIn[m].size(); j++) {
+            int a = assembliesIn[m][j];
+            writePhysvol(out, assemblyNames[a], "A-" + assemblyNames[a],
+                         inverse * frames[a]);
+        }
+        for (int j = 0; j < shapesIn[m].size(); j++) {
+            int i = shapesIn[m][j];
+            writePhysvol(out, convName(names[i]), volumeOf[i],
+                         inverse * placements[i]);
+        }
+        _("    </volume>\n");
+    }
 
     _("  </structure>\n");
 }
@@ -175,7 +983,8 @@ void GdmlWriter::writeSetup()
 
 void GdmlWriter::writeExtro()
 {
-    writeWorldBox();
+    StatsPhase phase(stats, "structure");
+    report("Writing the structure", 0, 1);
     writeStructures();
     writeSetup();
     _("</gdml>\n");
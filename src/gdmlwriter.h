@@ -1,35 +1,139 @@
 #ifndef GDMLWRITER_H
 #define GDMLWRITER_H
 
+#include "triangulate.h"
+#include "metadata.h"
+
 #include <QString>
 #include <QList>
+#include <QVector>
+#include <QByteArray>
 
 #include <Standard.hxx>
 #include <TopoDS.hxx>
 #include <Bnd_Box.hxx>
+#include <gp_Trsf.hxx>
+
+class Emitter;
+class OutputSink;
+class Stats;
 
-#include <stdio.h>
+// Follows an export from the thread running it, and may stop it.
+class ExportProgress
+{
+public:
+    virtual ~ExportProgress() {}
+    // How far the named stage has got, from 0 to 1.
+    virtual void progress(const char* stage, double fraction) = 0;
+    // Polled from the worker threads too.
+    virtual bool isCancelled() = 0;
+    // The export has stopped reading the shapes it was given; from now on,
+    // they may be meshed elsewhere.
+    virtual void shapesDone() {}
+};
+
+// The formatted solids of an earlier export, with what else the structure
+// needs to know of them. Exports splice in the chunks of every solid whose
+// Mesher::solidKeys() entry is unchanged, rather than meshing and
+// formatting it again, so that editing a solid only costs redoing that
+// one. Names are not part of the chunks; a solid's element is split
+// around its name.
+class SolidChunks
+{
+public:
+    // Which solids of the mesher the chunks hold as it would make them.
+    QVector<bool> fitting(const Mesher&) const;
+    // Sizes every list for count solids, keeping what they hold.
+    void resize(int count);
+    // Memory taken by the text.
+    qint64 size() const;
+
+    QVector<QByteArray> keys;
+    // Per solid: its <position>s, the element's tag and what follows the
+    // name, its bounds, and the frame of a primitive.
+    QVector<QByteArray> positions;
+    QVector<QByteArray> kinds;
+    QVector<QByteArray> bodies;
+    QVector<Bnd_Box> boxes;
+    QVector<gp_Trsf> frames;
+    QVector<bool> primitive;
+    // For the report.
+    QVector<int> vertices;
+    QVector<int> triangles;
+    QVector<int> undecimated;
+};
 
 class GdmlWriter
 {
 public:
     static QString defaultMaterial();
 
-    GdmlWriter(QString);
+    // With preallocate set, disk space is reserved ahead of the writes.
+    // Names ending in .gz or .zst are written compressed.
+    GdmlWriter(QString, bool preallocate = false);
     ~GdmlWriter();
+    // Completes the file, returning false if any write failed. The
+    // destructor does this if it has not been done.
+    bool close();
+    // Nests the shapes in the given assemblies; assemblyOf holds the
+    // innermost assembly of each shape, or -1. Without this call (or with
+    // assemblies which do not fit), shapes go straight into the world.
+    void setAssemblies(const QVector<AssemblyMetadata>& assemblies,
+                       const QVector<int>& assemblyOf);
+    // Times the phases of writing, and records each solid; may be NULL.
+    void setStats(Stats*);
+    // Reports how far writing has got, and stops meshing and formatting if
+    // cancelled, leaving an incomplete file; may be NULL.
+    void setProgress(ExportProgress*);
     void writeIntro();
-    void addSolid(TopoDS_Shape, QString, QString);
+    // Meshes every distinct solid of the mesher and writes the vertices and
+    // solids, using the given number of threads (0 for all cores). The output
+    // does not depend on the thread count. Each shape is later placed in the
+    // world as a physvol of its solid. Solids whose chunks fit the mesher
+    // are written from them; the chunks of the others are refilled with
+    // this output.
+    void writeSolids(Mesher&, const QList<QString>& names,
+                     const QList<QString>& materials, int threads = 0,
+                     SolidChunks* chunks = NULL);
     void writeExtro();
 private:
     void writeMaterials();
     void writeSetup();
     void writeStructures();
-    void writeWorldBox();
+    void layoutAssemblies();
+    void writeEnvelopes();
+    void writeSolidHead(const SolidChunks&, int s);
+    void placeSolids(const SolidChunks&);
+    void spliceSolids(const SolidChunks&, const QVector<int>& uses);
+    void report(const char* stage, int done, int total);
+    bool isCancelled() const;
 
-    FILE* f = NULL;
+    OutputSink* sink = NULL;
+    Emitter* out = NULL;
+    Stats* stats = NULL;
+    ExportProgress* progress = NULL;
+    // Set if solids put aside for the second pass were lost.
+    bool spillFailed = false;
     QList<QString> names;
     QList<QString> materials;
+    QVector<int> solidOf;
+    QVector<gp_Trsf> placements;
+    QVector<QByteArray> solidNames;
+    QVector<Bnd_Box> solidBoxes;
     Bnd_Box bounds;
+
+    QVector<AssemblyMetadata> assemblies;
+    QVector<int> assemblyOf;
+    // Assemblies deepest first; the kept ones get a volume, with the frame
+    // and size of their envelope box. Dissolved ones leave their contents to
+    // the nearest kept ancestor, given by motherOf and containerOf.
+    QVector<int> order;
+    QVector<bool> kept;
+    QVector<int> motherOf;
+    QVector<int> containerOf;
+    QVector<gp_Trsf> frames;
+    QVector<gp_XYZ> envelopes;
+    QVector<QByteArray> assemblyNames;
 };
 
 #endif // GDMLWRITER_H
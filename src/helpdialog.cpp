@@ -6,12 +6,19 @@
 #include <QHeaderView>
 #include <QPushButton>
 #include <QHBoxLayout>
+#include <QGridLayout>
 #include <QSettings>
 
 #include <V3d_Viewer.hxx>
 #include <V3d_BadValue.hxx>
 #include <Standard_Version.hxx>
 
+static const int defaultLodSolids = 2000;
+static const int defaultLodDelay = 300;
+
+int HelpDialog::lodSolids = defaultLodSolids;
+int HelpDialog::lodDelay = defaultLodDelay;
+
 #define NAME_IMPL(X) virtual QString getName() {return QString(X);}
 #define COLOR_IMPL(X) virtual Qt::GlobalColor getColor() {return X;}
 #define CURSOR_IMPL(X) virtual Qt::CursorShape getCursor() {return X;}
@@ -131,6 +138,10 @@ public:
     NAME_IMPL("ClkRotate")
     COLOR_IMPL(Qt::darkMagenta)
     CURSOR_IMPL(Qt::ClosedHandCursor)
+    virtual bool navigates()
+    {
+        return true;
+    }
     virtual void click(const ViewActionData& data)
     {
         data.view->StartRotation(data.x, data.y);
@@ -148,6 +159,10 @@ public:
     NAME_IMPL("ClkPan")
     COLOR_IMPL(Qt::darkMagenta)
     CURSOR_IMPL(Qt::OpenHandCursor)
+    virtual bool navigates()
+    {
+        return true;
+    }
     virtual void click(const ViewActionData& data)
     {
         x1 = data.x, y1 = data.y;
@@ -167,6 +182,10 @@ public:
     NAME_IMPL("ClkZoom")
     COLOR_IMPL(Qt::darkMagenta)
     CURSOR_IMPL(Qt::SizeVerCursor)
+    virtual bool navigates()
+    {
+        return true;
+    }
     virtual void click(const ViewActionData& data)
     {
         x1 = data.x, y1 = data.y;
@@ -281,6 +300,10 @@ class ClsScrZoom : public MouseScrollMode
 public:
     NAME_IMPL("ScrZoom")
     COLOR_IMPL(Qt::darkBlue)
+    virtual bool navigates()
+    {
+        return true;
+    }
     virtual void scroll(V3d_View* v, int delta)
     {
         doScroll(v, delta / 360.0);
@@ -292,6 +315,10 @@ class ClsScrZoomInv : public MouseScrollMode
 public:
     NAME_IMPL("ScrZoomInv")
     COLOR_IMPL(Qt::darkBlue)
+    virtual bool navigates()
+    {
+        return true;
+    }
     virtual void scroll(V3d_View* v, int delta)
     {
         doScroll(v, -delta / 360.0);
@@ -310,6 +337,10 @@ class ClsScrPanStepV : public MouseScrollMode
 public:
     NAME_IMPL("ScrPanStepV")
     COLOR_IMPL(Qt::black)
+    virtual bool navigates()
+    {
+        return true;
+    }
     virtual void scroll(V3d_View* v, int delta)
     {
         v->Pan(0, delta / 2);
@@ -321,6 +352,10 @@ class ClsScrPanStepH : public MouseScrollMode
 public:
     NAME_IMPL("ScrPanStepH")
     COLOR_IMPL(Qt::black)
+    virtual bool navigates()
+    {
+        return true;
+    }
     virtual void scroll(V3d_View* v, int delta)
     {
         v->Pan(delta / 2, 0);
@@ -506,6 +541,27 @@ HelpDialog::HelpDialog(QWidget* parent) :
     QPushButton* closeButton = new QPushButton("Close");
     connect(closeButton, SIGNAL(clicked()), SLOT(hide()));
 
+    solidsBox = new QSpinBox();
+    solidsBox->setRange(0, 10000000);
+    solidsBox->setSingleStep(500);
+    solidsBox->setValue(lodSolids);
+    connect(solidsBox, SIGNAL(valueChanged(int)), SLOT(setLodSolids(int)));
+    delayBox = new QSpinBox();
+    delayBox->setRange(0, 5000);
+    delayBox->setSingleStep(50);
+    delayBox->setSuffix(" ms");
+    delayBox->setValue(lodDelay);
+    connect(delayBox, SIGNAL(valueChanged(int)), SLOT(setLodDelay(int)));
+
+    QGridLayout* lodlayout = new QGridLayout();
+    lodlayout->addWidget(new QLabel("Draw boxes while moving from"), 0, 0);
+    lodlayout->addWidget(solidsBox, 0, 1);
+    lodlayout->addWidget(new QLabel("solids on"), 0, 2);
+    lodlayout->addWidget(new QLabel("Draw solids again after idling for"), 1,
+                         0);
+    lodlayout->addWidget(delayBox, 1, 1);
+    lodlayout->setColumnStretch(3, 1);
+
     QHBoxLayout* hlayout = new QHBoxLayout();
     hlayout->addWidget(resetButton);
     hlayout->addStretch(5);
@@ -515,6 +571,8 @@ HelpDialog::HelpDialog(QWidget* parent) :
     QVBoxLayout* layout = new QVBoxLayout();
     layout->addWidget(table);
     layout->addSpacing(4);
+    layout->addLayout(lodlayout);
+    layout->addSpacing(4);
     layout->addLayout(hlayout);
 
     setLayout(layout);
@@ -588,6 +646,8 @@ void HelpDialog::clearPopup()
 void HelpDialog::loadConfig()
 {
     QSettings s;
+    lodSolids = s.value("lod-solids", defaultLodSolids).toInt();
+    lodDelay = s.value("lod-delay", defaultLodDelay).toInt();
     if (s.contains("view-actions")) {
         QByteArray array = s.value("view-actions").toByteArray();
         int y;
@@ -634,6 +694,8 @@ void HelpDialog::saveConfig()
                                      sizeof(allScrollModes) / sizeof(allScrollModes[0]));
     }
     s.setValue("view-actions", array);
+    s.setValue("lod-solids", lodSolids);
+    s.setValue("lod-delay", lodDelay);
 }
 
 void HelpDialog::resetConfig()
@@ -644,4 +706,16 @@ void HelpDialog::resetConfig()
             table->setCellWidget(y, x, makeLabel(modeConfig[y][x]));
         }
     }
+    solidsBox->setValue(defaultLodSolids);
+    delayBox->setValue(defaultLodDelay);
+}
+
+void HelpDialog::setLodSolids(int solids)
+{
+    lodSolids = solids;
+}
+
+void HelpDialog::setLodDelay(int delay)
+{
+    lodDelay = delay;
 }
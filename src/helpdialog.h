@@ -5,6 +5,7 @@
 #include <QRubberBand>
 #include <QTableWidget>
 #include <QComboBox>
+#include <QSpinBox>
 #include <QList>
 
 #include <V3d_TypeOfOrientation.hxx>
@@ -28,6 +29,11 @@ public:
     virtual void click(const ViewActionData&) {}
     virtual void drag(const ViewActionData&) {}
     virtual void release(const ViewActionData&) {}
+    // Whether dragging moves the view, rather than picking things.
+    virtual bool navigates()
+    {
+        return false;
+    }
 private:
     MouseButtonMode(const MouseButtonMode&);
     void operator=(const MouseButtonMode&);
@@ -38,6 +44,10 @@ class MouseScrollMode : public MouseMode
 public:
     MouseScrollMode() {}
     virtual void scroll(V3d_View*, int) {}
+    virtual bool navigates()
+    {
+        return false;
+    }
 private:
     MouseScrollMode(const MouseScrollMode&);
     void operator=(const MouseScrollMode&);
@@ -86,14 +96,23 @@ public:
     static void loadConfig();
     static void saveConfig();
 
+    // While the view moves, solids are drawn as boxes once there are this
+    // many, until input has been idle for lodDelay ms.
+    static int lodSolids;
+    static int lodDelay;
+
 public slots:
     void resetConfig();
+    void setLodSolids(int);
+    void setLodDelay(int);
     void editCell(int, int);
     void changeItem();
     void clearPopup();
 
 private:
     QTableWidget* table;
+    QSpinBox* solidsBox;
+    QSpinBox* delayBox;
     ModeComboBox* popup;
     int lastRow, lastCol;
 };
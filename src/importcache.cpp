@@ -0,0 +1,311 @@
+#include "importcache.h"
+
+#include <QFile>
+#include <QDir>
+#include <QFileInfo>
+#include <QStringList>
+#include <QDataStream>
+#include <QCryptographicHash>
+#if QT_VERSION >= 0x050000
+#include <QStandardPaths>
+#else
+#include <QDesktopServices>
+#endif
+
+#include <Standard_Failure.hxx>
+#include <BinTools.hxx>
+#include <BRep_Builder.hxx>
+#include <TopoDS_Compound.hxx>
+#include <TopoDS_Iterator.hxx>
+#include <TopTools_SequenceOfShape.hxx>
+#include <gp_Quaternion.hxx>
+
+#include <fstream>
+
+#include <utime.h>
+
+// Bumped whenever what importSTEP produces, or the layout below, changes.
+static const quint32 cacheMagic = 0x53544743;
+static const quint32 cacheVersion = 1;
+// Once the entries take more than this, the least recently used ones go.
+static const qint64 cacheLimit = qint64(2) << 30;
+
+ImportCache::ImportCache(QString directory) :
+    directory(directory)
+{
+}
+
+QString ImportCache::defaultDirectory()
+{
+#if QT_VERSION >= 0x050000
+    QString base = QStandardPaths::writableLocation(
+                       QStandardPaths::CacheLocation);
+#else
+    QString base = QDesktopServices::storageLocation(
+                       QDesktopServices::CacheLocation);
+#endif
+    if (base.isEmpty()) {
+        return QString();
+    }
+    return base + "/imports";
+}
+
+bool ImportCache::isEnabled() const
+{
+    return !directory.isEmpty();
+}
+
+QByteArray ImportCache::key(QString file, QString options)
+{
+    QFile f(file);
+    if (!f.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(QByteArray::number(cacheVersion));
+    hash.addData(options.toUtf8());
+    QByteArray block(1 << 20, Qt::Uninitialized);
+    for (;;) {
+        qint64 n = f.read(block.data(), block.size());
+        if (n < 0) {
+            return QByteArray();
+        }
+        if (n == 0) {
+            break;
+        }
+        hash.addData(block.constData(), n);
+    }
+    return hash.result().toHex();
+}
+
+QString ImportCache::path(const QByteArray& key, const char* suffix) const
+{
+    return directory + "/" + QString::fromLatin1(key) + suffix;
+}
+
+static void writeTrsf(QDataStream& out, const gp_Trsf& trsf)
+{
+    gp_Quaternion q = trsf.GetRotation();
+    gp_XYZ t = trsf.TranslationPart();
+    out << q.X() << q.Y() << q.Z() << q.W();
+    out << t.X() << t.Y() << t.Z() << trsf.ScaleFactor();
+}
+
+static gp_Trsf readTrsf(QDataStream& in)
+{
+    double qx, qy, qz, qw, tx, ty, tz, scale;
+    in >> qx >> qy >> qz >> qw >> tx >> ty >> tz >> scale;
+    gp_Trsf trsf;
+    trsf.SetRotation(gp_Quaternion(qx, qy, qz, qw));
+    trsf.SetTranslationPart(gp_Vec(tx, ty, tz));
+    if (scale != 1.0) {
+        trsf.SetScaleFactor(scale);
+    }
+    return trsf;
+}
+
+bool ImportCache::load(const QByteArray& key,
+                       const Handle(TopTools_HSequenceOfShape)& shapes,
+                       QList<QPair<QString, QColor> >& objData,
+                       QVector<AssemblyMetadata>& assemblies,
+                       QList<int>& assemblyOf) const
+{
+    if (!isEnabled() || key.isEmpty()) {
+        return false;
+    }
+
+    // The side table is written last, so its presence marks a whole entry.
+    QFile table(path(key, ".meta"));
+    if (!table.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QDataStream in(&table);
+    in.setVersion(QDataStream::Qt_4_8);
+    quint32 magic, version, solidCount, assemblyCount;
+    in >> magic >> version >> solidCount >> assemblyCount;
+    if (in.status() != QDataStream::Ok || magic != cacheMagic ||
+            version != cacheVersion) {
+        return false;
+    }
+    QList<QPair<QString, QColor> > names;
+    QList<int> owners;
+    for (quint32 i = 0; i < solidCount && in.status() == QDataStream::Ok; i++) {
+        QString name;
+        QColor color;
+        qint32 owner;
+        in >> name >> color >> owner;
+        names.append(QPair<QString, QColor>(name, color));
+        owners.append(owner);
+    }
+    QVector<AssemblyMetadata> groups;
+    for (quint32 i = 0; i < assemblyCount && in.status() == QDataStream::Ok;
+            i++) {
+        AssemblyMetadata assembly;
+        qint32 parent;
+        in >> assembly.name >> parent;
+        assembly.parent = parent;
+        assembly.location = readTrsf(in);
+        groups.append(assembly);
+    }
+    if (in.status() != QDataStream::Ok) {
+        return false;
+    }
+
+    std::ifstream stream(path(key, ".brep").toLocal8Bit().constData(),
+                         std::ios::in | std::ios::binary);
+    if (!stream) {
+        return false;
+    }
+    TopoDS_Shape compound;
+    try {
+        BinTools::Read(compound, stream);
+    } catch (Standard_Failure&) {
+        return false;
+    }
+    if (compound.IsNull()) {
+        return false;
+    }
+    TopTools_SequenceOfShape solids;
+    for (TopoDS_Iterator it(compound); it.More(); it.Next()) {
+        solids.Append(it.Value());
+    }
+    if (quint32(solids.Length()) != solidCount) {
+        return false;
+    }
+    // Marks the entry as recently used, for evict().
+    utime(QFile::encodeName(table.fileName()).constData(), NULL);
+
+    shapes->Append(solids);
+    objData.append(names);
+    assemblyOf.append(owners);
+    int offset = assemblies.size();
+    for (int i = 0; i < groups.size(); i++) {
+        if (groups[i].parent >= 0) {
+            groups[i].parent += offset;
+        }
+        assemblies.append(groups[i]);
+    }
+    for (int i = assemblyOf.size() - owners.size(); i < assemblyOf.size(); i++) {
+        if (assemblyOf[i] >= 0) {
+            assemblyOf[i] += offset;
+        }
+    }
+    return true;
+}
+
+class TemporaryFiles
+{
+public:
+    ~TemporaryFiles()
+    {
+        for (int i = 0; i < paths.size(); i++) {
+            QFile::remove(paths[i]);
+        }
+    }
+    QStringList paths;
+};
+
+bool ImportCache::store(const QByteArray& key,
+                        const Handle(TopTools_HSequenceOfShape)& solids,
+                        const QList<QPair<QString, QColor> >& objData,
+                        const QVector<AssemblyMetadata>& assemblies,
+                        const QList<int>& assemblyOf, int firstSolid,
+                        int firstAssembly) const
+{
+    if (!isEnabled() || key.isEmpty() || solids.IsNull() ||
+            solids->Length() != objData.size() - firstSolid ||
+            !QDir().mkpath(directory)) {
+        return false;
+    }
+
+    // One compound keeps both the order of the solids and the sharing of
+    // their geometry, which the mesher relies on to mesh each part once.
+    BRep_Builder builder;
+    TopoDS_Compound compound;
+    builder.MakeCompound(compound);
+    for (int i = 1; i <= solids->Length(); i++) {
+        builder.Add(compound, solids->Value(i));
+    }
+    QString brep = path(key, ".brep");
+    QString meta = path(key, ".meta");
+    // Removes whatever is left of the temporary files when done; after the
+    // renames, nothing is.
+    TemporaryFiles temporary;
+    temporary.paths << brep + ".tmp" << meta + ".tmp";
+    {
+        std::ofstream stream((brep + ".tmp").toLocal8Bit().constData(),
+                             std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!stream) {
+            return false;
+        }
+        try {
+            BinTools::Write(compound, stream);
+        } catch (Standard_Failure&) {
+            return false;
+        }
+        if (!stream.flush()) {
+            return false;
+        }
+    }
+
+    QFile table(meta + ".tmp");
+    if (!table.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+    QDataStream out(&table);
+    out.setVersion(QDataStream::Qt_4_8);
+    out << cacheMagic << cacheVersion << quint32(objData.size() - firstSolid)
+        << quint32(assemblies.size() - firstAssembly);
+    for (int i = firstSolid; i < objData.size(); i++) {
+        int owner = assemblyOf[i];
+        out << objData[i].first << objData[i].second
+            << qint32(owner >= 0 ? owner - firstAssembly : -1);
+    }
+    for (int i = firstAssembly; i < assemblies.size(); i++) {
+        int parent = assemblies[i].parent;
+        out << assemblies[i].name
+            << qint32(parent >= 0 ? parent - firstAssembly : -1);
+        writeTrsf(out, assemblies[i].location);
+    }
+    table.close();
+    if (out.status() != QDataStream::Ok) {
+        return false;
+    }
+
+    QFile::remove(brep);
+    QFile::remove(meta);
+    if (!QFile::rename(brep + ".tmp", brep)) {
+        return false;
+    }
+    if (!QFile::rename(meta + ".tmp", meta)) {
+        // Without a side table, nothing would ever load or evict it.
+        QFile::remove(brep);
+        return false;
+    }
+    evict();
+    return true;
+}
+
+void ImportCache::evict() const
+{
+    // Oldest first; load() touches the side table of each entry it reads.
+    QDir dir(directory);
+    QFileInfoList tables = dir.entryInfoList(QStringList() << "*.meta",
+                           QDir::Files, QDir::Time | QDir::Reversed);
+    QVector<qint64> sizes;
+    qint64 total = 0;
+    for (int i = 0; i < tables.size(); i++) {
+        QString brep = tables[i].path() + "/" + tables[i].completeBaseName() +
+                       ".brep";
+        sizes.append(tables[i].size() + QFileInfo(brep).size());
+        total += sizes.last();
+    }
+    // The newest entry stays, however large.
+    for (int i = 0; i + 1 < tables.size() && total > cacheLimit; i++) {
+        QString base = tables[i].path() + "/" + tables[i].completeBaseName();
+        // The table goes first, so a half removed entry never loads.
+        QFile::remove(base + ".meta");
+        QFile::remove(base + ".brep");
+        total -= sizes[i];
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef IMPORTCACHE_H
+#define IMPORTCACHE_H
+
+#include "metadata.h"
+
+#include <QString>
+#include <QByteArray>
+#include <QList>
+#include <QPair>
+#include <QColor>
+#include <QVector>
+
+#include <TopTools_HSequenceOfShape.hxx>
+
+// On-disk cache of what importing a STEP file produced, so that importing
+// the same file again skips parsing and transfer. Entries are keyed by the
+// file's contents and the reader options; each holds the solids as binary
+// BRep, and their names, colors and assemblies in a small side table.
+// Past a couple of gigabytes, the entries least recently used are dropped.
+class ImportCache
+{
+public:
+    // An empty directory disables the cache.
+    explicit ImportCache(QString directory);
+
+    // A per-user cache location.
+    static QString defaultDirectory();
+
+    bool isEnabled() const;
+    // Hashes the file together with the options it is read with. Returns
+    // an empty key if the file cannot be read.
+    static QByteArray key(QString file, QString options);
+
+    // load() appends to the lists like Translator::importSTEP, and leaves
+    // them untouched when it returns false. store() saves what an import
+    // appended, from solid firstSolid and assembly firstAssembly on, with
+    // solids holding just those solids: copies no one else touches, as
+    // writing reads their triangulations.
+    bool load(const QByteArray& key,
+              const Handle(TopTools_HSequenceOfShape)& shapes,
+              QList<QPair<QString, QColor> >& objData,
+              QVector<AssemblyMetadata>& assemblies,
+              QList<int>& assemblyOf) const;
+    bool store(const QByteArray& key,
+               const Handle(TopTools_HSequenceOfShape)& solids,
+               const QList<QPair<QString, QColor> >& objData,
+               const QVector<AssemblyMetadata>& assemblies,
+               const QList<int>& assemblyOf, int firstSolid = 0,
+               int firstAssembly = 0) const;
+private:
+    QString path(const QByteArray& key, const char* suffix) const;
+    // Drops the least recently used entries while the cache is too big.
+    void evict() const;
+
+    QString directory;
+};
+
+#endif // IMPORTCACHE_H
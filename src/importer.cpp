@@ -0,0 +1,96 @@
+#include "importer.h"
+#include "parallel.h"
+
+#include <QMutexLocker>
+
+Importer::Importer(QString path) :
+    path(path), cancelled(0), queuedShapes(new TopTools_HSequenceOfShape()),
+    ok(false), lastStage(NULL), lastPercent(-1)
+{
+    // OpenCASCADE is about to be used from two threads.
+    workerCount(1);
+}
+
+QString Importer::fileName() const
+{
+    return path;
+}
+
+void Importer::cancel()
+{
+    cancelled.fetchAndStoreOrdered(1);
+}
+
+bool Importer::isCancelled()
+{
+    return cancelled.loadAcquire() != 0;
+}
+
+void Importer::takeSolids(Model& model)
+{
+    QMutexLocker locker(&lock);
+    model.append(queuedShapes, queuedData, queuedAssemblyOf);
+    queuedShapes->Clear();
+    queuedData.clear();
+    queuedAssemblyOf.clear();
+}
+
+bool Importer::succeeded()
+{
+    QMutexLocker locker(&lock);
+    return ok;
+}
+
+QVector<AssemblyMetadata> Importer::assemblies()
+{
+    QMutexLocker locker(&lock);
+    return found;
+}
+
+QByteArray Importer::sourceKey()
+{
+    QMutexLocker locker(&lock);
+    return key;
+}
+
+void Importer::progress(const char* stage, double fraction)
+{
+    int percent = qBound(0, int(fraction * 100.0), 100);
+    // OpenCASCADE reports far more often than a progress bar can show.
+    if (stage == lastStage && percent == lastPercent) {
+        return;
+    }
+    lastStage = stage;
+    lastPercent = percent;
+    emit progressed(QString(stage), percent);
+}
+
+void Importer::solidsAdded(const Handle(TopTools_HSequenceOfShape)& shapes,
+                           const QList<QPair<QString, QColor> >& objData,
+                           const QList<int>& assemblyOf, int first)
+{
+    {
+        QMutexLocker locker(&lock);
+        for (int i = first; i < shapes->Length(); i++) {
+            queuedShapes->Append(shapes->Value(i + 1));
+            queuedData.append(objData[i]);
+            queuedAssemblyOf.append(assemblyOf[i]);
+        }
+    }
+    emit solidsReady();
+}
+
+void Importer::run()
+{
+    Handle(TopTools_HSequenceOfShape) shapes = new TopTools_HSequenceOfShape();
+    QList<QPair<QString, QColor> > objData;
+    QList<int> assemblyOf;
+    QVector<AssemblyMetadata> groups;
+    QByteArray read;
+    bool done = Translator::importSTEP(path, shapes, objData, groups,
+                                       assemblyOf, NULL, this, &read);
+    QMutexLocker locker(&lock);
+    ok = done && !isCancelled();
+    found = groups;
+    key = read;
+}
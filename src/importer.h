@@ -0,0 +1,60 @@
+#ifndef IMPORTER_H
+#define IMPORTER_H
+
+#include "translate.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QAtomicInt>
+
+// Imports a STEP file on a thread of its own, so the window stays usable.
+// Solids are queued as the import finds them, for the GUI thread to take
+// in batches when solidsReady() is emitted.
+class Importer : public QThread, public ImportProgress
+{
+    Q_OBJECT
+public:
+    explicit Importer(QString path);
+
+    QString fileName() const;
+    // Asks the import to stop soon; it then fails.
+    void cancel();
+    // Moves the queued solids into the model.
+    void takeSolids(Model& model);
+    // All only valid once the thread has finished.
+    bool succeeded();
+    QVector<AssemblyMetadata> assemblies();
+    // The file's Translator::importKey().
+    QByteArray sourceKey();
+
+    virtual void progress(const char* stage, double fraction);
+    virtual void solidsAdded(const Handle(TopTools_HSequenceOfShape)& shapes,
+                             const QList<QPair<QString, QColor> >& objData,
+                             const QList<int>& assemblyOf, int first);
+    virtual bool isCancelled();
+
+signals:
+    void progressed(QString stage, int percent);
+    void solidsReady();
+
+protected:
+    virtual void run();
+
+private:
+    QString path;
+    QAtomicInt cancelled;
+
+    QMutex lock;
+    Handle(TopTools_HSequenceOfShape) queuedShapes;
+    QList<QPair<QString, QColor> > queuedData;
+    QList<int> queuedAssemblyOf;
+    QVector<AssemblyMetadata> found;
+    QByteArray key;
+    bool ok;
+
+    // Only touched by the importing thread.
+    const char* lastStage;
+    int lastPercent;
+};
+
+#endif // IMPORTER_H
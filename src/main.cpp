@@ -1,5 +1,8 @@
 #include "window.h"
 #include "translate.h"
+#include "batch.h"
+#include "stats.h"
+#include "trace.h"
 #include "stdio.h"
 
 #include <QApplication>
@@ -10,6 +13,7 @@
 #include <Message_Printer.hxx>
 
 #include <iostream>
+#include <math.h>
 
 class CustomPrinter : public Message_Printer
 {
@@ -55,40 +59,164 @@ int main(int argc, char** argv)
     app.setApplicationName("STEP-GDML");
     QStringList args = app.arguments();
 
-    if (args.length() <= 2) {
+    QStringList files;
+    QString batch, results, statsFile, traceFile;
+    int statsTop = 20;
+    ExportOptions options;
+    for (int i = 1; i < args.length(); i++) {
+        const QString& arg = args[i];
+        if (arg.startsWith("--weld=")) {
+            bool ok;
+            options.mesh.weldTolerance = arg.mid(7).toDouble(&ok);
+            if (!ok || options.mesh.weldTolerance < 0.0) {
+                printf("Invalid weld tolerance: %s\n", arg.toUtf8().data());
+                return -1;
+            }
+        } else if (arg.startsWith("--deflection=") ||
+                   arg.startsWith("--relative-deflection=")) {
+            bool ok;
+            options.mesh.relative = arg.startsWith("--relative-deflection=");
+            options.mesh.deflection = arg.mid(arg.indexOf('=') + 1).toDouble(&ok);
+            if (!ok || options.mesh.deflection <= 0.0) {
+                printf("Invalid deflection: %s\n", arg.toUtf8().data());
+                return -1;
+            }
+        } else if (arg.startsWith("--angle=")) {
+            bool ok;
+            options.mesh.angle = arg.mid(8).toDouble(&ok) * M_PI / 180.0;
+            if (!ok || options.mesh.angle <= 0.0) {
+                printf("Invalid angle: %s\n", arg.toUtf8().data());
+                return -1;
+            }
+        } else if (arg.startsWith("--decimate=")) {
+            bool ok;
+            options.mesh.decimation = arg.mid(11).toDouble(&ok);
+            if (!ok || options.mesh.decimation < 0.0) {
+                printf("Invalid decimation tolerance: %s\n", arg.toUtf8().data());
+                return -1;
+            }
+        } else if (arg.startsWith("--budget=")) {
+            bool ok;
+            options.mesh.triangleBudget = arg.mid(9).toInt(&ok);
+            if (!ok || options.mesh.triangleBudget < 0) {
+                printf("Invalid triangle budget: %s\n", arg.toUtf8().data());
+                return -1;
+            }
+        } else if (arg == "--preallocate") {
+            options.preallocate = true;
+        } else if (arg.startsWith("--threads=")) {
+            bool ok;
+            options.threads = arg.mid(10).toInt(&ok);
+            if (!ok || options.threads < 0) {
+                printf("Invalid thread count: %s\n", arg.toUtf8().data());
+                return -1;
+            }
+        } else if (arg.startsWith("--cache=")) {
+            Translator::setImportCache(arg.mid(8));
+        } else if (arg.startsWith("--stats=")) {
+            statsFile = arg.mid(8);
+        } else if (arg.startsWith("--stats-top=")) {
+            bool ok;
+            statsTop = arg.mid(12).toInt(&ok);
+            if (!ok || statsTop < 0) {
+                printf("Invalid solid count: %s\n", arg.toUtf8().data());
+                return -1;
+            }
+        } else if (arg.startsWith("--trace=")) {
+            traceFile = arg.mid(8);
+        } else if (arg.startsWith("--batch=")) {
+            batch = arg.mid(8);
+        } else if (arg.startsWith("--results=")) {
+            results = arg.mid(10);
+        } else if (arg == "--no-cache") {
+            Translator::setImportCache(QString());
+        } else {
+            files.append(arg);
+        }
+    }
+
+    if (!traceFile.isEmpty()) {
+        if (!Trace::available()) {
+            printf("Tracing is not built in; rebuild with qmake CONFIG+=trace.\n");
+            return -1;
+        }
+        Trace::start();
+    }
+
+    if (!batch.isEmpty()) {
+        if (!files.isEmpty()) {
+            printf("No input or output files may be given with --batch.\n");
+            return -1;
+        }
+        if (!statsFile.isEmpty()) {
+            printf("--stats only applies to single conversions.\n");
+            return -1;
+        }
+        if (results.isEmpty()) {
+            results = batch + ".results";
+        }
+        int failed = runBatch(batch, results, options);
+        if (!traceFile.isEmpty() && !Trace::write(traceFile)) {
+            printf("Could not write the trace to %s.\n", traceFile.toUtf8().data());
+            return -1;
+        }
+        return failed == 0 ? 0 : -1;
+    }
+
+    if (files.length() <= 1) {
         QString ifile;
-        if (args.length() == 2) {
-            ifile = args[1];
+        if (files.length() == 1) {
+            ifile = files[0];
         }
         MainWindow w(ifile);
         w.show();
         return app.exec();
-    } else if (args.length() == 3) {
-        QString ifile = args[1];
-        QString ofile = args[2];
-        Handle(TopTools_HSequenceOfShape) shapes = new TopTools_HSequenceOfShape();
-        QList<QPair<QString, QColor> > li;
-        if (!Translator::importSTEP(ifile, shapes, li)) {
-            printf("Import failed. :-(\n");
+    } else if (files.length() == 2) {
+        Stats stats;
+        if (!statsFile.isEmpty()) {
+            stats.input = files[0];
+            stats.output = files[1];
+            options.stats = &stats;
+        }
+        bool ok = Translator::convert(files[0], files[1], options);
+        if (!traceFile.isEmpty() && !Trace::write(traceFile)) {
+            printf("Could not write the trace to %s.\n", traceFile.toUtf8().data());
             return -1;
         }
-        QVector<SolidMetadata> metadata(shapes->Length());
-        for (int i = 0; i < metadata.size(); i++) {
-            metadata[i].color = Quantity_Color();
-            metadata[i].item = 0;
-            metadata[i].object = 0;
-            metadata[i].name = QString::number(i);
-            metadata[i].transp = 0.0;
-            metadata[i].material = "ALUMINUM";
+        if (!ok) {
+            return -1;
         }
-
-        if (!Translator::exportGDML(ofile, shapes, metadata)) {
-            printf("Export failed. :-(\n");
+        if (!statsFile.isEmpty() && !stats.writeJson(statsFile, statsTop)) {
+            printf("Could not write the statistics to %s.\n",
+                   statsFile.toUtf8().data());
             return -1;
         }
         return 0;
     } else {
-        printf("Usage: step-gdml [INPUT_STEP_FILE] [OUTPUT_GDML_FILE]\n");
+        printf("Usage: step-gdml [OPTIONS] [INPUT_STEP_FILE] [OUTPUT_GDML_FILE]\n");
+        printf("       step-gdml [OPTIONS] --batch=MANIFEST [--results=FILE]\n");
+        printf("Options:\n");
+        printf("  --weld=TOL     merge mesh nodes closer than TOL mm (default 1e-4)\n");
+        printf("  --deflection=D mesh to within D mm of the surfaces\n");
+        printf("  --relative-deflection=F\n");
+        printf("                 ... or within F times each part's diagonal (default 0.004)\n");
+        printf("  --angle=DEG    bend facets by at most DEG degrees (default 28.6)\n");
+        printf("  --decimate=TOL simplify meshes while the quadric (plane-distance) error\n");
+        printf("                 stays below TOL mm\n");
+        printf("  --budget=N     coarsen the largest meshes to fit N triangles in all\n");
+        printf("  --preallocate  reserve disk space ahead of writing the output\n");
+        printf("  --threads=N    mesh and format on N threads (default: all cores)\n");
+        printf("  --cache=DIR    keep imported STEP files in DIR for quick reloading; the\n");
+        printf("                 least recently used go once they exceed 2 GB\n");
+        printf("  --no-cache     always read STEP files afresh\n");
+        printf("  --stats=FILE   write phase timings and a per-solid table to FILE as JSON\n");
+        printf("  --stats-top=N  ... listing the N solids slowest to mesh (default 20)\n");
+        printf("  --trace=FILE   write spans of each thread's work to FILE, for chrome://tracing\n");
+        printf("                 or Perfetto (needs a build with qmake CONFIG+=trace)\n");
+        printf("  --batch=FILE   convert the \"INPUT OUTPUT\" pairs listed in FILE, one per\n");
+        printf("                 line, side by side\n");
+        printf("  --results=FILE where --batch reports on each job (default FILE.results)\n");
+        printf("Output names ending in .gz or .zst are written compressed.\n");
         return -1;
     }
 }
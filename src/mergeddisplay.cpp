@@ -0,0 +1,448 @@
+#include "mergeddisplay.h"
+
+#if MERGED_DISPLAY
+
+#include "translate.h"
+#include "triangulate.h"
+
+#include <Graphic3d_ArrayOfTriangles.hxx>
+#include <Graphic3d_AspectFillArea3d.hxx>
+#include <Graphic3d_Group.hxx>
+#include <Graphic3d_MaterialAspect.hxx>
+#include <Prs3d_Drawer.hxx>
+#include <Prs3d_Presentation.hxx>
+#include <PrsMgr_PresentationManager3d.hxx>
+#include <SelectMgr_Selection.hxx>
+#include <SelectMgr_SequenceOfOwner.hxx>
+#include <Select3D_SensitiveTriangulation.hxx>
+#include <Poly_Triangulation.hxx>
+#include <gp.hxx>
+#include <gp_Pnt.hxx>
+#include <gp_Dir.hxx>
+
+IMPLEMENT_STANDARD_RTTIEXT(SolidOwner, SelectMgr_EntityOwner)
+IMPLEMENT_STANDARD_RTTIEXT(MergedSolids, AIS_InteractiveObject)
+
+// Most solids in one batch. Changing one solid rebuilds its batch, so this
+// bounds the work of an edit, while still merging enough that 20k solids
+// make a few dozen presentations.
+static const int batchSize = 1024;
+
+SolidOwner::SolidOwner(const Handle(SelectMgr_SelectableObject)& batch,
+                       int solid, int position) :
+    SelectMgr_EntityOwner(batch), solid(solid), position(position)
+{
+}
+
+static Handle(Graphic3d_AspectFillArea3d) shadedAspect(
+    const Quantity_Color& color, double transp)
+{
+    Graphic3d_MaterialAspect mat = Translator::displayMaterial();
+    mat.SetColor(color);
+    mat.SetTransparency(transp);
+    return new Graphic3d_AspectFillArea3d(Aspect_IS_SOLID, color, color,
+                                          Aspect_TOL_SOLID, 1.0, mat, mat);
+}
+
+// Highlights skip the polygon offset which pushes shaded faces back, so
+// they are drawn over the solid they cover.
+static Handle(Graphic3d_AspectFillArea3d) highlightAspect(
+    const Quantity_Color& color)
+{
+    Handle(Graphic3d_AspectFillArea3d) aspect = shadedAspect(color, 0.0);
+    aspect->SetPolygonOffsets(Aspect_POM_Off);
+    return aspect;
+}
+
+// Adds the existing triangulations of the shapes to the presentation as
+// one indexed triangle array, smoothly shaded within each face.
+static void addTriangles(const Handle(Prs3d_Presentation)& prs,
+                         const QVector<TopoDS_Shape>& shapes,
+                         const Handle(Graphic3d_AspectFillArea3d)& aspect)
+{
+    QVector<TriangleMesh> meshes;
+    int nodes = 0, triangles = 0;
+    for (int i = 0; i < shapes.size(); i++) {
+        meshes.append(triangulateShape(shapes[i]));
+        nodes += meshes.last().nodeCount();
+        triangles += meshes.last().triangleCount();
+    }
+    if (triangles == 0) {
+        return;
+    }
+
+    Handle(Graphic3d_ArrayOfTriangles) array = new Graphic3d_ArrayOfTriangles(
+        nodes, 3 * triangles, Standard_True);
+    for (int i = 0; i < meshes.size(); i++) {
+        const TriangleMesh& mesh = meshes[i];
+        QVector<gp_XYZ> normals(mesh.nodeCount(), gp_XYZ(0, 0, 0));
+        for (int t = 0; t < mesh.triangleCount(); t++) {
+            const int* v = mesh.triangles.constData() + 3 * t;
+            gp_XYZ a = mesh.node(v[0]);
+            gp_XYZ n = (mesh.node(v[1]) - a) ^ (mesh.node(v[2]) - a);
+            normals[v[0]] += n;
+            normals[v[1]] += n;
+            normals[v[2]] += n;
+        }
+        int base = array->VertexNumber();
+        for (int k = 0; k < mesh.nodeCount(); k++) {
+            gp_XYZ n = normals[k];
+            if (n.Modulus() < gp::Resolution()) {
+                n = gp_XYZ(0, 0, 1);
+            }
+            array->AddVertex(gp_Pnt(mesh.node(k)), gp_Dir(n));
+        }
+        for (int j = 0; j < mesh.triangles.size(); j++) {
+            array->AddEdge(base + mesh.triangles[j] + 1);
+        }
+    }
+
+    Handle(Graphic3d_Group) group = prs->NewGroup();
+    group->SetGroupPrimitivesAspect(aspect);
+    group->AddPrimitiveArray(array);
+}
+
+static Handle(Poly_Triangulation) toTriangulation(const TriangleMesh& mesh)
+{
+    Handle(Poly_Triangulation) t = new Poly_Triangulation(mesh.nodeCount(),
+            mesh.triangleCount(), Standard_False);
+    for (int k = 0; k < mesh.nodeCount(); k++) {
+#if OCC_VERSION_HEX >= 0x070600
+        t->SetNode(k + 1, gp_Pnt(mesh.node(k)));
+#else
+        t->ChangeNode(k + 1) = gp_Pnt(mesh.node(k));
+#endif
+    }
+    for (int j = 0; j < mesh.triangleCount(); j++) {
+        const int* v = mesh.triangles.constData() + 3 * j;
+        Poly_Triangle triangle(v[0] + 1, v[1] + 1, v[2] + 1);
+#if OCC_VERSION_HEX >= 0x070600
+        t->SetTriangle(j + 1, triangle);
+#else
+        t->ChangeTriangle(j + 1) = triangle;
+#endif
+    }
+    return t;
+}
+
+MergedSolids::MergedSolids(const Model& model, const QVector<int>& solids,
+                           const Quantity_Color& selectionColor) :
+    solids(solids), selectionColor(selectionColor)
+{
+    const SolidMetadata& first = model.metadata[solids.first()];
+    color = first.color;
+    transp = first.transp;
+    for (int i = 0; i < solids.size(); i++) {
+        shapes.append(model.shape(solids[i]));
+        positions.insert(solids[i], i);
+    }
+    // Highlights are drawn per solid below, not over the whole batch.
+    SetAutoHilight(Standard_False);
+    SetDisplayMode(0);
+}
+
+Handle(SolidOwner) MergedSolids::owner(int solid) const
+{
+    int position = positions.value(solid, -1);
+    if (position < 0 || position >= owners.size()) {
+        return Handle(SolidOwner)();
+    }
+    return owners[position];
+}
+
+Standard_Boolean MergedSolids::AcceptDisplayMode(
+    const Standard_Integer mode) const
+{
+    return mode == 0;
+}
+
+void MergedSolids::Compute(const Handle(PrsMgr_PresentationManager3d)&,
+                           const Handle(Prs3d_Presentation)& prs,
+                           const Standard_Integer mode)
+{
+    if (mode != 0) {
+        return;
+    }
+    addTriangles(prs, shapes, shadedAspect(color, transp));
+}
+
+void MergedSolids::ComputeSelection(const Handle(SelectMgr_Selection)&
+                                    selection, const Standard_Integer mode)
+{
+    if (mode != 0) {
+        return;
+    }
+    // Kept across recomputations, so that selections stay valid.
+    if (owners.isEmpty()) {
+        for (int i = 0; i < solids.size(); i++) {
+            owners.append(new SolidOwner(this, solids[i], i));
+        }
+    }
+    for (int i = 0; i < shapes.size(); i++) {
+        TriangleMesh mesh = triangulateShape(shapes[i]);
+        if (mesh.triangleCount() == 0) {
+            continue;
+        }
+        selection->Add(new Select3D_SensitiveTriangulation(owners[i],
+                       toTriangulation(mesh), TopLoc_Location(), Standard_True));
+    }
+}
+
+void MergedSolids::HilightSelected(const Handle(PrsMgr_PresentationManager3d)&
+                                   pm, const SelectMgr_SequenceOfOwner& selected)
+{
+    QVector<TopoDS_Shape> picked;
+    for (int i = selected.Lower(); i <= selected.Upper(); i++) {
+        Handle(SolidOwner) o = Handle(SolidOwner)::DownCast(selected.Value(i));
+        if (!o.IsNull()) {
+            picked.append(shapes[o->position]);
+        }
+    }
+    Handle(Prs3d_Presentation) prs = GetSelectPresentation(pm);
+    prs->Clear();
+    addTriangles(prs, picked, highlightAspect(selectionColor));
+    prs->SetDisplayPriority(9);
+    prs->Display();
+}
+
+void MergedSolids::HilightOwnerWithColor(
+    const Handle(PrsMgr_PresentationManager3d)& pm,
+    const Handle(Prs3d_Drawer)& style,
+    const Handle(SelectMgr_EntityOwner)& owner)
+{
+    Handle(SolidOwner) o = Handle(SolidOwner)::DownCast(owner);
+    if (o.IsNull()) {
+        return;
+    }
+    Handle(Prs3d_Presentation) prs = GetHilightPresentation(pm);
+    prs->Clear();
+    addTriangles(prs, QVector<TopoDS_Shape>() << shapes[o->position],
+                 highlightAspect(style->Color()));
+    if (pm->IsImmediateModeOn()) {
+        pm->AddToImmediateList(prs);
+    } else {
+        prs->Display();
+    }
+}
+
+MergedDisplay::MergedDisplay(const Handle(AIS_InteractiveContext)& context) :
+    context(context)
+{
+}
+
+MergedDisplay::~MergedDisplay()
+{
+    clear();
+}
+
+MergedDisplay::BatchKey MergedDisplay::keyOf(const Quantity_Color& color,
+        double transp)
+{
+    QRgb rgb = QColor::fromRgbF(color.Red(), color.Green(), color.Blue()).rgb();
+    return BatchKey(rgb, qRound(transp * 100));
+}
+
+void MergedDisplay::display(const Model& model, int first)
+{
+    batchOf.resize(model.count());
+    QMap<BatchKey, QVector<int> > added;
+    for (int i = first; i < model.count(); i++) {
+        Translator::meshCoarsely(model.shape(i));
+        const SolidMetadata& m = model.metadata[i];
+        added[keyOf(m.color, m.transp)].append(i);
+    }
+    QMap<BatchKey, QVector<int> >::const_iterator it;
+    for (it = added.constBegin(); it != added.constEnd(); ++it) {
+        add(model, it.key(), it.value(), false);
+    }
+}
+
+void MergedDisplay::compact(const Model& model)
+{
+    QMap<BatchKey, QVector<Handle(MergedSolids)> > partial;
+    for (int i = 0; i < batchOf.size(); i++) {
+        const Handle(MergedSolids)& batch = batchOf[i];
+        // Each batch once, at its first solid.
+        if (batch.IsNull() || batch->solids.first() != i ||
+                batch->solids.size() >= batchSize) {
+            continue;
+        }
+        partial[keyOf(batch->color, batch->transp)].append(batch);
+    }
+    QMap<BatchKey, QVector<Handle(MergedSolids)> >::const_iterator it;
+    for (it = partial.constBegin(); it != partial.constEnd(); ++it) {
+        const QVector<Handle(MergedSolids)>& batches = it.value();
+        if (batches.size() < 2) {
+            continue;
+        }
+        QVector<int> solids, selected;
+        for (int b = 0; b < batches.size(); b++) {
+            solids += batches[b]->solids;
+            selected += selectedIn(batches[b]);
+            context->Remove(batches[b], Standard_False);
+        }
+        open.remove(it.key());
+        add(model, it.key(), solids, false);
+        for (int i = 0; i < selected.size(); i++) {
+            reselect(batchOf[selected[i]], QVector<int>() << selected[i]);
+        }
+    }
+}
+
+void MergedDisplay::update(const Model& model, int solid)
+{
+    Handle(MergedSolids) old = batchOf[solid];
+    if (old.IsNull()) {
+        return;
+    }
+    const SolidMetadata& m = model.metadata[solid];
+    BatchKey key = keyOf(m.color, m.transp);
+    BatchKey oldKey = keyOf(old->color, old->transp);
+    if (key == oldKey) {
+        return;
+    }
+    Handle(SelectMgr_EntityOwner) owner = ownerOf(solid);
+    bool selected = !owner.IsNull() && context->IsSelected(owner);
+
+    QVector<int> rest = old->solids;
+    rest.remove(rest.indexOf(solid));
+    batchOf[solid].Nullify();
+    Handle(MergedSolids) kept = replace(model, old, rest);
+    if (open.value(oldKey) == old) {
+        if (kept.IsNull()) {
+            open.remove(oldKey);
+        } else {
+            open[oldKey] = kept;
+        }
+    }
+
+    add(model, key, QVector<int>() << solid, true);
+    if (selected) {
+        context->AddOrRemoveSelected(ownerOf(solid), Standard_False);
+    }
+}
+
+void MergedDisplay::clear()
+{
+    // The solids of a batch mostly sit together, and removing a batch that
+    // is gone already does nothing.
+    for (int i = 0; i < batchOf.size(); i++) {
+        if (!batchOf[i].IsNull() && (i == 0 || batchOf[i] != batchOf[i - 1])) {
+            context->Remove(batchOf[i], Standard_False);
+        }
+    }
+    batchOf.clear();
+    open.clear();
+}
+
+void MergedDisplay::remesh(const Model& model, const QVector<int>& solids)
+{
+    QVector<Handle(MergedSolids)> stale;
+    for (int i = 0; i < solids.size(); i++) {
+        const Handle(MergedSolids)& batch = batchOf.value(solids[i]);
+        if (!batch.IsNull() && !stale.contains(batch)) {
+            stale.append(batch);
+        }
+    }
+    for (int i = 0; i < stale.size(); i++) {
+        BatchKey key = keyOf(stale[i]->color, stale[i]->transp);
+        Handle(MergedSolids) batch = replace(model, stale[i], stale[i]->solids);
+        if (open.value(key) == stale[i]) {
+            open[key] = batch;
+        }
+    }
+}
+
+int MergedDisplay::solidOf(const Handle(SelectMgr_EntityOwner)& owner) const
+{
+    Handle(SolidOwner) o = Handle(SolidOwner)::DownCast(owner);
+    if (o.IsNull() || o->solid >= batchOf.size() ||
+            batchOf[o->solid] != o->Selectable()) {
+        return -1;
+    }
+    return o->solid;
+}
+
+Handle(SelectMgr_EntityOwner) MergedDisplay::ownerOf(int solid) const
+{
+    const Handle(MergedSolids)& batch = batchOf[solid];
+    if (batch.IsNull()) {
+        return Handle(SelectMgr_EntityOwner)();
+    }
+    return batch->owner(solid);
+}
+
+// Fills the open batch of the key if asked to, then starts new ones.
+void MergedDisplay::add(const Model& model, const BatchKey& key,
+                        QVector<int> solids, bool topUp)
+{
+    Handle(MergedSolids) batch;
+    if (topUp) {
+        batch = open.value(key);
+    }
+    while (!solids.isEmpty()) {
+        QVector<int> members;
+        if (!batch.IsNull()) {
+            members = batch->solids;
+        }
+        int taken = qMin(solids.size(), batchSize - members.size());
+        members += solids.mid(0, taken);
+        solids.remove(0, taken);
+        batch = replace(model, batch, members);
+        if (members.size() < batchSize) {
+            open[key] = batch;
+        } else {
+            open.remove(key);
+            batch.Nullify();
+        }
+    }
+}
+
+QVector<int> MergedDisplay::selectedIn(const Handle(MergedSolids)& batch) const
+{
+    QVector<int> selected;
+    for (int i = 0; i < batch->solids.size(); i++) {
+        Handle(SolidOwner) owner = batch->owner(batch->solids[i]);
+        if (!owner.IsNull() && context->IsSelected(owner)) {
+            selected.append(batch->solids[i]);
+        }
+    }
+    return selected;
+}
+
+void MergedDisplay::reselect(const Handle(MergedSolids)& batch,
+                             const QVector<int>& solids)
+{
+    for (int i = 0; i < solids.size(); i++) {
+        Handle(SolidOwner) owner = batch->owner(solids[i]);
+        if (!owner.IsNull()) {
+            context->AddOrRemoveSelected(owner, Standard_False);
+        }
+    }
+}
+
+// Shows solids in place of old, either of which may be empty, keeping the
+// selection of the solids in both.
+Handle(MergedSolids) MergedDisplay::replace(const Model& model,
+        const Handle(MergedSolids)& old, const QVector<int>& solids)
+{
+    QVector<int> selected;
+    if (!old.IsNull()) {
+        selected = selectedIn(old);
+        context->Remove(old, Standard_False);
+    }
+    if (solids.isEmpty()) {
+        return Handle(MergedSolids)();
+    }
+
+    Handle(MergedSolids) batch = new MergedSolids(model, solids,
+            context->SelectionStyle()->Color());
+    for (int i = 0; i < solids.size(); i++) {
+        batchOf[solids[i]] = batch;
+    }
+    context->Display(batch, 0, 0, Standard_False);
+    reselect(batch, selected);
+    return batch;
+}
+
+#endif // MERGED_DISPLAY
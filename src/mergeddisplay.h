@@ -0,0 +1,127 @@
+#ifndef MERGEDDISPLAY_H
+#define MERGEDDISPLAY_H
+
+#include "model.h"
+
+#include <QMap>
+#include <QHash>
+#include <QPair>
+#include <QVector>
+#include <QColor>
+
+#include <Standard_Version.hxx>
+
+// Highlighting a part of an object on its own takes the per-owner styles
+// of OCC 7.1.
+#define MERGED_DISPLAY (OCC_VERSION_HEX >= 0x070100)
+
+#if MERGED_DISPLAY
+
+#include <AIS_InteractiveObject.hxx>
+#include <AIS_InteractiveContext.hxx>
+#include <SelectMgr_EntityOwner.hxx>
+#include <Quantity_Color.hxx>
+
+// Picks out one solid of a MergedSolids.
+class SolidOwner : public SelectMgr_EntityOwner
+{
+    DEFINE_STANDARD_RTTIEXT(SolidOwner, SelectMgr_EntityOwner)
+public:
+    SolidOwner(const Handle(SelectMgr_SelectableObject)& batch, int solid,
+               int position);
+
+    // Index into the model, and into the solids of the batch.
+    int solid;
+    int position;
+};
+
+DEFINE_STANDARD_HANDLE(SolidOwner, SelectMgr_EntityOwner)
+
+// Solids of one color and transparency shaded as a single triangle array,
+// with one sensitive triangulation and owner per solid. A batch never
+// changes; adding or moving solids replaces it.
+class MergedSolids : public AIS_InteractiveObject
+{
+    DEFINE_STANDARD_RTTIEXT(MergedSolids, AIS_InteractiveObject)
+public:
+    MergedSolids(const Model& model, const QVector<int>& solids,
+                 const Quantity_Color& selectionColor);
+
+    // The owner of a solid of the batch; null until the batch is shown.
+    Handle(SolidOwner) owner(int solid) const;
+
+    virtual Standard_Boolean AcceptDisplayMode(
+        const Standard_Integer mode) const;
+    virtual void HilightSelected(const Handle(PrsMgr_PresentationManager3d)&,
+                                 const SelectMgr_SequenceOfOwner& owners);
+    virtual void HilightOwnerWithColor(
+        const Handle(PrsMgr_PresentationManager3d)&,
+        const Handle(Prs3d_Drawer)& style,
+        const Handle(SelectMgr_EntityOwner)& owner);
+
+    QVector<int> solids;
+    Quantity_Color color;
+    double transp;
+protected:
+    virtual void Compute(const Handle(PrsMgr_PresentationManager3d)&,
+                         const Handle(Prs3d_Presentation)& prs,
+                         const Standard_Integer mode);
+    virtual void ComputeSelection(const Handle(SelectMgr_Selection)& selection,
+                                  const Standard_Integer mode);
+private:
+    QVector<TopoDS_Shape> shapes;
+    QVector<Handle(SolidOwner)> owners;
+    // Where each solid sits in solids.
+    QHash<int, int> positions;
+    Quantity_Color selectionColor;
+};
+
+DEFINE_STANDARD_HANDLE(MergedSolids, AIS_InteractiveObject)
+
+// Shows the solids of a model in batches of equal color and transparency,
+// instead of one presentation each. Owners stand for single solids, so
+// picking and selection work per solid as before.
+class MergedDisplay
+{
+public:
+    explicit MergedDisplay(const Handle(AIS_InteractiveContext)& context);
+    ~MergedDisplay();
+
+    // Shows the solids of the model from first on, meshed coarsely unless
+    // they have a mesh already. They go into batches of their own, as
+    // topping up those shown before would rebuild them.
+    void display(const Model& model, int first = 0);
+    // Merges the batches left part full by displaying in pieces.
+    void compact(const Model& model);
+    // Shows the solids again with their current triangulation.
+    void remesh(const Model& model, const QVector<int>& solids);
+    // Moves a solid to the batch of its current color and transparency.
+    void update(const Model& model, int solid);
+    // Removes every batch from the context.
+    void clear();
+
+    // The solid an owner picks, or -1 if it is none of ours.
+    int solidOf(const Handle(SelectMgr_EntityOwner)& owner) const;
+    Handle(SelectMgr_EntityOwner) ownerOf(int solid) const;
+private:
+    typedef QPair<QRgb, int> BatchKey;
+    static BatchKey keyOf(const Quantity_Color& color, double transp);
+    void add(const Model& model, const BatchKey& key, QVector<int> solids,
+             bool topUp);
+    Handle(MergedSolids) replace(const Model& model,
+                                 const Handle(MergedSolids)& old,
+                                 const QVector<int>& solids);
+    QVector<int> selectedIn(const Handle(MergedSolids)& batch) const;
+    void reselect(const Handle(MergedSolids)& batch,
+                  const QVector<int>& solids);
+
+    Handle(AIS_InteractiveContext) context;
+    // The batch showing each solid.
+    QVector<Handle(MergedSolids)> batchOf;
+    // The batch of each key which still has room.
+    QMap<BatchKey, Handle(MergedSolids)> open;
+};
+
+#endif // MERGED_DISPLAY
+
+#endif // MERGEDDISPLAY_H
@@ -5,17 +5,29 @@
 
 #include <Quantity_Color.hxx>
 #include <Standard_Real.hxx>
-
-class AIS_InteractiveObject;
-class QListWidgetItem;
+#include <gp_Trsf.hxx>
 
 typedef struct {
-    AIS_InteractiveObject* object;
-    QListWidgetItem* item;
     QString name;
     QString material;
     Quantity_Color color;
     Standard_Real transp;
+    // Innermost enclosing assembly, or -1 for none.
+    int assembly;
+    // Mesh deflection (in the units of the export's MeshOptions) and angle
+    // (in radians) for this solid; 0 uses those of the export.
+    Standard_Real deflection;
+    Standard_Real angle;
 } SolidMetadata;
 
+// An assembly of the STEP product structure. Solids and subassemblies
+// point at the assembly containing them.
+typedef struct {
+    QString name;
+    // Enclosing assembly, or -1 for a top level one.
+    int parent;
+    // Placement of the assembly's frame in the world.
+    gp_Trsf location;
+} AssemblyMetadata;
+
 #endif // METADATA_H
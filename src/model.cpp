@@ -0,0 +1,58 @@
+#include "model.h"
+
+Model::Model() :
+    shapes(new TopTools_HSequenceOfShape())
+{
+}
+
+void Model::clear()
+{
+    source.clear();
+    sourceKey.clear();
+    shapes = new TopTools_HSequenceOfShape();
+    metadata.clear();
+    assemblies.clear();
+}
+
+int Model::count() const
+{
+    return metadata.size();
+}
+
+const TopoDS_Shape& Model::shape(int i) const
+{
+    return shapes->Value(i + 1);
+}
+
+void Model::append(const Handle(TopTools_HSequenceOfShape)& added,
+                   const QList<QPair<QString, QColor> >& objData,
+                   const QList<int>& assemblyOf, int first)
+{
+    for (int i = first; i < added->Length(); i++) {
+        SolidMetadata sm;
+        sm.name = objData[i].first;
+        sm.material = "ALUMINUM";
+        QColor c = objData[i].second;
+        sm.color = Quantity_Color(c.redF(), c.greenF(), c.blueF(),
+                                  Quantity_TOC_RGB);
+        sm.transp = 0.0;
+        sm.assembly = assemblyOf[i];
+        sm.deflection = 0.0;
+        sm.angle = 0.0;
+        shapes->Append(added->Value(i + 1));
+        metadata.append(sm);
+    }
+}
+
+Model Model::snapshot() const
+{
+    Model copy;
+    copy.source = source;
+    copy.sourceKey = sourceKey;
+    copy.metadata = metadata;
+    copy.assemblies = assemblies;
+    for (int i = 1; i <= shapes->Length(); i++) {
+        copy.shapes->Append(shapes->Value(i));
+    }
+    return copy;
+}
@@ -0,0 +1,45 @@
+#ifndef MODEL_H
+#define MODEL_H
+
+#include "metadata.h"
+
+#include <QString>
+#include <QList>
+#include <QPair>
+#include <QColor>
+#include <QVector>
+
+#include <TopoDS_Shape.hxx>
+#include <TopTools_HSequenceOfShape.hxx>
+
+// The solids of an import and what the user made of them: one shape per
+// solid in a contiguous sequence, its metadata at the same index, and the
+// assemblies they sit in. Exports and projects read from here; the viewer
+// only shows it. Plain copies share the shape sequence.
+class Model
+{
+public:
+    Model();
+
+    void clear();
+    int count() const;
+    const TopoDS_Shape& shape(int i) const;
+    // Adds the solids from first on as Translator::importSTEP lists them,
+    // with the default material and tolerances.
+    void append(const Handle(TopTools_HSequenceOfShape)& shapes,
+                const QList<QPair<QString, QColor> >& objData,
+                const QList<int>& assemblyOf, int first = 0);
+    // A copy with a shape sequence of its own, which later appends to this
+    // one leave alone. The shapes themselves are shared.
+    Model snapshot() const;
+
+    // The STEP file imported, if any, and its Translator::importKey() as
+    // the import read it.
+    QString source;
+    QByteArray sourceKey;
+    Handle(TopTools_HSequenceOfShape) shapes;
+    QVector<SolidMetadata> metadata;
+    QVector<AssemblyMetadata> assemblies;
+};
+
+#endif // MODEL_H
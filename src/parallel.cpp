@@ -0,0 +1,517 @@
+#include "parallel.h"
+
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QWaitCondition>
+#include <QVector>
+#include <QList>
+
+#include <Standard.hxx>
+#include <Standard_Version.hxx>
+
+int workerCount(int threads)
+{
+#if OCC_VERSION_HEX < 0x070000
+    // The 6.x memory manager is only thread safe once asked to be.
+    static bool reentrant = false;
+    if (!reentrant) {
+        Standard::SetReentrant(Standard_True);
+        reentrant = true;
+    }
+#endif
+    if (threads <= 0) {
+        threads = QThread::idealThreadCount();
+    }
+    return qMax(threads, 1);
+}
+
+class Task
+{
+public:
+    virtual ~Task() {}
+    virtual void run() = 0;
+};
+
+// Worker threads which each keep a deque of tasks: a worker pushes and pops
+// at the back of its own, and when that is empty, steals from the front of
+// the others'. Threads waiting on tasks they submitted run queued tasks in
+// the meantime, so nested loops never block a worker idle. Whole jobs wait
+// in a queue of their own, which only idle workers take from: a thread
+// waiting on a few tasks must not start a job that outlasts them.
+class StealingPool
+{
+public:
+    explicit StealingPool(int workers);
+    ~StealingPool();
+
+    // The pool the calling thread works for, or NULL.
+    static StealingPool* current();
+    int size() const
+    {
+        return threads.size();
+    }
+    // Takes ownership of the task.
+    void submit(Task* task);
+    // The same, for a job.
+    void submitJob(Task* job);
+    // Runs tasks, and jobs if asked to, until done() holds.
+    void helpUntil(const std::function<bool()>& done, bool jobs = false);
+    // Wakes threads waiting in helpUntil() to check on their condition.
+    void notify();
+private:
+    class Worker;
+    struct Deque {
+        QMutex lock;
+        QList<Task*> tasks;
+    };
+    Task* take(int self, bool jobs);
+    void work(int self);
+
+    QVector<Worker*> threads;
+    QVector<Deque*> deques;
+    Deque queued;
+    QMutex sleepLock;
+    QWaitCondition wake;
+    QAtomicInt pending;
+    QAtomicInt pendingJobs;
+    bool stopping;
+};
+
+static thread_local StealingPool* currentPool = NULL;
+static thread_local int currentWorker = -1;
+
+class StealingPool::Worker : public QThread
+{
+public:
+    Worker(StealingPool* pool, int index) : pool(pool), index(index) {}
+protected:
+    virtual void run()
+    {
+        currentPool = pool;
+        currentWorker = index;
+        pool->work(index);
+    }
+private:
+    StealingPool* pool;
+    int index;
+};
+
+StealingPool::StealingPool(int workers) :
+    pending(0), pendingJobs(0), stopping(false)
+{
+    // One more deque, for tasks submitted from outside the pool.
+    for (int w = 0; w <= workers; w++) {
+        deques.append(new Deque());
+    }
+    for (int w = 0; w < workers; w++) {
+        threads.append(new Worker(this, w));
+    }
+    for (int w = 0; w < workers; w++) {
+        threads[w]->start();
+    }
+}
+
+StealingPool::~StealingPool()
+{
+    {
+        QMutexLocker locker(&sleepLock);
+        stopping = true;
+        wake.wakeAll();
+    }
+    for (int w = 0; w < threads.size(); w++) {
+        threads[w]->wait();
+        delete threads[w];
+    }
+    for (int d = 0; d < deques.size(); d++) {
+        delete deques[d];
+    }
+}
+
+StealingPool* StealingPool::current()
+{
+    return currentPool;
+}
+
+void StealingPool::submit(Task* task)
+{
+    int self = currentPool == this ? currentWorker : threads.size();
+    {
+        QMutexLocker locker(&deques[self]->lock);
+        deques[self]->tasks.append(task);
+    }
+    pending.fetchAndAddOrdered(1);
+    QMutexLocker locker(&sleepLock);
+    wake.wakeAll();
+}
+
+void StealingPool::submitJob(Task* job)
+{
+    {
+        QMutexLocker locker(&queued.lock);
+        queued.tasks.append(job);
+    }
+    pendingJobs.fetchAndAddOrdered(1);
+    QMutexLocker locker(&sleepLock);
+    wake.wakeAll();
+}
+
+void StealingPool::notify()
+{
+    QMutexLocker locker(&sleepLock);
+    wake.wakeAll();
+}
+
+Task* StealingPool::take(int self, bool jobs)
+{
+    if (self >= 0 && self < threads.size()) {
+        QMutexLocker locker(&deques[self]->lock);
+        if (!deques[self]->tasks.isEmpty()) {
+            pending.fetchAndAddOrdered(-1);
+            return deques[self]->tasks.takeLast();
+        }
+    }
+    // Steal the oldest task, which tends to be the biggest, starting with
+    // the next deque over so thieves spread out.
+    int n = deques.size();
+    for (int k = 1; k <= n; k++) {
+        Deque* victim = deques[(qMax(self, 0) + k) % n];
+        QMutexLocker locker(&victim->lock);
+        if (!victim->tasks.isEmpty()) {
+            pending.fetchAndAddOrdered(-1);
+            return victim->tasks.takeFirst();
+        }
+    }
+    // Tasks come first, as the jobs started are waiting on them.
+    if (jobs) {
+        QMutexLocker locker(&queued.lock);
+        if (!queued.tasks.isEmpty()) {
+            pendingJobs.fetchAndAddOrdered(-1);
+            return queued.tasks.takeFirst();
+        }
+    }
+    return NULL;
+}
+
+void StealingPool::work(int self)
+{
+    for (;;) {
+        Task* task = take(self, true);
+        if (task) {
+            task->run();
+            delete task;
+            continue;
+        }
+        QMutexLocker locker(&sleepLock);
+        if (stopping) {
+            return;
+        }
+        if (pending.loadAcquire() == 0 && pendingJobs.loadAcquire() == 0) {
+            wake.wait(&sleepLock);
+        }
+    }
+}
+
+void StealingPool::helpUntil(const std::function<bool()>& done, bool jobs)
+{
+    int self = currentPool == this ? currentWorker : -1;
+    while (!done()) {
+        Task* task = take(self, jobs);
+        if (task) {
+            task->run();
+            delete task;
+            continue;
+        }
+        QMutexLocker locker(&sleepLock);
+        // Tasks finishing elsewhere call notify(); the timeout only guards
+        // against a condition changing without one.
+        bool idle = pending.loadAcquire() == 0 &&
+                    (!jobs || pendingJobs.loadAcquire() == 0);
+        if (idle && !done()) {
+            wake.wait(&sleepLock, 10);
+        }
+    }
+}
+
+class RangeWorker : public QRunnable
+{
+public:
+    RangeWorker(QAtomicInt& next, int count,
+                const std::function<void(int)>& body) :
+        next(next), count(count), body(body)
+    {
+    }
+    virtual void run()
+    {
+        for (;;) {
+            int i = next.fetchAndAddOrdered(1);
+            if (i >= count) {
+                return;
+            }
+            body(i);
+        }
+    }
+private:
+    QAtomicInt& next;
+    const int count;
+    const std::function<void(int)>& body;
+};
+
+// A share of a parallelFor running on a stealing pool.
+class RangeTask : public Task
+{
+public:
+    RangeTask(StealingPool* pool, QAtomicInt& next, QAtomicInt& finished,
+              int count, const std::function<void(int)>& body) :
+        pool(pool), next(next), finished(finished), count(count), body(body)
+    {
+    }
+    virtual void run()
+    {
+        for (;;) {
+            int i = next.fetchAndAddOrdered(1);
+            if (i >= count) {
+                break;
+            }
+            body(i);
+        }
+        finished.fetchAndAddOrdered(1);
+        pool->notify();
+    }
+private:
+    StealingPool* pool;
+    QAtomicInt& next;
+    QAtomicInt& finished;
+    const int count;
+    const std::function<void(int)>& body;
+};
+
+void parallelFor(int count, const std::function<void(int)>& body, int threads)
+{
+    StealingPool* stealing = StealingPool::current();
+    if (stealing && threads != 1 && count > 1) {
+        // Idle workers steal shares of the range; the caller takes indices
+        // too, and waits for the shares to finish.
+        int shares = qMin(threads > 0 ? threads : stealing->size(), count - 1);
+        QAtomicInt next(0);
+        QAtomicInt finished(0);
+        for (int t = 0; t < shares; t++) {
+            stealing->submit(new RangeTask(stealing, next, finished, count,
+                                           body));
+        }
+        for (int i = next.fetchAndAddOrdered(1); i < count;
+             i = next.fetchAndAddOrdered(1)) {
+            body(i);
+        }
+        stealing->helpUntil([&]() {
+            return finished.loadAcquire() == shares;
+        });
+        return;
+    }
+
+    threads = qMin(workerCount(threads), count);
+    if (threads <= 1) {
+        for (int i = 0; i < count; i++) {
+            body(i);
+        }
+        return;
+    }
+
+    QAtomicInt next(0);
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+    for (int t = 0; t < threads; t++) {
+        pool.start(new RangeWorker(next, count, body));
+    }
+    pool.waitForDone();
+}
+
+class ChunkQueue
+{
+public:
+    ChunkQueue(int count, int window) :
+        chunks(count), ready(count, false), window(window), consumed(0)
+    {
+    }
+
+    // Blocks a producer until chunk i is close enough to the consumer.
+    void waitForTurn(int i)
+    {
+        QMutexLocker locker(&lock);
+        while (i >= consumed + window) {
+            chunkTaken.wait(&lock);
+        }
+    }
+    bool isReady(int i)
+    {
+        QMutexLocker locker(&lock);
+        return ready[i];
+    }
+    void put(int i, const QByteArray& chunk)
+    {
+        QMutexLocker locker(&lock);
+        chunks[i] = chunk;
+        ready[i] = true;
+        chunkReady.wakeAll();
+    }
+    QByteArray take(int i)
+    {
+        QMutexLocker locker(&lock);
+        while (!ready[i]) {
+            chunkReady.wait(&lock);
+        }
+        QByteArray chunk = chunks[i];
+        chunks[i] = QByteArray();
+        consumed = i + 1;
+        chunkTaken.wakeAll();
+        return chunk;
+    }
+private:
+    QMutex lock;
+    QWaitCondition chunkReady;
+    QWaitCondition chunkTaken;
+    QVector<QByteArray> chunks;
+    QVector<bool> ready;
+    const int window;
+    int consumed;
+};
+
+class ChunkWorker : public QRunnable
+{
+public:
+    ChunkWorker(QAtomicInt& next, int count, ChunkQueue& queue,
+                const std::function<QByteArray(int)>& produce) :
+        next(next), count(count), queue(queue), produce(produce)
+    {
+    }
+    virtual void run()
+    {
+        for (;;) {
+            int i = next.fetchAndAddOrdered(1);
+            if (i >= count) {
+                return;
+            }
+            // Every index below i was handed out first and passes this
+            // check no later than i does, so the consumer never starves.
+            queue.waitForTurn(i);
+            queue.put(i, produce(i));
+        }
+    }
+private:
+    QAtomicInt& next;
+    const int count;
+    ChunkQueue& queue;
+    const std::function<QByteArray(int)>& produce;
+};
+
+// One chunk of an orderedPipeline running on a stealing pool.
+class ChunkTask : public Task
+{
+public:
+    ChunkTask(StealingPool* pool, int i, ChunkQueue& queue,
+              const std::function<QByteArray(int)>& produce) :
+        pool(pool), i(i), queue(queue), produce(produce)
+    {
+    }
+    virtual void run()
+    {
+        queue.put(i, produce(i));
+        pool->notify();
+    }
+private:
+    StealingPool* pool;
+    const int i;
+    ChunkQueue& queue;
+    const std::function<QByteArray(int)>& produce;
+};
+
+void orderedPipeline(int count, const std::function<QByteArray(int)>& produce,
+                     const std::function<void(int, const QByteArray&)>& consume,
+                     int threads)
+{
+    StealingPool* stealing = StealingPool::current();
+    if (stealing && threads != 1) {
+        // Chunks are only submitted once they fall within the window, so no
+        // task ever has to wait for the consumer.
+        int window = 4 * (threads > 0 ? threads : stealing->size());
+        ChunkQueue queue(count, window);
+        for (int i = 0; i < qMin(window, count); i++) {
+            stealing->submit(new ChunkTask(stealing, i, queue, produce));
+        }
+        for (int i = 0; i < count; i++) {
+            stealing->helpUntil([&]() {
+                return queue.isReady(i);
+            });
+            consume(i, queue.take(i));
+            if (i + window < count) {
+                stealing->submit(new ChunkTask(stealing, i + window, queue,
+                                               produce));
+            }
+        }
+        return;
+    }
+
+    threads = qMin(workerCount(threads), count);
+    if (threads <= 1) {
+        for (int i = 0; i < count; i++) {
+            consume(i, produce(i));
+        }
+        return;
+    }
+
+    QAtomicInt next(0);
+    ChunkQueue queue(count, 4 * threads);
+    QThreadPool pool;
+    pool.setMaxThreadCount(threads);
+    for (int t = 0; t < threads; t++) {
+        pool.start(new ChunkWorker(next, count, queue, produce));
+    }
+    for (int i = 0; i < count; i++) {
+        consume(i, queue.take(i));
+    }
+    pool.waitForDone();
+}
+
+// A job of stealingFor.
+class JobTask : public Task
+{
+public:
+    JobTask(StealingPool* pool, int i, QAtomicInt& finished,
+            const std::function<void(int)>& job) :
+        pool(pool), i(i), finished(finished), job(job)
+    {
+    }
+    virtual void run()
+    {
+        job(i);
+        finished.fetchAndAddOrdered(1);
+        pool->notify();
+    }
+private:
+    StealingPool* pool;
+    const int i;
+    QAtomicInt& finished;
+    const std::function<void(int)>& job;
+};
+
+void stealingFor(int count, const std::function<void(int)>& job, int threads)
+{
+    StealingPool pool(workerCount(threads));
+    QAtomicInt finished(0);
+    for (int i = 0; i < count; i++) {
+        pool.submitJob(new JobTask(&pool, i, finished, job));
+    }
+    // The caller helps out as well, from the deque for outside tasks.
+    StealingPool* outerPool = currentPool;
+    int outerWorker = currentWorker;
+    currentPool = &pool;
+    currentWorker = pool.size();
+    pool.helpUntil([&]() {
+        return finished.loadAcquire() == count;
+    }, true);
+    currentPool = outerPool;
+    currentWorker = outerWorker;
+}
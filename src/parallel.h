@@ -0,0 +1,33 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <QByteArray>
+
+#include <functional>
+
+// Number of worker threads to use when asked for 0 ("all cores").
+int workerCount(int threads);
+
+// Runs body(0) .. body(count - 1) on a pool with one thread per core (or
+// the given number of threads), and returns once all of them are done.
+// Indices are handed out in increasing order, but may complete in any order.
+void parallelFor(int count, const std::function<void(int)>& body,
+                 int threads = 0);
+
+// Runs produce(0) .. produce(count - 1) on worker threads, and passes each
+// result to consume on the calling thread, strictly in index order. Workers
+// stay at most a few chunks ahead of consume, which caps the memory held.
+// With one thread, everything runs inline on the caller.
+void orderedPipeline(int count, const std::function<QByteArray(int)>& produce,
+                     const std::function<void(int, const QByteArray&)>& consume,
+                     int threads = 0);
+
+// Runs job(0) .. job(count - 1) on a work-stealing pool, and returns once
+// all are done. Jobs are started in index order. Within a job, parallelFor
+// and orderedPipeline split their work into tasks on the same pool, which
+// idle workers steal, so one large job spreads over the cores that small
+// ones leave free. Their thread counts then cap the number of tasks.
+void stealingFor(int count, const std::function<void(int)>& job,
+                 int threads = 0);
+
+#endif // PARALLEL_H
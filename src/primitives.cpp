@@ -0,0 +1,598 @@
+#include "primitives.h"
+
+#include <QVector>
+#include <QPair>
+
+#include <TopoDS.hxx>
+#include <TopoDS_Face.hxx>
+#include <TopExp_Explorer.hxx>
+#include <BRep_Tool.hxx>
+#include <BRepGProp.hxx>
+#include <GProp_GProps.hxx>
+#include <Geom_Surface.hxx>
+#include <Geom_RectangularTrimmedSurface.hxx>
+#include <Geom_Plane.hxx>
+#include <Geom_CylindricalSurface.hxx>
+#include <Geom_ConicalSurface.hxx>
+#include <Geom_SphericalSurface.hxx>
+#include <gp_Pln.hxx>
+#include <gp_Cylinder.hxx>
+#include <gp_Cone.hxx>
+#include <gp_Sphere.hxx>
+#include <gp_Lin.hxx>
+#include <gp_Ax3.hxx>
+#include <BRepTools.hxx>
+#include <BRepTools_WireExplorer.hxx>
+#include <TopoDS_Vertex.hxx>
+
+#include <cmath>
+#include <algorithm>
+
+// Lengths (in mm) and angles (in radians) closer than this are equal.
+static const Standard_Real linearTolerance = 1e-6;
+static const Standard_Real angularTolerance = 1e-9;
+// Largest relative difference to the solid's volume accepted.
+static const Standard_Real volumeTolerance = 1e-5;
+
+// Twice the signed area of a polygon; positive when counterclockwise.
+static Standard_Real signedArea(const QVector<gp_XY>& polygon)
+{
+    Standard_Real area = 0.0;
+    for (int i = 0; i < polygon.size(); i++) {
+        area += polygon[i] ^ polygon[(i + 1) % polygon.size()];
+    }
+    return area;
+}
+
+Primitive::Primitive() :
+    kind(None), dx(0.0), dy(0.0), dz(0.0),
+    rmin1(0.0), rmax1(0.0), rmin2(0.0), rmax2(0.0)
+{
+}
+
+Standard_Real Primitive::volume() const
+{
+    switch (kind) {
+    case Box:
+        return dx * dy * dz;
+    case Tube:
+        return M_PI * (rmax1 * rmax1 - rmin1 * rmin1) * dz;
+    case Cone:
+        return M_PI * dz / 3.0 *
+               (rmax1 * rmax1 + rmax1 * rmax2 + rmax2 * rmax2 -
+                rmin1 * rmin1 - rmin1 * rmin2 - rmin2 * rmin2);
+    case Sphere:
+        return 4.0 / 3.0 * M_PI *
+               (rmax1 * rmax1 * rmax1 - rmin1 * rmin1 * rmin1);
+    case Extrusion:
+        return fabs(signedArea(polygon)) / 2 * dz;
+    case Revolution: {
+        // Pappus: the turn of each area element sweeps 2 pi r dA.
+        Standard_Real moment = 0.0;
+        for (int i = 0; i < polygon.size(); i++) {
+            const gp_XY& a = polygon[i];
+            const gp_XY& b = polygon[(i + 1) % polygon.size()];
+            moment += (a.X() + b.X()) * (a ^ b);
+        }
+        return 2 * M_PI * fabs(moment) / 6;
+    }
+    default:
+        return 0.0;
+    }
+}
+
+Bnd_Box Primitive::bounds() const
+{
+    Bnd_Box box;
+    Standard_Real r = std::max(rmax1, rmax2);
+    switch (kind) {
+    case Box:
+        box.Update(-dx / 2, -dy / 2, -dz / 2, dx / 2, dy / 2, dz / 2);
+        break;
+    case Tube:
+    case Cone:
+        box.Update(-r, -r, -dz / 2, r, r, dz / 2);
+        break;
+    case Sphere:
+        box.Update(-r, -r, -r, r, r, r);
+        break;
+    case Extrusion:
+        for (int i = 0; i < polygon.size(); i++) {
+            box.Update(polygon[i].X(), polygon[i].Y(), -dz / 2);
+            box.Update(polygon[i].X(), polygon[i].Y(), dz / 2);
+        }
+        break;
+    case Revolution:
+        for (int i = 0; i < polygon.size(); i++) {
+            r = polygon[i].X();
+            box.Update(-r, -r, polygon[i].Y(), r, r, polygon[i].Y());
+        }
+        break;
+    default:
+        break;
+    }
+    return box;
+}
+
+static Standard_Real height(const gp_Pnt& p, const gp_Ax1& axis)
+{
+    return (p.XYZ() - axis.Location().XYZ()).Dot(axis.Direction().XYZ());
+}
+
+// Three pairs of parallel planes, at right angles to each other.
+static Primitive recognizeBox(const QVector<gp_Pln>& planes)
+{
+    Primitive box;
+    if (planes.size() != 6) {
+        return box;
+    }
+
+    gp_Dir axes[3];
+    Standard_Real lo[3], hi[3];
+    int found = 0;
+    QVector<bool> paired(planes.size(), false);
+    for (int i = 0; i < planes.size(); i++) {
+        if (paired[i]) {
+            continue;
+        }
+        gp_Ax1 axis = planes[i].Axis();
+        int j = i + 1;
+        while (j < planes.size() && (paired[j] ||
+                                     !planes[j].Axis().IsParallel(axis, angularTolerance))) {
+            j++;
+        }
+        if (j == planes.size() || found == 3) {
+            return box;
+        }
+        paired[i] = paired[j] = true;
+        // Distances from the origin along the plane normal.
+        Standard_Real a = axis.Location().XYZ().Dot(axis.Direction().XYZ());
+        Standard_Real b = a + height(planes[j].Location(), axis);
+        if (fabs(a - b) < linearTolerance) {
+            return box;
+        }
+        axes[found] = axis.Direction();
+        lo[found] = std::min(a, b);
+        hi[found] = std::max(a, b);
+        found++;
+    }
+    if (found != 3 || !axes[0].IsNormal(axes[1], angularTolerance) ||
+        !axes[0].IsNormal(axes[2], angularTolerance) ||
+        !axes[1].IsNormal(axes[2], angularTolerance)) {
+        return box;
+    }
+
+    // Make the frame right handed.
+    gp_Dir z = axes[0].Crossed(axes[1]);
+    if (z.Dot(axes[2]) < 0) {
+        Standard_Real t = lo[2];
+        lo[2] = -hi[2];
+        hi[2] = -t;
+    }
+    gp_XYZ center = axes[0].XYZ() * ((lo[0] + hi[0]) / 2) +
+                    axes[1].XYZ() * ((lo[1] + hi[1]) / 2) +
+                    z.XYZ() * ((lo[2] + hi[2]) / 2);
+
+    box.kind = Primitive::Box;
+    box.dx = hi[0] - lo[0];
+    box.dy = hi[1] - lo[1];
+    box.dz = hi[2] - lo[2];
+    box.frame.SetDisplacement(gp_Ax3(), gp_Ax3(gp_Pnt(center), z, axes[0]));
+    return box;
+}
+
+static bool coaxial(const gp_Ax1& axis, const QVector<gp_Cylinder>& cylinders,
+                    const QVector<gp_Cone>& cones)
+{
+    gp_Lin line(axis);
+    for (int i = 0; i < cylinders.size(); i++) {
+        if (!cylinders[i].Axis().IsParallel(axis, angularTolerance) ||
+            line.Distance(cylinders[i].Location()) > linearTolerance) {
+            return false;
+        }
+    }
+    for (int i = 0; i < cones.size(); i++) {
+        if (!cones[i].Axis().IsParallel(axis, angularTolerance) ||
+            line.Distance(cones[i].Location()) > linearTolerance) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Radii of a surface of revolution at the two ends of the axis.
+typedef struct {
+    Standard_Real at1, at2;
+} Profile;
+
+// Two planes across one axis, closing at most two coaxial surfaces of
+// revolution: an outer one, and possibly an inner one.
+static Primitive recognizeCone(const QVector<gp_Pln>& planes,
+                               const QVector<gp_Cylinder>& cylinders,
+                               const QVector<gp_Cone>& cones)
+{
+    Primitive cone;
+    gp_Ax1 axis = cylinders.isEmpty() ? cones[0].Axis() : cylinders[0].Axis();
+    if (!coaxial(axis, cylinders, cones)) {
+        return cone;
+    }
+
+    QVector<Standard_Real> heights;
+    for (int i = 0; i < planes.size(); i++) {
+        if (!planes[i].Axis().IsParallel(axis, angularTolerance)) {
+            return cone;
+        }
+        Standard_Real h = height(planes[i].Location(), axis);
+        bool known = false;
+        for (int j = 0; j < heights.size(); j++) {
+            known = known || fabs(heights[j] - h) < linearTolerance;
+        }
+        if (!known) {
+            heights.append(h);
+        }
+    }
+    if (heights.size() != 2) {
+        return cone;
+    }
+    Standard_Real h1 = std::min(heights[0], heights[1]);
+    Standard_Real h2 = std::max(heights[0], heights[1]);
+
+    // A surface may be split across several faces; collect the distinct
+    // radius profiles.
+    QVector<Profile> profiles;
+    for (int i = 0; i < cylinders.size() + cones.size(); i++) {
+        Profile p;
+        if (i < cylinders.size()) {
+            p.at1 = p.at2 = cylinders[i].Radius();
+        } else {
+            const gp_Cone& c = cones[i - cylinders.size()];
+            Standard_Real slope = tan(c.SemiAngle()) *
+                                  c.Axis().Direction().Dot(axis.Direction());
+            Standard_Real h0 = height(c.Location(), axis);
+            p.at1 = c.RefRadius() + (h1 - h0) * slope;
+            p.at2 = c.RefRadius() + (h2 - h0) * slope;
+        }
+        if (p.at1 < -linearTolerance || p.at2 < -linearTolerance) {
+            return cone;
+        }
+        p.at1 = std::max(p.at1, 0.0);
+        p.at2 = std::max(p.at2, 0.0);
+        bool known = false;
+        for (int j = 0; j < profiles.size(); j++) {
+            known = known || (fabs(profiles[j].at1 - p.at1) < linearTolerance &&
+                              fabs(profiles[j].at2 - p.at2) < linearTolerance);
+        }
+        if (!known) {
+            profiles.append(p);
+        }
+    }
+    if (profiles.size() > 2) {
+        return cone;
+    }
+    Profile outer = profiles[0];
+    Profile inner = {0.0, 0.0};
+    if (profiles.size() == 2) {
+        inner = profiles[1];
+        if (inner.at1 + inner.at2 > outer.at1 + outer.at2) {
+            std::swap(inner, outer);
+        }
+        if (inner.at1 >= outer.at1 || inner.at2 >= outer.at2) {
+            return cone;
+        }
+    }
+
+    bool straight = fabs(outer.at1 - outer.at2) < linearTolerance &&
+                    fabs(inner.at1 - inner.at2) < linearTolerance;
+    cone.kind = straight ? Primitive::Tube : Primitive::Cone;
+    cone.dz = h2 - h1;
+    cone.rmin1 = inner.at1;
+    cone.rmax1 = outer.at1;
+    cone.rmin2 = straight ? inner.at1 : inner.at2;
+    cone.rmax2 = straight ? outer.at1 : outer.at2;
+    gp_Pnt center = axis.Location().Translated(gp_Vec(axis.Direction()) *
+                    ((h1 + h2) / 2));
+    cone.frame.SetDisplacement(gp_Ax3(), gp_Ax3(center, axis.Direction()));
+    return cone;
+}
+
+// One or two concentric spheres, the inner one hollowing out the other.
+static Primitive recognizeSphere(const QVector<gp_Sphere>& spheres)
+{
+    Primitive sphere;
+    gp_Pnt center = spheres[0].Location();
+    QVector<Standard_Real> radii;
+    for (int i = 0; i < spheres.size(); i++) {
+        if (spheres[i].Location().Distance(center) > linearTolerance) {
+            return sphere;
+        }
+        bool known = false;
+        for (int j = 0; j < radii.size(); j++) {
+            known = known || fabs(radii[j] - spheres[i].Radius()) < linearTolerance;
+        }
+        if (!known) {
+            radii.append(spheres[i].Radius());
+        }
+    }
+    if (radii.size() > 2) {
+        return sphere;
+    }
+
+    sphere.kind = Primitive::Sphere;
+    sphere.rmax1 = sphere.rmax2 = radii[0];
+    if (radii.size() == 2) {
+        sphere.rmin1 = sphere.rmin2 = std::min(radii[0], radii[1]);
+        sphere.rmax1 = sphere.rmax2 = std::max(radii[0], radii[1]);
+    }
+    sphere.frame.SetTranslation(gp_Vec(center.XYZ()));
+    return sphere;
+}
+
+// Drops vertices which repeat their predecessor or lie on the line
+// joining their neighbours.
+static QVector<gp_XY> simplifyPolygon(const QVector<gp_XY>& polygon)
+{
+    QVector<gp_XY> result = polygon;
+    bool changed = true;
+    while (changed && result.size() >= 3) {
+        changed = false;
+        for (int i = 0; i < result.size() && result.size() >= 3; i++) {
+            const gp_XY& prev = result[(i + result.size() - 1) % result.size()];
+            const gp_XY& next = result[(i + 1) % result.size()];
+            gp_XY a = result[i] - prev;
+            gp_XY b = next - result[i];
+            Standard_Real length = std::max(a.Modulus(), b.Modulus());
+            if (a.Modulus() < linearTolerance ||
+                fabs(a ^ b) < linearTolerance * length) {
+                result.remove(i);
+                changed = true;
+                i--;
+            }
+        }
+    }
+    return result;
+}
+
+// Two parallel planar caps, and planar sides all along the axis between
+// them. The outline of a cap is the cross section.
+static Primitive recognizeExtrusion(const QVector<gp_Pln>& planes,
+                                    const QVector<TopoDS_Face>& faces)
+{
+    Primitive extrusion;
+    for (int c = 0; c < planes.size(); c++) {
+        gp_Ax1 axis = planes[c].Axis();
+        QVector<int> caps;
+        bool sides = true;
+        for (int i = 0; i < planes.size() && sides; i++) {
+            if (planes[i].Axis().IsParallel(axis, angularTolerance)) {
+                caps.append(i);
+            } else {
+                sides = planes[i].Axis().IsNormal(axis, angularTolerance);
+            }
+        }
+        if (!sides || caps.size() != 2) {
+            continue;
+        }
+        Standard_Real h1 = height(planes[caps[0]].Location(), axis);
+        Standard_Real h2 = height(planes[caps[1]].Location(), axis);
+        if (fabs(h1 - h2) < linearTolerance) {
+            continue;
+        }
+
+        // G4ExtrudedSolid has no holes; along another axis, the caps may
+        // have none.
+        const TopoDS_Face& cap = faces[caps[0]];
+        int wires = 0;
+        for (TopExp_Explorer exp(cap, TopAbs_WIRE); exp.More(); exp.Next()) {
+            wires++;
+        }
+        if (wires != 1) {
+            continue;
+        }
+
+        gp_Pnt center = axis.Location().Translated(gp_Vec(axis.Direction()) *
+                        ((h1 + h2) / 2));
+        gp_Ax3 frame(center, axis.Direction());
+        QVector<gp_XY> polygon;
+        for (BRepTools_WireExplorer exp(BRepTools::OuterWire(cap), cap);
+             exp.More(); exp.Next()) {
+            gp_XYZ p = BRep_Tool::Pnt(exp.CurrentVertex()).XYZ() - center.XYZ();
+            polygon.append(gp_XY(p.Dot(frame.XDirection().XYZ()),
+                                 p.Dot(frame.YDirection().XYZ())));
+        }
+        polygon = simplifyPolygon(polygon);
+        if (polygon.size() < 3) {
+            continue;
+        }
+        // Geant4 wants the vertices clockwise.
+        if (signedArea(polygon) > 0) {
+            std::reverse(polygon.begin(), polygon.end());
+        }
+
+        extrusion.kind = Primitive::Extrusion;
+        extrusion.dz = fabs(h2 - h1);
+        extrusion.polygon = polygon;
+        extrusion.frame.SetDisplacement(gp_Ax3(), frame);
+        return extrusion;
+    }
+    return extrusion;
+}
+
+// Planes across one axis and coaxial cylinders and cones, which sweep a
+// polygon in the (r, z) half plane a full turn about the axis.
+static Primitive recognizeRevolution(const QVector<gp_Pln>& planes,
+                                     const QVector<TopoDS_Face>& planeFaces,
+                                     const QVector<gp_Cylinder>& cylinders,
+                                     const QVector<gp_Cone>& cones,
+                                     const QVector<TopoDS_Face>& revolvedFaces)
+{
+    Primitive revolution;
+    gp_Ax1 axis = cylinders.isEmpty() ? cones[0].Axis() : cylinders[0].Axis();
+    if (!coaxial(axis, cylinders, cones)) {
+        return revolution;
+    }
+    for (int i = 0; i < planes.size(); i++) {
+        if (!planes[i].Axis().IsParallel(axis, angularTolerance)) {
+            return revolution;
+        }
+    }
+
+    // Each face of a full turn spans a segment of the profile, between the
+    // (r, z) points its vertices map to. A disk has no vertex on the axis.
+    gp_Lin line(axis);
+    QVector<gp_XY> points;
+    QVector<QPair<int, int> > segments;
+    for (int f = 0; f < planeFaces.size() + revolvedFaces.size(); f++) {
+        const TopoDS_Face& face = f < planeFaces.size() ? planeFaces[f] :
+                                  revolvedFaces[f - planeFaces.size()];
+        QVector<int> ends;
+        for (TopExp_Explorer exp(face, TopAbs_VERTEX); exp.More(); exp.Next()) {
+            gp_Pnt p = BRep_Tool::Pnt(TopoDS::Vertex(exp.Current()));
+            gp_XY rz(line.Distance(p), height(p, axis));
+            if (rz.X() < linearTolerance) {
+                rz.SetX(0.0);
+            }
+            int k = 0;
+            while (k < points.size() && (points[k] - rz).Modulus() >= linearTolerance) {
+                k++;
+            }
+            if (k == points.size()) {
+                points.append(rz);
+            }
+            if (!ends.contains(k)) {
+                ends.append(k);
+            }
+        }
+        if (f < planeFaces.size() && ends.size() == 1) {
+            gp_XY center(0.0, points[ends[0]].Y());
+            int k = 0;
+            while (k < points.size() && (points[k] - center).Modulus() >= linearTolerance) {
+                k++;
+            }
+            if (k == points.size()) {
+                points.append(center);
+            }
+            ends.append(k);
+        }
+        if (ends.size() != 2) {
+            return revolution;
+        }
+        QPair<int, int> segment(std::min(ends[0], ends[1]), std::max(ends[0], ends[1]));
+        if (!segments.contains(segment)) {
+            segments.append(segment);
+        }
+    }
+
+    // Chain the segments into one polygon. Where it touches the axis, the
+    // chain may be open; the axis closes it.
+    QVector<QVector<int> > neighbours(points.size());
+    for (int i = 0; i < segments.size(); i++) {
+        neighbours[segments[i].first].append(segments[i].second);
+        neighbours[segments[i].second].append(segments[i].first);
+    }
+    int start = 0;
+    for (int k = 0; k < points.size(); k++) {
+        if (neighbours[k].size() == 1) {
+            if (points[k].X() != 0.0) {
+                return revolution;
+            }
+            start = k;
+        } else if (neighbours[k].size() != 2) {
+            return revolution;
+        }
+    }
+    QVector<gp_XY> polygon;
+    int prev = -1, cur = start;
+    int walked = 0;
+    do {
+        polygon.append(points[cur]);
+        int next = neighbours[cur][0] != prev ? neighbours[cur][0] :
+                   neighbours[cur].value(1, -1);
+        prev = cur;
+        cur = next;
+        walked++;
+    } while (cur >= 0 && cur != start && walked <= points.size());
+    if (polygon.size() != points.size()) {
+        return revolution;
+    }
+    polygon = simplifyPolygon(polygon);
+    if (polygon.size() < 3) {
+        return revolution;
+    }
+
+    revolution.kind = Primitive::Revolution;
+    revolution.polygon = polygon;
+    revolution.frame.SetDisplacement(gp_Ax3(), gp_Ax3(axis.Location(),
+                                     axis.Direction()));
+    return revolution;
+}
+
+Primitive recognizePrimitive(const TopoDS_Shape& shape)
+{
+    Primitive none;
+    if (shape.IsNull() || shape.ShapeType() != TopAbs_SOLID) {
+        return none;
+    }
+
+    QVector<gp_Pln> planes;
+    QVector<gp_Cylinder> cylinders;
+    QVector<gp_Cone> cones;
+    QVector<gp_Sphere> spheres;
+    QVector<TopoDS_Face> planeFaces, revolvedFaces;
+    for (TopExp_Explorer exp(shape, TopAbs_FACE); exp.More(); exp.Next()) {
+        const TopoDS_Face& face = TopoDS::Face(exp.Current());
+        Handle(Geom_Surface) surface = BRep_Tool::Surface(face);
+        while (!surface.IsNull() &&
+               surface->IsKind(STANDARD_TYPE(Geom_RectangularTrimmedSurface))) {
+            surface = Handle(Geom_RectangularTrimmedSurface)::DownCast(
+                          surface)->BasisSurface();
+        }
+        if (surface.IsNull()) {
+            return none;
+        } else if (surface->IsKind(STANDARD_TYPE(Geom_Plane))) {
+            planes.append(Handle(Geom_Plane)::DownCast(surface)->Pln());
+            planeFaces.append(face);
+        } else if (surface->IsKind(STANDARD_TYPE(Geom_CylindricalSurface))) {
+            cylinders.append(Handle(Geom_CylindricalSurface)::DownCast(
+                                 surface)->Cylinder());
+            revolvedFaces.append(face);
+        } else if (surface->IsKind(STANDARD_TYPE(Geom_ConicalSurface))) {
+            cones.append(Handle(Geom_ConicalSurface)::DownCast(surface)->Cone());
+            revolvedFaces.append(face);
+        } else if (surface->IsKind(STANDARD_TYPE(Geom_SphericalSurface))) {
+            spheres.append(Handle(Geom_SphericalSurface)::DownCast(
+                               surface)->Sphere());
+        } else {
+            return none;
+        }
+    }
+
+    // Prefer the simplest solid which fits.
+    Primitive result;
+    if (cylinders.isEmpty() && cones.isEmpty() && spheres.isEmpty()) {
+        result = recognizeBox(planes);
+        if (result.kind == Primitive::None) {
+            result = recognizeExtrusion(planes, planeFaces);
+        }
+    } else if (spheres.isEmpty()) {
+        result = recognizeCone(planes, cylinders, cones);
+        if (result.kind == Primitive::None) {
+            result = recognizeRevolution(planes, planeFaces, cylinders, cones,
+                                         revolvedFaces);
+        }
+    } else if (planes.isEmpty() && cylinders.isEmpty() && cones.isEmpty()) {
+        result = recognizeSphere(spheres);
+    }
+    if (result.kind == Primitive::None) {
+        return none;
+    }
+
+    // The surfaces alone do not show how the faces are trimmed, so only
+    // trust the result if it encloses the same volume as the solid.
+    GProp_GProps props;
+    BRepGProp::VolumeProperties(shape, props);
+    Standard_Real expected = result.volume();
+    if (fabs(fabs(props.Mass()) - expected) > volumeTolerance * expected) {
+        return none;
+    }
+    return result;
+}
@@ -0,0 +1,54 @@
+#ifndef PRIMITIVES_H
+#define PRIMITIVES_H
+
+#include <QVector>
+
+#include <Standard.hxx>
+#include <gp_XY.hxx>
+#include <gp_Trsf.hxx>
+#include <Bnd_Box.hxx>
+#include <TopoDS_Shape.hxx>
+
+// A GDML solid described by a few dimensions, in its own frame: centered
+// on the origin, with any axis of revolution along z. Only the outline of
+// a revolution is not centered.
+class Primitive
+{
+public:
+    enum Kind {
+        None,
+        Box,
+        Tube,
+        Cone,
+        Sphere,
+        Extrusion,
+        Revolution
+    };
+
+    Primitive();
+
+    // Enclosed volume, in mm^3.
+    Standard_Real volume() const;
+    // Bounding box in the primitive's frame.
+    Bnd_Box bounds() const;
+
+    Kind kind;
+    // Full lengths; only a box uses dx and dy. An extrusion runs from
+    // z = -dz/2 to +dz/2.
+    Standard_Real dx, dy, dz;
+    // Inner and outer radii at z = -dz/2 (1) and z = +dz/2 (2). Tubes and
+    // spheres only use rmin1 and rmax1.
+    Standard_Real rmin1, rmax1, rmin2, rmax2;
+    // Extrusion: the (x, y) cross section, clockwise. Revolution: the
+    // (r, z) outline turned about the z axis.
+    QVector<gp_XY> polygon;
+    // Maps the primitive's frame into that of the shape.
+    gp_Trsf frame;
+};
+
+// Finds the primitive which is exactly the given solid, from the types of
+// its surfaces, and checks the result against the solid's volume. Returns
+// a primitive of kind None if there is no such primitive.
+Primitive recognizePrimitive(const TopoDS_Shape& shape);
+
+#endif // PRIMITIVES_H
@@ -0,0 +1,341 @@
+#include "project.h"
+
+#include <string.h>
+
+// The file starts with a header, then holds these sections, each 8-byte
+// aligned: solid records, mesh records, the nodes (double), the triangles
+// (qint32), and a blob of UTF-8 strings. Offsets are from the start of the
+// file; strings are found by offset and size within the blob.
+struct ProjectHeader {
+    char magic[8];
+    quint32 version;
+    quint32 solidCount;
+    quint32 meshCount;
+    quint32 padding;
+    quint64 fileSize;
+    quint64 solidsOffset;
+    quint64 meshesOffset;
+    quint64 nodesOffset;
+    quint64 nodeValues;
+    quint64 trianglesOffset;
+    quint64 triangleValues;
+    quint64 stringsOffset;
+    quint64 stringsSize;
+    // Within the blob.
+    quint64 source[2];
+    quint64 sourceKey[2];
+    quint64 fingerprint[2];
+};
+
+struct ProjectSolid {
+    quint64 name[2];
+    quint64 material[2];
+    double color[3];
+    double transp;
+    double deflection;
+    double angle;
+};
+
+// Ranges of values, not of nodes or triangles.
+struct ProjectMesh {
+    quint64 firstNode;
+    quint64 nodeValues;
+    quint64 firstTriangle;
+    quint64 triangleValues;
+    qint64 undecimated;
+};
+
+static const char projectMagic[8] = {'S', 'T', 'G', 'D', 'P', 'R', 'J', '\0'};
+static const quint32 projectVersion = 1;
+
+static quint64 align8(quint64 offset)
+{
+    return (offset + 7) & ~quint64(7);
+}
+
+static bool aligned8(quint64 offset)
+{
+    return (offset & 7) == 0;
+}
+
+Project::Project() :
+    data(NULL), size(0), header(NULL), solids(NULL), meshes(NULL)
+{
+}
+
+Project::~Project()
+{
+    close();
+}
+
+bool Project::isOpen() const
+{
+    return header != NULL;
+}
+
+void Project::close()
+{
+    if (data) {
+        file.unmap((uchar*)data);
+    }
+    file.close();
+    data = NULL;
+    size = 0;
+    header = NULL;
+    solids = NULL;
+    meshes = NULL;
+}
+
+// Whether [offset, offset + length) lies within size, without overflowing.
+static bool within(quint64 offset, quint64 length, quint64 size)
+{
+    return offset <= size && length <= size - offset;
+}
+
+bool Project::open(QString path)
+{
+    close();
+    file.setFileName(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    size = file.size();
+    if (size < sizeof(ProjectHeader)) {
+        close();
+        return false;
+    }
+    data = file.map(0, size);
+    if (!data) {
+        close();
+        return false;
+    }
+
+    const ProjectHeader* h = (const ProjectHeader*)data;
+    const quint64 blob = h->stringsOffset;
+    bool ok = memcmp(h->magic, projectMagic, sizeof(projectMagic)) == 0 &&
+              h->version == projectVersion && h->fileSize == size &&
+              aligned8(h->solidsOffset) && aligned8(h->meshesOffset) &&
+              aligned8(h->nodesOffset) && aligned8(h->trianglesOffset) &&
+              within(h->solidsOffset, quint64(h->solidCount) *
+                     sizeof(ProjectSolid), size) &&
+              within(h->meshesOffset, quint64(h->meshCount) *
+                     sizeof(ProjectMesh), size) &&
+              h->nodeValues <= size / sizeof(double) &&
+              within(h->nodesOffset, h->nodeValues * sizeof(double), size) &&
+              h->triangleValues <= size / sizeof(qint32) &&
+              within(h->trianglesOffset, h->triangleValues * sizeof(qint32),
+                     size) &&
+              within(blob, h->stringsSize, size) &&
+              within(h->source[0], h->source[1], h->stringsSize) &&
+              within(h->sourceKey[0], h->sourceKey[1], h->stringsSize) &&
+              within(h->fingerprint[0], h->fingerprint[1], h->stringsSize);
+    const ProjectSolid* ss = (const ProjectSolid*)(data + h->solidsOffset);
+    for (quint32 i = 0; ok && i < h->solidCount; i++) {
+        ok = within(ss[i].name[0], ss[i].name[1], h->stringsSize) &&
+             within(ss[i].material[0], ss[i].material[1], h->stringsSize);
+    }
+    const ProjectMesh* ms = (const ProjectMesh*)(data + h->meshesOffset);
+    const qint32* triangles = (const qint32*)(data + h->trianglesOffset);
+    for (quint32 i = 0; ok && i < h->meshCount; i++) {
+        ok = within(ms[i].firstNode, ms[i].nodeValues, h->nodeValues) &&
+             within(ms[i].firstTriangle, ms[i].triangleValues,
+                    h->triangleValues) &&
+             ms[i].nodeValues % 3 == 0 && ms[i].triangleValues % 3 == 0;
+        // Every triangle must join nodes of its own mesh.
+        const qint32* t = triangles + (ok ? ms[i].firstTriangle : 0);
+        const qint64 nodes = ms[i].nodeValues / 3;
+        for (quint64 j = 0; ok && j < ms[i].triangleValues; j++) {
+            ok = t[j] >= 0 && t[j] < nodes;
+        }
+    }
+    if (!ok) {
+        close();
+        return false;
+    }
+    header = h;
+    solids = ss;
+    meshes = ms;
+    return true;
+}
+
+QByteArray Project::bytes(quint64 offset, quint64 length) const
+{
+    return QByteArray((const char*)data + header->stringsOffset + offset,
+                      length);
+}
+
+QString Project::source() const
+{
+    return QString::fromUtf8(bytes(header->source[0], header->source[1]));
+}
+
+QByteArray Project::sourceKey() const
+{
+    return bytes(header->sourceKey[0], header->sourceKey[1]);
+}
+
+bool Project::restore(QVector<SolidMetadata>& metadata) const
+{
+    if (quint32(metadata.size()) != header->solidCount) {
+        return false;
+    }
+    for (int i = 0; i < metadata.size(); i++) {
+        const ProjectSolid& saved = solids[i];
+        SolidMetadata& m = metadata[i];
+        m.name = QString::fromUtf8(bytes(saved.name[0], saved.name[1]));
+        m.material = QString::fromUtf8(bytes(saved.material[0],
+                                             saved.material[1]));
+        m.color = Quantity_Color(saved.color[0], saved.color[1], saved.color[2],
+                                 Quantity_TOC_RGB);
+        m.transp = saved.transp;
+        m.deflection = saved.deflection;
+        m.angle = saved.angle;
+    }
+    return true;
+}
+
+QByteArray Project::fingerprint() const
+{
+    return bytes(header->fingerprint[0], header->fingerprint[1]);
+}
+
+int Project::count() const
+{
+    return header->meshCount;
+}
+
+TriangleMesh Project::mesh(int s) const
+{
+    const ProjectMesh& m = meshes[s];
+    const double* nodes = (const double*)(data + header->nodesOffset);
+    const qint32* triangles = (const qint32*)(data + header->trianglesOffset);
+    TriangleMesh result;
+    result.nodes.resize(m.nodeValues);
+    memcpy(result.nodes.data(), nodes + m.firstNode,
+           m.nodeValues * sizeof(double));
+    result.triangles.resize(m.triangleValues);
+    memcpy(result.triangles.data(), triangles + m.firstTriangle,
+           m.triangleValues * sizeof(qint32));
+    return result;
+}
+
+int Project::undecimatedCount(int s) const
+{
+    return meshes[s].undecimated;
+}
+
+// Collects the strings, handing out their place in the blob.
+class StringBlob
+{
+public:
+    void add(quint64 ref[2], const QByteArray& text)
+    {
+        ref[0] = blob.size();
+        ref[1] = text.size();
+        blob.append(text);
+    }
+    QByteArray blob;
+};
+
+static bool writeAll(QFile& file, const void* data, quint64 size)
+{
+    return file.write((const char*)data, size) == qint64(size);
+}
+
+static bool padTo(QFile& file, quint64 offset)
+{
+    static const char zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    return writeAll(file, zeros, offset - file.pos());
+}
+
+bool Project::save(QString path, QString source, const QByteArray& sourceKey,
+                   const QVector<SolidMetadata>& metadata,
+                   const MeshSource* meshSource)
+{
+    ProjectHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, projectMagic, sizeof(projectMagic));
+    h.version = projectVersion;
+    h.solidCount = metadata.size();
+    h.meshCount = meshSource ? meshSource->count() : 0;
+
+    StringBlob strings;
+    strings.add(h.source, source.toUtf8());
+    strings.add(h.sourceKey, sourceKey);
+    strings.add(h.fingerprint, meshSource ? meshSource->fingerprint() :
+                QByteArray());
+
+    QVector<ProjectSolid> solidRecords(h.solidCount);
+    for (int i = 0; i < metadata.size(); i++) {
+        const SolidMetadata& m = metadata[i];
+        ProjectSolid& r = solidRecords[i];
+        strings.add(r.name, m.name.toUtf8());
+        strings.add(r.material, m.material.toUtf8());
+        r.color[0] = m.color.Red();
+        r.color[1] = m.color.Green();
+        r.color[2] = m.color.Blue();
+        r.transp = m.transp;
+        r.deflection = m.deflection;
+        r.angle = m.angle;
+    }
+
+    // Fetched once; a MeshSet hands out shared copies of what it holds.
+    QVector<TriangleMesh> meshList(h.meshCount);
+    QVector<ProjectMesh> meshRecords(h.meshCount);
+    for (quint32 s = 0; s < h.meshCount; s++) {
+        meshList[s] = meshSource->mesh(s);
+        const TriangleMesh& mesh = meshList[s];
+        ProjectMesh& r = meshRecords[s];
+        r.firstNode = h.nodeValues;
+        r.nodeValues = mesh.nodes.size();
+        r.firstTriangle = h.triangleValues;
+        r.triangleValues = mesh.triangles.size();
+        r.undecimated = meshSource->undecimatedCount(s);
+        h.nodeValues += r.nodeValues;
+        h.triangleValues += r.triangleValues;
+    }
+
+    h.solidsOffset = align8(sizeof(ProjectHeader));
+    h.meshesOffset = align8(h.solidsOffset + h.solidCount *
+                            sizeof(ProjectSolid));
+    h.nodesOffset = align8(h.meshesOffset + h.meshCount * sizeof(ProjectMesh));
+    h.trianglesOffset = align8(h.nodesOffset + h.nodeValues * sizeof(double));
+    h.stringsOffset = align8(h.trianglesOffset + h.triangleValues *
+                             sizeof(qint32));
+    h.stringsSize = strings.blob.size();
+    h.fileSize = h.stringsOffset + h.stringsSize;
+
+    // Written aside and renamed over, so an open project being saved over
+    // stays intact until the new one is complete.
+    QFile file(path + ".tmp");
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+    bool ok = writeAll(file, &h, sizeof(h)) && padTo(file, h.solidsOffset) &&
+              writeAll(file, solidRecords.constData(),
+                       h.solidCount * sizeof(ProjectSolid)) &&
+              padTo(file, h.meshesOffset) &&
+              writeAll(file, meshRecords.constData(),
+                       h.meshCount * sizeof(ProjectMesh)) &&
+              padTo(file, h.nodesOffset);
+    for (quint32 s = 0; ok && s < h.meshCount; s++) {
+        const TriangleMesh& mesh = meshList[s];
+        ok = writeAll(file, mesh.nodes.constData(),
+                      mesh.nodes.size() * sizeof(double));
+    }
+    ok = ok && padTo(file, h.trianglesOffset);
+    for (quint32 s = 0; ok && s < h.meshCount; s++) {
+        const TriangleMesh& mesh = meshList[s];
+        ok = writeAll(file, mesh.triangles.constData(),
+                      mesh.triangles.size() * sizeof(qint32));
+    }
+    ok = ok && padTo(file, h.stringsOffset) &&
+         writeAll(file, strings.blob.constData(), h.stringsSize);
+    file.close();
+    if (!ok || file.error() != QFile::NoError) {
+        QFile::remove(path + ".tmp");
+        return false;
+    }
+    QFile::remove(path);
+    return QFile::rename(path + ".tmp", path);
+}
@@ -0,0 +1,60 @@
+#ifndef PROJECT_H
+#define PROJECT_H
+
+#include "metadata.h"
+#include "triangulate.h"
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QFile>
+
+struct ProjectHeader;
+struct ProjectSolid;
+struct ProjectMesh;
+
+// A saved session: the STEP file it started from, the edits made to each
+// solid, and optionally the meshes of the last export. Everything sits in
+// flat, aligned arrays, so opening only maps the file; meshes are copied
+// out as an export asks for them.
+class Project : public MeshSource
+{
+public:
+    Project();
+    virtual ~Project();
+
+    // Maps the file and checks its layout; false if it is no project.
+    bool open(QString path);
+    void close();
+    bool isOpen() const;
+
+    // Writes a project for the import of source, whose importKey() is
+    // sourceKey. meshes may be NULL.
+    static bool save(QString path, QString source, const QByteArray& sourceKey,
+                     const QVector<SolidMetadata>& metadata,
+                     const MeshSource* meshes);
+
+    QString source() const;
+    QByteArray sourceKey() const;
+    // Applies the saved names, materials, colors and tolerances. False if
+    // metadata is not for as many solids as were saved.
+    bool restore(QVector<SolidMetadata>& metadata) const;
+
+    virtual QByteArray fingerprint() const;
+    virtual int count() const;
+    virtual TriangleMesh mesh(int s) const;
+    virtual int undecimatedCount(int s) const;
+private:
+    Project(const Project&);
+    void operator=(const Project&);
+    QByteArray bytes(quint64 offset, quint64 size) const;
+
+    QFile file;
+    const uchar* data;
+    quint64 size;
+    const ProjectHeader* header;
+    const ProjectSolid* solids;
+    const ProjectMesh* meshes;
+};
+
+#endif // PROJECT_H
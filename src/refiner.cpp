@@ -0,0 +1,233 @@
+#include "refiner.h"
+#include "parallel.h"
+#include "trace.h"
+
+#include <QMutexLocker>
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+
+#include <Bnd_Box.hxx>
+#include <BRepBndLib.hxx>
+#include <BRepBuilderAPI_Copy.hxx>
+#include <BRepMesh_IncrementalMesh.hxx>
+#include <BRep_Builder.hxx>
+#include <BRep_Tool.hxx>
+#include <TopExp_Explorer.hxx>
+#include <TopoDS.hxx>
+#include <TopoDS_Face.hxx>
+#include <TopLoc_Location.hxx>
+#include <Poly_Triangulation.hxx>
+
+// The triangulations of the faces of a solid, in the order TopExp_Explorer
+// visits them.
+class RefinedSolid
+{
+public:
+    int solid;
+    QList<Handle(Poly_Triangulation)> faces;
+};
+
+typedef std::pair<double, int> HeapEntry;
+
+Refiner::Refiner(double deviation, double angle) :
+    deviation(deviation), angle(angle), generation(0), stopping(false)
+{
+    // OpenCASCADE is about to be used from several threads.
+    workerCount(1);
+}
+
+Refiner::~Refiner()
+{
+    stop();
+    qDeleteAll(done);
+}
+
+void Refiner::add(int solid, const TopoDS_Shape& shape)
+{
+    TopoDS_Shape part = shape.Located(TopLoc_Location());
+    QMutexLocker locker(&lock);
+    int first = solid;
+    if (parts.IsBound(part)) {
+        first = parts.Find(part);
+    } else {
+        parts.Bind(part, solid);
+        pending.insert(solid, shape);
+    }
+    instances[first].append(solid);
+    // The part goes as early as any of its instances.
+    double priority = solid < priorities.size() ? priorities[solid] :
+                      std::numeric_limits<double>::max();
+    heap.push_back(HeapEntry(priority, first));
+    std::push_heap(heap.begin(), heap.end(), std::greater<HeapEntry>());
+    queued.wakeOne();
+}
+
+void Refiner::setPriorities(const QVector<double>& p)
+{
+    QMutexLocker locker(&lock);
+    priorities = p;
+    heap.clear();
+    QHash<int, TopoDS_Shape>::const_iterator it;
+    for (it = pending.constBegin(); it != pending.constEnd(); ++it) {
+        const QVector<int>& solids = instances[it.key()];
+        double priority = std::numeric_limits<double>::max();
+        for (int i = 0; i < solids.size(); i++) {
+            if (solids[i] < p.size()) {
+                priority = qMin(priority, p[solids[i]]);
+            }
+        }
+        heap.push_back(HeapEntry(priority, it.key()));
+    }
+    std::make_heap(heap.begin(), heap.end(), std::greater<HeapEntry>());
+}
+
+void Refiner::clear()
+{
+    QMutexLocker locker(&lock);
+    pending.clear();
+    parts.Clear();
+    instances.clear();
+    priorities.clear();
+    heap.clear();
+    qDeleteAll(done);
+    done.clear();
+    generation++;
+}
+
+bool Refiner::isIdle()
+{
+    QMutexLocker locker(&lock);
+    return pending.isEmpty();
+}
+
+QVector<int> Refiner::apply(const Model& model)
+{
+    QList<RefinedSolid*> taken;
+    QVector<QVector<int> > users;
+    {
+        QMutexLocker locker(&lock);
+        taken = done;
+        done.clear();
+        for (int i = 0; i < taken.size(); i++) {
+            users.append(instances.value(taken[i]->solid));
+        }
+    }
+    QVector<int> refined;
+    BRep_Builder builder;
+    for (int i = 0; i < taken.size(); i++) {
+        const RefinedSolid* r = taken[i];
+        if (r->solid >= model.count()) {
+            continue;
+        }
+        TopExp_Explorer it(model.shape(r->solid), TopAbs_FACE);
+        for (int f = 0; it.More() && f < r->faces.size(); it.Next(), f++) {
+            if (!r->faces[f].IsNull()) {
+                builder.UpdateFace(TopoDS::Face(it.Current()), r->faces[f]);
+            }
+        }
+        // The instances have the same faces, so are refined too.
+        for (int k = 0; k < users[i].size(); k++) {
+            if (users[i][k] < model.count()) {
+                refined.append(users[i][k]);
+            }
+        }
+    }
+    qDeleteAll(taken);
+    return refined;
+}
+
+void Refiner::stop()
+{
+    {
+        QMutexLocker locker(&lock);
+        stopping = true;
+        queued.wakeAll();
+    }
+    wait();
+}
+
+void Refiner::run()
+{
+    // One core is left to the GUI.
+    int threads = qMax(workerCount(0) - 1, 1);
+    parallelFor(threads, [this](int) {
+        work();
+    }, threads);
+}
+
+// Meshes as AIS_Shape does: the deflection is relative to the largest
+// extent of the solid.
+static QList<Handle(Poly_Triangulation)> meshFaces(const TopoDS_Shape& shape,
+        double deviation, double angle)
+{
+    TRACE_SPAN("refineSolid");
+    QList<Handle(Poly_Triangulation)> faces;
+    Bnd_Box box;
+    BRepBndLib::Add(shape, box);
+    if (box.IsVoid()) {
+        return faces;
+    }
+    Standard_Real x0, y0, z0, x1, y1, z1;
+    box.Get(x0, y0, z0, x1, y1, z1);
+    double extent = qMax(x1 - x0, qMax(y1 - y0, z1 - z0));
+    BRepMesh_IncrementalMesh(shape, extent * deviation * 4.0, Standard_False,
+                             angle);
+    for (TopExp_Explorer it(shape, TopAbs_FACE); it.More(); it.Next()) {
+        TopLoc_Location loc;
+        faces.append(BRep_Tool::Triangulation(TopoDS::Face(it.Current()), loc));
+    }
+    return faces;
+}
+
+void Refiner::work()
+{
+    for (;;) {
+        int solid = -1, gen = 0;
+        TopoDS_Shape shape;
+        {
+            QMutexLocker locker(&lock);
+            while (!stopping && solid < 0) {
+                if (heap.empty()) {
+                    queued.wait(&lock);
+                    continue;
+                }
+                std::pop_heap(heap.begin(), heap.end(),
+                              std::greater<HeapEntry>());
+                int next = heap.back().second;
+                heap.pop_back();
+                if (pending.contains(next)) {
+                    solid = next;
+                    shape = pending.take(next);
+                }
+            }
+            if (stopping) {
+                return;
+            }
+            gen = generation;
+        }
+
+        // Copied here, off the GUI thread; copying only reads the shape,
+        // and no other worker has this part.
+        TopoDS_Shape copy = BRepBuilderAPI_Copy(shape, Standard_False).Shape();
+        RefinedSolid* r = new RefinedSolid();
+        r->solid = solid;
+        r->faces = meshFaces(copy, deviation, angle);
+
+        bool first;
+        {
+            QMutexLocker locker(&lock);
+            if (gen != generation) {
+                delete r;
+                continue;
+            }
+            first = done.isEmpty();
+            done.append(r);
+        }
+        // Once per batch apply() takes.
+        if (first) {
+            emit refined();
+        }
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef REFINER_H
+#define REFINER_H
+
+#include "model.h"
+
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QVector>
+#include <QList>
+#include <QHash>
+
+#include <vector>
+#include <utility>
+
+#include <TopoDS_Shape.hxx>
+#include <TopTools_DataMapOfShapeInteger.hxx>
+
+class RefinedSolid;
+
+// Meshes solids at display quality on worker threads, the most urgent
+// first, while the viewer shows them coarsely. Each solid is meshed as a
+// copy made by the worker, so the shapes on display are only read from
+// another thread; the GUI thread then moves the triangulations over with
+// apply(). Instances of one part share their faces, so are meshed once.
+class Refiner : public QThread
+{
+    Q_OBJECT
+public:
+    // The relative deviation and angle to mesh with, as in Prs3d_Drawer.
+    Refiner(double deviation, double angle);
+    virtual ~Refiner();
+
+    // Queues a solid of the model.
+    void add(int solid, const TopoDS_Shape& shape);
+    // Lower comes first, one value per solid of the model; solids not
+    // covered go last.
+    void setPriorities(const QVector<double>& priorities);
+    // Forgets the solids queued or meshed, as when the model is cleared.
+    void clear();
+    bool isIdle();
+    // Gives the model's shapes the triangulations meshed so far, and
+    // returns which solids were refined.
+    QVector<int> apply(const Model& model);
+    // Waits for the workers to finish their solid and quit.
+    void stop();
+
+signals:
+    // Emitted from the workers when apply() has something to do.
+    void refined();
+
+protected:
+    virtual void run();
+
+private:
+    void work();
+
+    double deviation;
+    double angle;
+
+    QMutex lock;
+    QWaitCondition queued;
+    // The first solid queued of each part stands for all of them.
+    QHash<int, TopoDS_Shape> pending;
+    TopTools_DataMapOfShapeInteger parts;
+    QHash<int, QVector<int> > instances;
+    QVector<double> priorities;
+    // Min-heap on priority, rebuilt when the priorities change; entries
+    // for solids no longer pending are skipped.
+    std::vector<std::pair<double, int> > heap;
+    QList<RefinedSolid*> done;
+    // Bumped by clear(), so that solids meshed before are dropped.
+    int generation;
+    bool stopping;
+};
+
+#endif // REFINER_H
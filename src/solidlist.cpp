@@ -0,0 +1,45 @@
+#include "solidlist.h"
+
+SolidList::SolidList(const Model& model, QObject* parent) :
+    QAbstractListModel(parent), model(model), rows(0)
+{
+}
+
+int SolidList::rowCount(const QModelIndex& parent) const
+{
+    return parent.isValid() ? 0 : rows;
+}
+
+QVariant SolidList::data(const QModelIndex& index, int role) const
+{
+    if (!index.isValid() || index.row() >= rows || role != Qt::DisplayRole) {
+        return QVariant();
+    }
+    return model.metadata[index.row()].name;
+}
+
+void SolidList::grow()
+{
+    if (model.count() <= rows) {
+        return;
+    }
+    beginInsertRows(QModelIndex(), rows, model.count() - 1);
+    rows = model.count();
+    endInsertRows();
+}
+
+void SolidList::rename(int solid)
+{
+    if (solid >= 0) {
+        emit dataChanged(index(solid), index(solid));
+    } else if (rows > 0) {
+        emit dataChanged(index(0), index(rows - 1));
+    }
+}
+
+void SolidList::clear()
+{
+    beginResetModel();
+    rows = 0;
+    endResetModel();
+}
@@ -0,0 +1,31 @@
+#ifndef SOLIDLIST_H
+#define SOLIDLIST_H
+
+#include "model.h"
+
+#include <QAbstractListModel>
+
+// The names of the solids of a model, one row per solid in model order,
+// for views to sort and filter through a proxy. It only reads the model,
+// so it is told when solids are added, renamed or cleared.
+class SolidList : public QAbstractListModel
+{
+    Q_OBJECT
+public:
+    SolidList(const Model& model, QObject* parent);
+
+    virtual int rowCount(const QModelIndex& parent = QModelIndex()) const;
+    virtual QVariant data(const QModelIndex& index, int role) const;
+
+    // Adds rows for the solids the model gained.
+    void grow();
+    // Shows the name of a solid again, or of all for -1.
+    void rename(int solid = -1);
+    // Drops all rows; call before clearing the model.
+    void clear();
+private:
+    const Model& model;
+    int rows;
+};
+
+#endif // SOLIDLIST_H
@@ -0,0 +1,229 @@
+#include "stats.h"
+
+#include <QFile>
+#include <QMutexLocker>
+#include <QPair>
+
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+
+Stats::Stats()
+{
+}
+
+void Stats::addPhase(const char* name, qint64 wallNs, qint64 cpuNs)
+{
+    add(name, wallNs, cpuNs, false);
+}
+
+void Stats::addWork(const char* name, qint64 busyNs, qint64 cpuNs)
+{
+    add(name, busyNs, cpuNs, true);
+}
+
+void Stats::add(const char* name, qint64 wallNs, qint64 cpuNs, bool summed)
+{
+    QMutexLocker locker(&lock);
+    for (int i = 0; i < phases.size(); i++) {
+        if (phases[i].name == name && phases[i].summed == summed) {
+            phases[i].wallNs += wallNs;
+            phases[i].cpuNs += cpuNs;
+            return;
+        }
+    }
+    Phase phase;
+    phase.name = name;
+    phase.wallNs = wallNs;
+    phase.cpuNs = cpuNs;
+    phase.summed = summed;
+    phases.append(phase);
+}
+
+void Stats::setSolidCount(int count)
+{
+    Solid blank;
+    blank.kind = "tessellated";
+    blank.uses = 0;
+    blank.vertices = 0;
+    blank.triangles = 0;
+    blank.meshNs = 0;
+    blank.bytes = 0;
+    solids.fill(blank, count);
+}
+
+void Stats::setSolid(int s, const QByteArray& name, const char* kind,
+                     int uses)
+{
+    Solid& solid = solids.data()[s];
+    solid.name = name;
+    solid.kind = kind;
+    solid.uses = uses;
+}
+
+void Stats::setMesh(int s, int vertices, int triangles, qint64 meshNs)
+{
+    Solid& solid = solids.data()[s];
+    solid.vertices = vertices;
+    solid.triangles = triangles;
+    solid.meshNs = meshNs;
+}
+
+void Stats::addBytes(int s, qint64 bytes)
+{
+    solids.data()[s].bytes += bytes;
+}
+
+static QByteArray jsonString(const QByteArray& text)
+{
+    QByteArray out = "\"";
+    for (int i = 0; i < text.size(); i++) {
+        unsigned char c = text[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c < 0x20) {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+static QByteArray milliseconds(qint64 ns)
+{
+    return QByteArray::number(ns / 1e6, 'f', 3);
+}
+
+static bool slowerMesh(const QPair<qint64, int>& a, const QPair<qint64, int>& b)
+{
+    return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+
+bool Stats::writeJson(QString path, int top) const
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    QByteArray json = "{\n";
+    json += "  \"input\": " + jsonString(input.toUtf8()) + ",\n";
+    json += "  \"output\": " + jsonString(output.toUtf8()) + ",\n";
+    // Linux reports kilobytes.
+    json += "  \"peak_rss_kb\": " + QByteArray::number(qint64(usage.ru_maxrss)) +
+            ",\n";
+
+    json += "  \"phases\": [";
+    int listed = 0;
+    for (int i = 0; i < phases.size(); i++) {
+        if (phases[i].summed) {
+            continue;
+        }
+        json += listed++ ? ",\n    " : "\n    ";
+        json += "{\"name\": " + jsonString(phases[i].name) +
+                ", \"wall_ms\": " + milliseconds(phases[i].wallNs) +
+                ", \"process_cpu_ms\": " + milliseconds(phases[i].cpuNs) +
+                "}";
+    }
+    json += "\n  ],\n";
+    json += "  \"work\": [";
+    listed = 0;
+    for (int i = 0; i < phases.size(); i++) {
+        if (!phases[i].summed) {
+            continue;
+        }
+        json += listed++ ? ",\n    " : "\n    ";
+        json += "{\"name\": " + jsonString(phases[i].name) +
+                ", \"busy_ms\": " + milliseconds(phases[i].wallNs) +
+                ", \"thread_cpu_ms\": " + milliseconds(phases[i].cpuNs) + "}";
+    }
+    json += "\n  ],\n";
+
+    QVector<QByteArray> rows(solids.size());
+    QVector<QPair<qint64, int> > byCost;
+    for (int s = 0; s < solids.size(); s++) {
+        const Solid& solid = solids[s];
+        rows[s] = "{\"index\": " + QByteArray::number(s) +
+                  ", \"name\": " + jsonString(solid.name) +
+                  ", \"kind\": " + jsonString(solid.kind) +
+                  ", \"instances\": " + QByteArray::number(solid.uses) +
+                  ", \"vertices\": " + QByteArray::number(solid.vertices) +
+                  ", \"triangles\": " + QByteArray::number(solid.triangles) +
+                  ", \"mesh_ms\": " + milliseconds(solid.meshNs) +
+                  ", \"bytes\": " + QByteArray::number(solid.bytes) + "}";
+        byCost.append(QPair<qint64, int>(solid.meshNs, s));
+    }
+    json += "  \"solids\": [";
+    for (int s = 0; s < rows.size(); s++) {
+        json += s ? ",\n    " : "\n    ";
+        json += rows[s];
+    }
+    json += "\n  ],\n";
+
+    std::sort(byCost.begin(), byCost.end(), slowerMesh);
+    json += "  \"most_expensive\": [";
+    for (int k = 0; k < qMin(top, byCost.size()); k++) {
+        json += k ? ",\n    " : "\n    ";
+        json += rows[byCost[k].second];
+    }
+    json += "\n  ]\n}\n";
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+    return file.write(json) == json.size();
+}
+
+StatsPhase::StatsPhase(Stats* stats, const char* name) :
+    stats(stats), name(name), cpu(0)
+#ifdef STEPGDML_TRACE
+    , span(name)
+#endif
+{
+    if (stats) {
+        wall.start();
+        cpu = cpuTime();
+    }
+}
+
+StatsPhase::~StatsPhase()
+{
+    if (stats) {
+        stats->addPhase(name, wall.nsecsElapsed(), cpuTime() - cpu);
+    }
+}
+
+qint64 StatsPhase::cpuTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+StatsWork::StatsWork(Stats* stats, const char* name) :
+    stats(stats), name(name), cpu(0)
+{
+    if (stats) {
+        busy.start();
+        cpu = threadCpuTime();
+    }
+}
+
+StatsWork::~StatsWork()
+{
+    if (stats) {
+        stats->addWork(name, busy.nsecsElapsed(), threadCpuTime() - cpu);
+    }
+}
+
+qint64 StatsWork::threadCpuTime()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return qint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
@@ -0,0 +1,98 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "trace.h"
+
+#include <QString>
+#include <QByteArray>
+#include <QVector>
+#include <QMutex>
+#include <QElapsedTimer>
+
+// Timings and sizes of one conversion, for the --stats report: wall and
+// process CPU time per phase, busy and CPU time per kind of pipelined work
+// summed over the threads doing it, peak memory use, and a table of the
+// solids written.
+class Stats
+{
+public:
+    Stats();
+
+    QString input;
+    QString output;
+
+    // Adds to the phase of that name; phases are listed in order of first
+    // appearance. Thread safe.
+    void addPhase(const char* name, qint64 wallNs, qint64 cpuNs);
+    // The same for work done in pieces on many threads, whose times add up.
+    void addWork(const char* name, qint64 busyNs, qint64 cpuNs);
+
+    // Sizes the solid table; call before the setters below, which may then
+    // run on any thread, as long as each solid is only set by one.
+    void setSolidCount(int count);
+    void setSolid(int s, const QByteArray& name, const char* kind, int uses);
+    void setMesh(int s, int vertices, int triangles, qint64 meshNs);
+    void addBytes(int s, qint64 bytes);
+
+    // Writes the report as JSON, listing the top solids by meshing time
+    // separately. Returns false if the file could not be written.
+    bool writeJson(QString path, int top) const;
+private:
+    typedef struct {
+        QByteArray name;
+        qint64 wallNs;
+        qint64 cpuNs;
+        bool summed;
+    } Phase;
+    void add(const char* name, qint64 wallNs, qint64 cpuNs, bool summed);
+    typedef struct {
+        QByteArray name;
+        const char* kind;
+        int uses;
+        int vertices;
+        int triangles;
+        qint64 meshNs;
+        qint64 bytes;
+    } Solid;
+
+    QMutex lock;
+    QVector<Phase> phases;
+    QVector<Solid> solids;
+};
+
+// Times the enclosing scope as a phase of stats, which may be NULL. It is
+// also a trace span.
+class StatsPhase
+{
+public:
+    StatsPhase(Stats* stats, const char* name);
+    ~StatsPhase();
+    // Process CPU time so far, in ns.
+    static qint64 cpuTime();
+private:
+    Stats* stats;
+    const char* name;
+    QElapsedTimer wall;
+    qint64 cpu;
+#ifdef STEPGDML_TRACE
+    TraceSpan span;
+#endif
+};
+
+// Times the enclosing scope as a piece of the work of that name, on the
+// calling thread only; for work which overlaps other work in a pipeline.
+class StatsWork
+{
+public:
+    StatsWork(Stats* stats, const char* name);
+    ~StatsWork();
+    // CPU time of the calling thread so far, in ns.
+    static qint64 threadCpuTime();
+private:
+    Stats* stats;
+    const char* name;
+    QElapsedTimer busy;
+    qint64 cpu;
+};
+
+#endif // STATS_H
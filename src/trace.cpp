@@ -0,0 +1,185 @@
+#include "trace.h"
+
+#ifdef STEPGDML_TRACE
+
+#include <QFile>
+#include <QByteArray>
+#include <QVector>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QAtomicInt>
+
+#include <stdlib.h>
+#include <time.h>
+
+#include <new>
+
+// Events each thread keeps; older ones are overwritten.
+static const int ringSize = 8192;
+
+typedef struct {
+    const char* name;
+    quint64 begin;
+    quint64 end;
+    quint64 allocations;
+} TraceEvent;
+
+// Only its own thread writes to a buffer; they are read once recording has
+// ended. Buffers outlive their threads, as pools come and go.
+typedef struct {
+    int tid;
+    quint64 count;
+    TraceEvent events[ringSize];
+} TraceBuffer;
+
+static QAtomicInt recording(0);
+static QMutex buffersLock;
+static QVector<TraceBuffer*> buffers;
+static thread_local TraceBuffer* threadBuffer = NULL;
+static thread_local quint64 threadAllocations = 0;
+
+// Counts C++ allocations per thread. OpenCASCADE's own allocator is not
+// seen, so these are mostly Qt and standard library containers.
+void* operator new(size_t size)
+{
+    threadAllocations++;
+    void* p = malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept
+{
+    free(p);
+}
+
+static quint64 now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return quint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static TraceBuffer* bufferOfThread()
+{
+    if (!threadBuffer) {
+        TraceBuffer* buffer = (TraceBuffer*)calloc(1, sizeof(TraceBuffer));
+        QMutexLocker locker(&buffersLock);
+        buffer->tid = buffers.size() + 1;
+        buffers.append(buffer);
+        threadBuffer = buffer;
+    }
+    return threadBuffer;
+}
+
+TraceSpan::TraceSpan(const char* name) :
+    name(name), begin(0), allocations(threadAllocations)
+{
+    if (recording.loadAcquire()) {
+        begin = now();
+    }
+}
+
+TraceSpan::~TraceSpan()
+{
+    if (!begin || !recording.loadAcquire()) {
+        return;
+    }
+    TraceBuffer* buffer = bufferOfThread();
+    TraceEvent& event = buffer->events[buffer->count % ringSize];
+    event.name = name;
+    event.begin = begin;
+    event.end = now();
+    event.allocations = threadAllocations - allocations;
+    buffer->count++;
+}
+
+bool Trace::available()
+{
+    return true;
+}
+
+void Trace::start()
+{
+    recording.storeRelease(1);
+}
+
+static QByteArray jsonString(const char* text)
+{
+    QByteArray out = "\"";
+    for (const char* c = text; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            out += '\\';
+        }
+        out += *c;
+    }
+    return out + "\"";
+}
+
+bool Trace::write(QString path)
+{
+    recording.storeRelease(0);
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+
+    QMutexLocker locker(&buffersLock);
+    quint64 origin = ~quint64(0);
+    for (int b = 0; b < buffers.size(); b++) {
+        const TraceBuffer* buffer = buffers[b];
+        quint64 first = buffer->count > quint64(ringSize) ?
+                        buffer->count - ringSize : 0;
+        for (quint64 k = first; k < buffer->count; k++) {
+            origin = qMin(origin, buffer->events[k % ringSize].begin);
+        }
+    }
+
+    QByteArray json = "{\"traceEvents\": [\n";
+    bool first = true;
+    for (int b = 0; b < buffers.size(); b++) {
+        const TraceBuffer* buffer = buffers[b];
+        quint64 start = buffer->count > quint64(ringSize) ?
+                        buffer->count - ringSize : 0;
+        for (quint64 k = start; k < buffer->count; k++) {
+            const TraceEvent& event = buffer->events[k % ringSize];
+            json += first ? "" : ",\n";
+            first = false;
+            // Microseconds, as the format wants.
+            json += "{\"name\": " + jsonString(event.name) +
+                    ", \"ph\": \"X\", \"pid\": 1, \"tid\": " +
+                    QByteArray::number(buffer->tid) + ", \"ts\": " +
+                    QByteArray::number((event.begin - origin) / 1e3, 'f', 3) +
+                    ", \"dur\": " +
+                    QByteArray::number((event.end - event.begin) / 1e3, 'f', 3) +
+                    ", \"args\": {\"allocations\": " +
+                    QByteArray::number(event.allocations) + "}}";
+        }
+        if (buffer->count > quint64(ringSize)) {
+            qWarning("Trace: thread %d dropped its %llu oldest spans.",
+                     buffer->tid, buffer->count - ringSize);
+        }
+    }
+    json += "\n]}\n";
+    return file.write(json) == json.size();
+}
+
+#else
+
+bool Trace::available()
+{
+    return false;
+}
+
+void Trace::start()
+{
+}
+
+bool Trace::write(QString)
+{
+    return false;
+}
+
+#endif
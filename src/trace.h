@@ -0,0 +1,49 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <QString>
+
+// Scoped spans in the Chrome trace-event format, for chrome://tracing or
+// Perfetto. Each thread records into a ring buffer of its own, so a span
+// costs two clock reads and a store. Only built with STEPGDML_TRACE
+// (qmake CONFIG+=trace); otherwise TRACE_SPAN compiles to nothing.
+namespace Trace
+{
+// Whether this build can trace at all.
+bool available();
+// Starts recording; spans before this are not kept.
+void start();
+// Writes what the ring buffers hold; false on failure.
+bool write(QString path);
+}
+
+#ifdef STEPGDML_TRACE
+
+#include <QtGlobal>
+
+class TraceSpan
+{
+public:
+    // name must outlive the trace; string literals do.
+    explicit TraceSpan(const char* name);
+    ~TraceSpan();
+private:
+    TraceSpan(const TraceSpan&);
+    void operator=(const TraceSpan&);
+
+    const char* name;
+    quint64 begin;
+    quint64 allocations;
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SPAN(name) TraceSpan TRACE_CONCAT(traceSpan, __LINE__)(name)
+
+#else
+
+#define TRACE_SPAN(name) do {} while (0)
+
+#endif
+
+#endif // TRACE_H
@@ -1,19 +1,39 @@
 #include "translate.h"
 #include "gdmlwriter.h"
+#include "triangulate.h"
+#include "importcache.h"
+#include "stats.h"
+#include "trace.h"
 
 #include <QSet>
 #include <QColor>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QMutex>
+#include <QMutexLocker>
 
 #include <AIS_Shape.hxx>
 #include <AIS_InteractiveObject.hxx>
 #include <AIS_DisplayMode.hxx>
-#include <AIS_ListOfInteractive.hxx>
+#include <Graphic3d_MaterialAspect.hxx>
+#include <Prs3d_Drawer.hxx>
 
 #include <TopoDS_Shape.hxx>
 #include <TopExp_Explorer.hxx>
 #include <TopTools_HSequenceOfShape.hxx>
+#include <TopTools_DataMapOfShapeShape.hxx>
+#include <BRepBuilderAPI_Copy.hxx>
 
 #include <STEPCAFControl_Reader.hxx>
+#include <STEPControl_Reader.hxx>
+#include <XSControl_WorkSession.hxx>
+#include <Transfer_TransientProcess.hxx>
+#include <Message_ProgressIndicator.hxx>
+#include <Standard_Version.hxx>
+#if OCC_VERSION_HEX >= 0x070000
+#include <StdPrs_ToolTriangulatedShape.hxx>
+#endif
 
 #include <TDocStd_Document.hxx>
 
@@ -23,133 +43,122 @@
 #include <XCAFDoc_MaterialTool.hxx>
 
 #include <TDF_LabelSequence.hxx>
+#include <TopLoc_Location.hxx>
 #include <TDataStd_Name.hxx>
 
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+
 //
 //
 //                      TRANSLATOR
 //
 //
 
-Translator::Translator(const Handle(AIS_InteractiveContext) theContext) :
-    context(theContext)
+ExportOptions::ExportOptions() :
+    preallocate(false), threads(0), reuse(NULL), keep(NULL), chunks(NULL),
+    stats(NULL), progress(NULL)
 {
 }
 
-QList<AIS_InteractiveObject*> Translator::displayShapes(const Handle(
-            AIS_InteractiveContext)& theContext,
-        const Handle(TopTools_HSequenceOfShape) & shapes)
-{
-    QList<AIS_InteractiveObject*> objs;
-    if (shapes.IsNull() || shapes->IsEmpty()) {
-        qWarning("Incoming list of shapes is empty");
-        return objs;
-    }
-
-    for (int i = 1; i <= shapes->Length(); i++) {
-        AIS_Shape* e = new AIS_Shape(shapes->Value(i));
-        e->SetDisplayMode(AIS_Shaded);
+// Everything which changes what importSTEP reads goes into its key.
+static const char* readerModes = "color name mat";
 
-        Graphic3d_MaterialAspect mat;
-        mat.SetTransparency(0.0);
-        mat.SetShininess(0.003);
+QString Translator::importCacheDirectory;
+bool Translator::importCacheChosen = false;
 
-        mat.SetAmbient(0.5);
-        mat.SetAmbientColor(Quantity_NOC_WHITE);
-        mat.SetReflectionModeOn(Graphic3d_TOR_AMBIENT);
+QByteArray Translator::importKey(QString file)
+{
+    return ImportCache::key(file, readerModes);
+}
 
-        mat.SetDiffuse(0.65);
-        mat.SetDiffuseColor(Quantity_NOC_WHITE);
-        mat.SetReflectionModeOn(Graphic3d_TOR_DIFFUSE);
+void Translator::setImportCache(QString directory)
+{
+    importCacheDirectory = directory;
+    importCacheChosen = true;
+}
 
-        mat.SetSpecular(0.01);
-        mat.SetSpecularColor(Quantity_NOC_WHITE);
-        mat.SetReflectionModeOn(Graphic3d_TOR_SPECULAR);
+Graphic3d_MaterialAspect Translator::displayMaterial()
+{
+    Graphic3d_MaterialAspect mat;
+    mat.SetTransparency(0.0);
+    mat.SetShininess(0.003);
 
-        mat.SetEmissive(0.0);
-        mat.SetEmissiveColor(Quantity_NOC_WHITE);
-        mat.SetReflectionModeOn(Graphic3d_TOR_EMISSION);
+    mat.SetAmbient(0.5);
+    mat.SetAmbientColor(Quantity_NOC_WHITE);
+    mat.SetReflectionModeOn(Graphic3d_TOR_AMBIENT);
 
-        mat.SetMaterialName("Magic Material");
-        mat.SetMaterialType(Graphic3d_MATERIAL_ASPECT);
+    mat.SetDiffuse(0.65);
+    mat.SetDiffuseColor(Quantity_NOC_WHITE);
+    mat.SetReflectionModeOn(Graphic3d_TOR_DIFFUSE);
 
-        e->SetMaterial(mat);
+    mat.SetSpecular(0.01);
+    mat.SetSpecularColor(Quantity_NOC_WHITE);
+    mat.SetReflectionModeOn(Graphic3d_TOR_SPECULAR);
 
-        theContext->Display(e, false);
-        objs.append(e);
-    }
+    mat.SetEmissive(0.0);
+    mat.SetEmissiveColor(Quantity_NOC_WHITE);
+    mat.SetReflectionModeOn(Graphic3d_TOR_EMISSION);
 
-    // update all viewers
-    theContext->UpdateCurrentViewer();
-    return objs;
+    mat.SetMaterialName("Magic Material");
+    mat.SetMaterialType(Graphic3d_MATERIAL_ASPECT);
+    return mat;
 }
 
-bool Translator::findAllShapes(const Handle(AIS_InteractiveContext)& ctxt,
-                               const Handle(TopTools_HSequenceOfShape) & shapes)
-{
-    if (shapes.IsNull()) {
-        qWarning("Incoming shape list was null.");
-        return false;
-    }
-
-    AIS_ListOfInteractive objs;
-    ctxt->EraseAll(false);
-    ctxt->ErasedObjects(objs);
-    ctxt->DisplayAll(false);
-    while (!objs.IsEmpty()) {
-        Handle(AIS_InteractiveObject) obj = objs.First();
-        if (obj->IsKind(STANDARD_TYPE(AIS_Shape))) {
-            TopoDS_Shape shape = Handle(AIS_Shape)::DownCast(obj)->Shape();
-            shapes->Append(shape);
-        }
-        objs.RemoveFirst();
-    }
-
-    return !shapes->IsEmpty();
-}
+// Relative deviation and angle of coarse meshes; the viewer's defaults are
+// 0.001 and 12 degrees.
+static const double coarseDeviation = 0.02;
+static const double coarseAngle = 40.0 * M_PI / 180.0;
 
-QList<AIS_InteractiveObject*> Translator::getInteractiveObjects(const Handle(
-            AIS_InteractiveContext)& ctxt)
+void Translator::meshCoarsely(const TopoDS_Shape& shape)
 {
-    QList<AIS_InteractiveObject*> qll;
-    AIS_ListOfInteractive objs;
-    ctxt->EraseAll(false);
-    ctxt->ErasedObjects(objs);
-    ctxt->DisplayAll(false);
-    while (!objs.IsEmpty()) {
-        Handle(AIS_InteractiveObject) obj = objs.First();
-        if (obj->IsKind(STANDARD_TYPE(AIS_Shape))) {
-            qll.append(&(*obj));
-        } else {
-            qDebug("ERROR\n");
-        }
-        objs.RemoveFirst();
+#if OCC_VERSION_HEX >= 0x070000
+    static Handle(Prs3d_Drawer) coarse;
+    if (coarse.IsNull()) {
+        coarse = new Prs3d_Drawer();
+        coarse->SetDeviationCoefficient(coarseDeviation);
+        coarse->SetDeviationAngle(coarseAngle);
     }
-    return qll;
+    StdPrs_ToolTriangulatedShape::Tessellate(shape, coarse);
+#else
+    Q_UNUSED(shape);
+#endif
 }
 
-QList<AIS_InteractiveObject*> Translator::importSTEP(QString path,
-        QList<QPair<QString, QColor> >& objNames)
+QList<AIS_InteractiveObject*> Translator::displayShapes(const Handle(
+            AIS_InteractiveContext)& theContext, const Model& model, int first,
+        bool coarse)
 {
-    Handle(TopTools_HSequenceOfShape) shapes = new TopTools_HSequenceOfShape();
-    if (!importSTEP(path, shapes, objNames)) {
-        qWarning("STEP Import failed\n");
-        return QList<AIS_InteractiveObject*>();
+    QList<AIS_InteractiveObject*> objs;
+    if (first >= model.count()) {
+        qWarning("Incoming list of shapes is empty");
+        return objs;
     }
-    return displayShapes(context, shapes);
-}
 
-bool Translator::exportGDML(QString path,
-                            const QVector<SolidMetadata>& metadata)
-{
-    Handle(TopTools_HSequenceOfShape) shapes = new TopTools_HSequenceOfShape();
-    // add all dem shapes
+    Graphic3d_MaterialAspect mat = displayMaterial();
+#if OCC_VERSION_HEX < 0x070000
+    Q_UNUSED(coarse);
+#endif
+    for (int i = first; i < model.count(); i++) {
+        AIS_Shape* e = new AIS_Shape(model.shape(i));
+        e->SetDisplayMode(AIS_Shaded);
+        e->SetMaterial(mat);
+#if OCC_VERSION_HEX >= 0x070000
+        if (coarse) {
+            meshCoarsely(model.shape(i));
+            // Left as it is, not meshed again at display quality.
+            e->Attributes()->SetAutoTriangulation(Standard_False);
+        }
+#endif
 
-    if (!findAllShapes(context, shapes)) {
-        return false;
+        theContext->Display(e, false);
+        objs.append(e);
     }
 
-    return exportGDML(path, shapes, metadata);
+    // update all viewers
+    theContext->UpdateCurrentViewer();
+    return objs;
 }
 
 
@@ -214,6 +223,7 @@ QPair<QString, QColor> handleShapeMetadata(const TopoDS_Shape& shape,
         const Handle(XCAFDoc_ShapeTool)& shapeTool,
         const Handle(XCAFDoc_MaterialTool)& materialTool)
 {
+    TRACE_SPAN("handleShapeMetadata");
     Q_UNUSED(materialTool);
 
     QColor result = getColor(shape, colorTool);
@@ -256,14 +266,203 @@ QPair<QString, QColor> handleShapeMetadata(const TopoDS_Shape& shape,
     }
 }
 
+// Walks the product structure, appending the solids of every part with its
+// placement applied, and recording the assemblies they sit in. Solids are
+// reported in batches as found. With copies, each solid also gets a copy
+// there, made before the solid is reported and so before anything meshes
+// it; parts are copied once, so their instances still share.
+class AssemblyWalker
+{
+public:
+    AssemblyWalker(const Handle(XCAFDoc_ShapeTool)& shapeTool,
+                   const Handle(XCAFDoc_ColorTool)& colorTool,
+                   const Handle(XCAFDoc_MaterialTool)& materialTool,
+                   const Handle(TopTools_HSequenceOfShape)& shapes,
+                   QList<QPair<QString, QColor> >& objData,
+                   QVector<AssemblyMetadata>& assemblies,
+                   QList<int>& assemblyOf, ImportProgress* progress,
+                   const Handle(TopTools_HSequenceOfShape)& copies) :
+        shapeTool(shapeTool), colorTool(colorTool), materialTool(materialTool),
+        shapes(shapes), objData(objData), assemblies(assemblies),
+        assemblyOf(assemblyOf), progress(progress), copies(copies),
+        reported(shapes->Length())
+    {
+    }
+
+    void walk(const TDF_Label& label, const TopLoc_Location& location,
+              int parent)
+    {
+        if (progress && progress->isCancelled()) {
+            return;
+        }
+        if (!XCAFDoc_ShapeTool::IsAssembly(label)) {
+            addPart(XCAFDoc_ShapeTool::GetShape(label), location, parent);
+            return;
+        }
+
+        AssemblyMetadata assembly;
+        assembly.name = getName(label);
+        assembly.parent = parent;
+        assembly.location = location.Transformation();
+        int index = assemblies.size();
+        assemblies.append(assembly);
+
+        TDF_LabelSequence components;
+        XCAFDoc_ShapeTool::GetComponents(label, components);
+        for (int i = 1; i <= components.Length(); i++) {
+            const TDF_Label& component = components.Value(i);
+            TDF_Label referred;
+            if (!XCAFDoc_ShapeTool::GetReferredShape(component, referred)) {
+                continue;
+            }
+            walk(referred, location * XCAFDoc_ShapeTool::GetLocation(component),
+                 index);
+        }
+    }
+
+    // Passes on the solids not yet reported.
+    void report()
+    {
+        if (progress && reported < shapes->Length()) {
+            progress->solidsAdded(shapes, objData, assemblyOf, reported);
+            reported = shapes->Length();
+        }
+    }
+private:
+    void append(const TopoDS_Shape& shape, int parent)
+    {
+        shapes->Append(shape);
+        objData.append(handleShapeMetadata(shape, colorTool, shapeTool,
+                                           materialTool));
+        assemblyOf.append(parent);
+        if (shapes->Length() - reported >= reportBatch) {
+            report();
+        }
+    }
+
+    // Appends the solids of shape, or else its shells, along with those of
+    // copy, which has the same structure.
+    bool addAll(const TopoDS_Shape& shape, const TopoDS_Shape& copy,
+                TopAbs_ShapeEnum type, int parent)
+    {
+        bool found = false;
+        TopExp_Explorer other;
+        if (!copies.IsNull()) {
+            other.Init(copy, type);
+        }
+        for (TopExp_Explorer exp(shape, type); exp.More(); exp.Next()) {
+            if (!copies.IsNull()) {
+                copies->Append(other.Current());
+                other.Next();
+            }
+            append(exp.Current(), parent);
+            found = true;
+        }
+        return found;
+    }
+
+    void addPart(const TopoDS_Shape& part, const TopLoc_Location& location,
+                 int parent)
+    {
+        TopoDS_Shape copy;
+        if (!copies.IsNull()) {
+            if (!copied.IsBound(part)) {
+                BRepBuilderAPI_Copy copier(part, Standard_False);
+                copied.Bind(part, copier.Shape());
+            }
+            copy = copied.Find(part).Moved(location);
+        }
+        TopoDS_Shape tds = part.Moved(location);
+        bool found = addAll(tds, copy, TopAbs_SOLID, parent);
+        if (!found) {
+            found = addAll(tds, copy, TopAbs_SHELL, parent);
+            if (found) {
+                // TODO: create a "WARNING" field/list, that can be checked postop,
+                // and raised by the window.
+                // Should we even allow standalone shells?
+                qCritical("Could not find any dependent solids. Instead, added shells. Output geometry may not be closed.");
+            } else {
+                qWarning("No dependent solids or shells found for shape.");
+            }
+        }
+    }
+
+    Handle(XCAFDoc_ShapeTool) shapeTool;
+    Handle(XCAFDoc_ColorTool) colorTool;
+    Handle(XCAFDoc_MaterialTool) materialTool;
+    Handle(TopTools_HSequenceOfShape) shapes;
+    QList<QPair<QString, QColor> >& objData;
+    QVector<AssemblyMetadata>& assemblies;
+    QList<int>& assemblyOf;
+    ImportProgress* progress;
+    Handle(TopTools_HSequenceOfShape) copies;
+    TopTools_DataMapOfShapeShape copied;
+    int reported;
+    // Solids handed on at once; fewer would make the display update often.
+    static const int reportBatch = 64;
+};
+
+// Passes OpenCASCADE's progress reports on, and cancellation back.
+class TransferIndicator : public Message_ProgressIndicator
+{
+public:
+    explicit TransferIndicator(ImportProgress* progress) : progress(progress)
+    {
+    }
+#if OCC_VERSION_HEX >= 0x070500
+    virtual void Show(const Message_ProgressScope&, const Standard_Boolean)
+    {
+        progress->progress("Transferring", GetPosition());
+    }
+#else
+    virtual Standard_Boolean Show(const Standard_Boolean)
+    {
+        progress->progress("Transferring", GetPosition());
+        return Standard_True;
+    }
+#endif
+    virtual Standard_Boolean UserBreak()
+    {
+        return progress->isCancelled();
+    }
+private:
+    ImportProgress* progress;
+};
+
 bool Translator::importSTEP(QString file,
                             const Handle(TopTools_HSequenceOfShape)& shapes,
-                            QList<QPair<QString, QColor> >& objData)
+                            QList<QPair<QString, QColor> >& objData,
+                            QVector<AssemblyMetadata>& assemblies,
+                            QList<int>& assemblyOf, Stats* stats,
+                            ImportProgress* progress)
 {
+    TRACE_SPAN("importSTEP");
     if (shapes.IsNull()) {
         qWarning("Shape list was null. Aborting export.");
         return false;
     }
+    int firstSolid = shapes->Length();
+    int firstAssembly = assemblies.size();
+
+    // The default depends on the application name, so is looked up late.
+    ImportCache cache(importCacheChosen ? importCacheDirectory :
+                      ImportCache::defaultDirectory());
+    QByteArray key;
+    if (cache.isEnabled() || sourceKey) {
+        StatsPhase phase(stats, "cache");
+        key = importKey(file);
+        if (sourceKey) {
+            *sourceKey = key;
+        }
+        if (cache.isEnabled() &&
+                cache.load(key, shapes, objData, assemblies, assemblyOf)) {
+            qDebug("Loaded from the import cache.");
+            if (progress) {
+                progress->solidsAdded(shapes, objData, assemblyOf, firstSolid);
+            }
+            return true;
+        }
+    }
 
     STEPCAFControl_Reader reader;
     reader.SetColorMode(true);
@@ -271,8 +470,20 @@ bool Translator::importSTEP(QString file,
     reader.SetMatMode(true);
 
     qDebug("Reading begun.");
-    IFSelect_ReturnStatus status = reader.ReadFile((Standard_CString)
-                                   file.toUtf8().constData());
+    if (progress) {
+        progress->progress("Reading", 0.0);
+    }
+    IFSelect_ReturnStatus status;
+    {
+        StatsPhase phase(stats, "read");
+#if OCC_VERSION_HEX < 0x070600
+        // Older STEP parsers keep their state in globals, so batch jobs
+        // may only read one file at a time.
+        static QMutex readLock;
+        QMutexLocker locker(&readLock);
+#endif
+        status = reader.ReadFile((Standard_CString)file.toUtf8().constData());
+    }
     qDebug("Reading complete.");
     switch (status) {
     case IFSelect_RetVoid:
@@ -290,11 +501,33 @@ bool Translator::importSTEP(QString file,
     case IFSelect_RetDone:
         break;
     }
+    if (progress && progress->isCancelled()) {
+        return false;
+    }
 
     Handle(TDocStd_Document) doc = new TDocStd_Document("XmlXCAF");
     qDebug("Transfer begun.");
-    bool ok = reader.Transfer(doc);
+    bool ok;
+    {
+        StatsPhase phase(stats, "transfer");
+        if (progress) {
+            Handle(Message_ProgressIndicator) indicator =
+                new TransferIndicator(progress);
+#if OCC_VERSION_HEX >= 0x070500
+            ok = reader.Transfer(doc, indicator->Start());
+#else
+            reader.Reader().WS()->MapReader()->SetProgress(indicator);
+            ok = reader.Transfer(doc);
+            reader.Reader().WS()->MapReader()->SetProgress(Handle(Message_ProgressIndicator)());
+#endif
+        } else {
+            ok = reader.Transfer(doc);
+        }
+    }
     qDebug("Transfer complete.");
+    if (progress && progress->isCancelled()) {
+        return false;
+    }
     if (!ok) {
         qWarning("Transfer wasn't ok. Aborting.");
         return false;
@@ -315,41 +548,65 @@ bool Translator::importSTEP(QString file,
         return false;
     }
 
-    for (int i = 1; i <= labels.Length(); i++) {
-        TopoDS_Shape tds = shapeTool->GetShape(labels.Value(i));
-        bool found = false;
-        for (TopExp_Explorer exp(tds, TopAbs_SOLID); exp.More(); exp.Next()) {
-            TopoDS_Shape solid = exp.Current();
-            shapes->Append(solid);
-            objData.append(handleShapeMetadata(solid, colorTool, shapeTool, materialTool));
-            found = true;
-        }
-        if (!found) {
-            for (TopExp_Explorer exp(tds, TopAbs_SHELL); exp.More(); exp.Next()) {
-                TopoDS_Shape solid = exp.Current();
-                objData.append(handleShapeMetadata(solid, colorTool, shapeTool, materialTool));
-                shapes->Append(solid);
-                found = true;
-            }
-            if (found) {
-                // TODO: create a "WARNING" field/list, that can be checked postop,
-                // and raised by the window.
-                // Should we even allow standalone shells?
-                qCritical("Could not find any dependent solids. Instead, added shells. Output geometry may not be closed.");
-            } else {
-                qWarning("No dependent solids or shells found for shape.");
+    // Solids handed on get meshed for display while the cache is written,
+    // so it gets copies of its own.
+    Handle(TopTools_HSequenceOfShape) copies;
+    if (cache.isEnabled()) {
+        copies = new TopTools_HSequenceOfShape();
+    }
+    AssemblyWalker walker(shapeTool, colorTool, materialTool, shapes,
+                          objData, assemblies, assemblyOf, progress, copies);
+    {
+        StatsPhase phase(stats, "metadata");
+        for (int i = 1; i <= labels.Length(); i++) {
+            if (progress) {
+                progress->progress("Naming solids",
+                                   double(i - 1) / labels.Length());
             }
+            walker.walk(labels.Value(i), TopLoc_Location(), -1);
         }
     }
+    if (progress && progress->isCancelled()) {
+        return false;
+    }
 
+    walker.report();
+    if (cache.isEnabled()) {
+        StatsPhase phase(stats, "cache");
+        if (progress) {
+            progress->progress("Caching", 0.0);
+        }
+        if (!cache.store(key, copies, objData, assemblies, assemblyOf,
+                         firstSolid, firstAssembly)) {
+            qWarning("Could not write to the import cache.");
+        }
+    }
     return true;
 }
 
 
-bool Translator::exportGDML(QString path,
-                            const Handle(TopTools_HSequenceOfShape)& shapes,
-                            const QVector<SolidMetadata>& metadata)
+bool Translator::importSTEP(QString file, Model& model, Stats* stats)
 {
+    Handle(TopTools_HSequenceOfShape) shapes = new TopTools_HSequenceOfShape();
+    QList<QPair<QString, QColor> > objData;
+    QList<int> assemblyOf;
+    QByteArray key;
+    if (!importSTEP(file, shapes, objData, model.assemblies, assemblyOf,
+                    stats, NULL, &key)) {
+        return false;
+    }
+    model.source = file;
+    model.sourceKey = key;
+    model.append(shapes, objData, assemblyOf);
+    return true;
+}
+
+bool Translator::exportGDML(QString path, const Model& model,
+                            const ExportOptions& options)
+{
+    const Handle(TopTools_HSequenceOfShape)& shapes = model.shapes;
+    const QVector<SolidMetadata>& metadata = model.metadata;
+    const QVector<AssemblyMetadata>& assemblies = model.assemblies;
     if (shapes.IsNull() || shapes->IsEmpty()) {
         qWarning("Shape list was null or empty. Aborting export.");
         return false;
@@ -363,26 +620,98 @@ bool Translator::exportGDML(QString path,
         }
     }
 
-#if HEAP_ALLOC_ALL_THE_THINGS
-    // Why is this heap-allocated? Ask Cthulhu. Stuff gets corrupted otherwise. ;-(
-    gdmlWriter = new GdmlWriter(path);
-    gdmlWriter->writeIntro();
-    for (int i = 1; i <= shapes->Length(); i++) {
-        SolidMetadata& meta = metadata[i - 1];
-        gdmlWriter->addSolid(shapes->Value(i), meta.name, meta.material);
+    QList<QString> names, materials;
+    QVector<int> assemblyOf;
+    for (int i = 0; i < shapes->Length(); i++) {
+        names.append(metadata[i].name);
+        materials.append(metadata[i].material);
+        assemblyOf.append(metadata[i].assembly);
+    }
+    Mesher mesher(shapes, options.mesh);
+    for (int i = 0; i < shapes->Length(); i++) {
+        mesher.setTolerances(i, metadata[i].deflection, metadata[i].angle);
+    }
+    if (mesher.useSource(options.reuse)) {
+        qDebug("Reusing the meshes of an earlier export.");
+    }
+    // Spliced chunks need no meshes, so the set kept would have gaps then.
+    if (options.keep && !(options.chunks &&
+                          options.chunks->fitting(mesher).contains(true))) {
+        mesher.record(options.keep);
     }
-    gdmlWriter->writeExtro();
-    delete gdmlWriter;
+
+    // In the same directory, so the rename cannot cross filesystems, and
+    // ending like the name, so compressed alike.
+    QFileInfo info(path);
+    QString part = info.dir().filePath(".part-" +
+                                       QString::number(qint64(getpid())) +
+                                       "-" + info.fileName());
+    bool ok;
+    try {
+#if HEAP_ALLOC_ALL_THE_THINGS
+        // Why is this heap-allocated? Ask Cthulhu. Stuff gets corrupted otherwise. ;-(
+        gdmlWriter = new GdmlWriter(part, options.preallocate);
+        gdmlWriter->setStats(options.stats);
+        gdmlWriter->setProgress(options.progress);
+        gdmlWriter->setAssemblies(assemblies, assemblyOf);
+        gdmlWriter->writeIntro();
+        gdmlWriter->writeSolids(mesher, names, materials, options.threads,
+                                options.chunks);
+        gdmlWriter->writeExtro();
+        ok = gdmlWriter->close();
+        delete gdmlWriter;
 #else
-    {
-        GdmlWriter writer(path);
+        GdmlWriter writer(part, options.preallocate);
+        writer.setStats(options.stats);
+        writer.setProgress(options.progress);
+        writer.setAssemblies(assemblies, assemblyOf);
         writer.writeIntro();
-        for (int i = 1; i <= shapes->Length(); i++) {
-            const SolidMetadata& meta = metadata[i - 1];
-            writer.addSolid(shapes->Value(i), meta.name, meta.material);
-        }
+        writer.writeSolids(mesher, names, materials, options.threads,
+                           options.chunks);
         writer.writeExtro();
-    }
+        ok = writer.close();
 #endif
+    } catch (const char*) {
+        qWarning("Could not open %s.", part.toUtf8().constData());
+        return false;
+    }
+    if (options.progress) {
+        options.progress->shapesDone();
+    }
+    if (options.progress && options.progress->isCancelled()) {
+        qDebug("Export cancelled.");
+        ok = false;
+    }
+    // rename() replaces the old file in one step, where QFile's will not
+    // replace it at all.
+    if (!ok || rename(QFile::encodeName(part).constData(),
+                      QFile::encodeName(path).constData()) != 0) {
+        QFile::remove(part);
+        return false;
+    }
+    return true;
+}
+
+bool Translator::convert(QString input, QString output,
+                         const ExportOptions& options, int* solidCount)
+{
+    Model model;
+    if (!importSTEP(input, model, options.stats)) {
+        printf("Import failed. :-(\n");
+        return false;
+    }
+    // Solids are named by number here, as the STEP names need not be
+    // unique.
+    for (int i = 0; i < model.count(); i++) {
+        model.metadata[i].name = QString::number(i);
+    }
+    if (solidCount) {
+        *solidCount = model.count();
+    }
+
+    if (!exportGDML(output, model, options)) {
+        printf("Export failed. :-(\n");
+        return false;
+    }
     return true;
 }
@@ -2,6 +2,8 @@
 #define TRANSLATE_H
 
 #include "metadata.h"
+#include "triangulate.h"
+#include "model.h"
 
 #include <QString>
 #include <QVector>
@@ -13,29 +15,93 @@
 #include <TopTools_HSequenceOfShape.hxx>
 
 class GdmlWriter;
+class Stats;
+class SolidChunks;
+class ExportProgress;
 class Graphic3d_MaterialAspect;
 
-class Translator
+class ExportOptions
+{
+public:
+    ExportOptions();
+
+    MeshOptions mesh;
+    // Reserve disk space for the output ahead of writing it.
+    bool preallocate;
+    // Worker threads for meshing and formatting; 0 uses all cores.
+    int threads;
+    // Meshes from an earlier export to use if they still fit, and a set to
+    // keep this export's meshes in; either may be NULL.
+    const MeshSource* reuse;
+    MeshSet* keep;
+    // Formatted solids of an earlier export, spliced in while they fit and
+    // refilled otherwise; may be NULL.
+    SolidChunks* chunks;
+    // Collects timings and sizes for a report; may be NULL.
+    Stats* stats;
+    // Hears how far the export has got, and may cancel it; may be NULL.
+    ExportProgress* progress;
+};
+
+// Follows an import from the thread running it, and may stop it.
+class ImportProgress
 {
 public:
-    Translator(const Handle(AIS_InteractiveContext) context);
-    QList<AIS_InteractiveObject*> importSTEP(QString,
-            QList<QPair<QString, QColor> >&);
-    bool exportGDML(QString, const QVector<SolidMetadata>&);
+    virtual ~ImportProgress() {}
+    // How far the named stage has got, from 0 to 1.
+    virtual void progress(const char* stage, double fraction) = 0;
+    // Solids from first on have been appended, along with their data.
+    virtual void solidsAdded(const Handle(TopTools_HSequenceOfShape)& shapes,
+                             const QList<QPair<QString, QColor> >& objData,
+                             const QList<int>& assemblyOf, int first) = 0;
+    virtual bool isCancelled() = 0;
+};
 
+class Translator
+{
+public:
+    // Appends every solid with its name and color, and the assembly holding
+    // it (an index into assemblies, or -1). Phases are timed into stats;
+    // progress hears of solids in batches, and a cancelled import fails.
+    // The file's importKey() goes into sourceKey if asked.
     static bool importSTEP(QString, const Handle(TopTools_HSequenceOfShape)&,
-                           QList<QPair<QString, QColor> >&);
-    static bool exportGDML(QString, const Handle(TopTools_HSequenceOfShape)&,
-                           const QVector<SolidMetadata>&);
+                           QList<QPair<QString, QColor> >&,
+                           QVector<AssemblyMetadata>& assemblies,
+                           QList<int>& assemblyOf, Stats* stats = NULL,
+                           ImportProgress* progress = NULL,
+                           QByteArray* sourceKey = NULL);
+    // Imports into an empty model, with default settings for each solid.
+    static bool importSTEP(QString, Model&, Stats* stats = NULL);
+    // Writes beside the file and renames over it once complete, so that it
+    // is never left half written, not even when cancelled.
+    static bool exportGDML(QString, const Model&,
+                           const ExportOptions& = ExportOptions());
+    // Identifies the content of a STEP file as importSTEP reads it.
+    static QByteArray importKey(QString file);
+    // Where importSTEP caches what it read, instead of the per-user
+    // default; empty disables the cache.
+    static void setImportCache(QString directory);
+    // Imports a STEP file and exports all of it, with default names and
+    // materials. Reports the number of solids if asked.
+    static bool convert(QString input, QString output,
+                        const ExportOptions& = ExportOptions(),
+                        int* solidCount = NULL);
+    // Shows the solids of the model from first on, returning an object for
+    // each. Coarse solids are shown as meshCoarsely() leaves them, until
+    // their finer triangulation is redisplayed; see Refiner.
     static QList<AIS_InteractiveObject*> displayShapes(const Handle(
-                AIS_InteractiveContext)&, const Handle(TopTools_HSequenceOfShape)&);
-    static bool findAllShapes(const Handle(AIS_InteractiveContext)&,
-                              const Handle(TopTools_HSequenceOfShape)&);
-    static QList<AIS_InteractiveObject*> getInteractiveObjects(const Handle(
-                AIS_InteractiveContext)&);
+                AIS_InteractiveContext)&, const Model&, int first = 0,
+            bool coarse = false);
+    // Meshes a shape roughly for a first picture, unless it has a mesh
+    // already. Does nothing before OpenCASCADE 7, where the viewer always
+    // meshes at display quality.
+    static void meshCoarsely(const TopoDS_Shape&);
+    // The material solids are shaded with, before their color is set.
+    static Graphic3d_MaterialAspect displayMaterial();
 private:
     static GdmlWriter* gdmlWriter;
-    const Handle(AIS_InteractiveContext) context;
+    static QString importCacheDirectory;
+    static bool importCacheChosen;
 };
 
 #endif
@@ -1,13 +1,40 @@
+#include "triangulate.h"
+#include "parallel.h"
+#include "trace.h"
+
+#include <QVector>
+#include <QMultiHash>
+#include <QPair>
+#include <QMutexLocker>
+#include <QDataStream>
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+
 #include <TopoDS_Shape.hxx>
 #include <Poly_Triangulation.hxx>
-#include <Poly_CoherentTriangulation.hxx>
 #include <TopExp_Explorer.hxx>
 #include <TopoDS_Face.hxx>
 #include <TopoDS.hxx>
 #include <BRep_Tool.hxx>
+#include <BRepMesh_IncrementalMesh.hxx>
+#include <BRepBndLib.hxx>
+#include <Bnd_Box.hxx>
+#include <Standard_Failure.hxx>
+#include <TopTools_IndexedMapOfShape.hxx>
+#include <TopTools_DataMapOfShapeInteger.hxx>
+#include <BRepTools.hxx>
+#include <BRepBuilderAPI_Copy.hxx>
+#include <BRep_Builder.hxx>
+#include <TopoDS_Compound.hxx>
+#include <TopoDS_Iterator.hxx>
+
+#include <cmath>
+#include <algorithm>
+#include <queue>
 
 // Almost verbatim from [OpenCASCADE7.2.0/StlAPI_Writer.cxx:Write]
-Handle_Poly_CoherentTriangulation triangulateShape(TopoDS_Shape shape) {
+TriangleMesh triangulateShape(TopoDS_Shape shape) {
+    TRACE_SPAN("triangulateShape");
     Standard_Integer aNbNodes = 0;
       Standard_Integer aNbTriangles = 0;
 
@@ -24,7 +51,9 @@ Handle_Poly_CoherentTriangulation triangulateShape(TopoDS_Shape shape) {
       }
 
       // create temporary triangulation
-      Handle(Poly_Triangulation) aMesh = new Poly_Triangulation (aNbNodes, aNbTriangles, Standard_False);
+      TriangleMesh aMesh;
+      aMesh.nodes.resize (3 * aNbNodes);
+      aMesh.triangles.resize (3 * aNbTriangles);
 
       // fill temporary triangulation
       Standard_Integer aNodeOffset = 0;
@@ -33,6 +62,11 @@ Handle_Poly_CoherentTriangulation triangulateShape(TopoDS_Shape shape) {
       {
         TopLoc_Location aLoc;
         Handle(Poly_Triangulation) aTriangulation = BRep_Tool::Triangulation (TopoDS::Face (anExpSF.Current()), aLoc);
+        if (aTriangulation.IsNull())
+        {
+          // Faces the mesher gave up on contribute nothing.
+          continue;
+        }
 
         const TColgp_Array1OfPnt& aNodes = aTriangulation->Nodes();
         const Poly_Array1OfTriangle& aTriangles = aTriangulation->Triangles();
@@ -43,7 +77,7 @@ Handle_Poly_CoherentTriangulation triangulateShape(TopoDS_Shape shape) {
         {
           gp_Pnt aPnt = aNodes (aNodeIter);
           aPnt.Transform (aTrsf);
-          aMesh->ChangeNode (aNodeIter + aNodeOffset) = aPnt;
+          aMesh.setNode (aNodeIter - aNodes.Lower() + aNodeOffset, aPnt.XYZ());
         }
 
         // copy triangles
@@ -62,18 +96,1063 @@ Handle_Poly_CoherentTriangulation triangulateShape(TopoDS_Shape shape) {
             anId[2] = aTmpIdx;
           }
 
-          // Update nodes according to the offset.
-          anId[0] += aNodeOffset;
-          anId[1] += aNodeOffset;
-          anId[2] += aNodeOffset;
-
-          aTri.Set (anId[0], anId[1], anId[2]);
-          aMesh->ChangeTriangle (aTriIter + aTriangleOffet) =  aTri;
+          // Update nodes according to the offset, and make them 0-based.
+          Standard_Integer aTriIndex = 3 * (aTriIter - aTriangles.Lower() + aTriangleOffet);
+          for (int k = 0; k < 3; k++)
+          {
+            aMesh.triangles[aTriIndex + k] = anId[k] - aNodes.Lower() + aNodeOffset;
+          }
         }
 
         aNodeOffset += aNodes.Size();
         aTriangleOffet += aTriangles.Size();
       }
 
-      return new Poly_CoherentTriangulation(aMesh);
+      // Drop the space reserved for faces which were skipped.
+      aMesh.nodes.resize (3 * aNodeOffset);
+      aMesh.triangles.resize (3 * aTriangleOffet);
+      return aMesh;
+}
+
+typedef struct {
+    qint64 x, y, z;
+} CellKey;
+
+inline bool operator==(const CellKey& a, const CellKey& b)
+{
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+inline uint qHash(const CellKey& k)
+{
+    return uint(quint64(k.x) * 73856093u) ^ uint(quint64(k.y) * 19349663u) ^
+           uint(quint64(k.z) * 83492791u);
+}
+
+static CellKey cellOf(const gp_XYZ& p, Standard_Real size)
+{
+    CellKey k;
+    k.x = (qint64)floor(p.X() / size);
+    k.y = (qint64)floor(p.Y() / size);
+    k.z = (qint64)floor(p.Z() / size);
+    return k;
+}
+
+// Whether triangle t is no wider than tolerance across its longest edge,
+// which is returned as the corner it starts at.
+static bool isSliver(const TriangleMesh& mesh, const QVector<int>& triangles,
+                     int t, Standard_Real tolerance, int& longest)
+{
+    const int* tri = triangles.constData() + 3 * t;
+    gp_XYZ p[3] = {mesh.node(tri[0]), mesh.node(tri[1]), mesh.node(tri[2])};
+    Standard_Real length2[3];
+    longest = 0;
+    for (int k = 0; k < 3; k++) {
+        length2[k] = (p[(k + 1) % 3] - p[k]).SquareModulus();
+        if (length2[k] > length2[longest]) {
+            longest = k;
+        }
+    }
+    Standard_Real area2 = ((p[1] - p[0]) ^ (p[2] - p[0])).Modulus();
+    return area2 <= 0.0 || area2 / sqrt(length2[longest]) <= tolerance;
+}
+
+static quint64 edgeKey(int a, int b)
+{
+    return (quint64(quint32(a)) << 32) | quint32(b);
+}
+
+// Passes removeSlivers makes before dropping what slivers remain.
+static const int sliverPasses = 8;
+
+// Removes the triangles of the list which are no wider than tolerance,
+// without opening cracks. A sliver's longest edge is flipped with the
+// neighbour across it, which splits that neighbour at the sliver's third
+// node; where that would make slivers again, or there is no one neighbour,
+// the sliver's shortest edge is collapsed instead. Slivers on an open
+// edge, which no other triangle shares, are simply dropped.
+static void removeSlivers(const TriangleMesh& mesh, QVector<int>& triangles,
+                          Standard_Real tolerance)
+{
+    for (int pass = 0; pass <= sliverPasses; pass++) {
+        const int count = triangles.size() / 3;
+        // The triangle with each directed edge, or -2 if several have it.
+        QHash<quint64, int> edges;
+        edges.reserve(3 * count);
+        for (int t = 0; t < count; t++) {
+            for (int k = 0; k < 3; k++) {
+                quint64 key = edgeKey(triangles[3 * t + k],
+                                      triangles[3 * t + (k + 1) % 3]);
+                edges[key] = edges.contains(key) ? -2 : t;
+            }
+        }
+
+        QVector<bool> dropped(count, false);
+        QVector<int> merged(mesh.nodeCount(), -1);
+        bool changed = false;
+        for (int t = 0; t < count; t++) {
+            int k;
+            if (dropped[t] || !isSliver(mesh, triangles, t, tolerance, k)) {
+                continue;
+            }
+            int* tri = triangles.data() + 3 * t;
+            int u = tri[k], v = tri[(k + 1) % 3], w = tri[(k + 2) % 3];
+            int n = edges.value(edgeKey(v, u), -1);
+            if (pass == sliverPasses) {
+                dropped[t] = true;
+                continue;
+            }
+            if (n == -1) {
+                dropped[t] = true;
+                changed = true;
+                continue;
+            }
+            if (n >= 0 && !dropped[n]) {
+                int* other = triangles.data() + 3 * n;
+                int x = other[0] + other[1] + other[2] - u - v;
+                QVector<int> flipped;
+                flipped << w << u << x << w << x << v;
+                int j;
+                if (x != w && !edges.contains(edgeKey(w, x)) &&
+                        !edges.contains(edgeKey(x, w)) &&
+                        !isSliver(mesh, flipped, 0, tolerance, j) &&
+                        !isSliver(mesh, flipped, 1, tolerance, j)) {
+                    edges.remove(edgeKey(u, v));
+                    edges.remove(edgeKey(v, u));
+                    edges[edgeKey(v, w)] = n;
+                    edges[edgeKey(u, x)] = t;
+                    edges[edgeKey(x, w)] = t;
+                    edges[edgeKey(w, x)] = n;
+                    for (int i = 0; i < 3; i++) {
+                        tri[i] = flipped[i];
+                        other[i] = flipped[3 + i];
+                    }
+                    changed = true;
+                    continue;
+                }
+            }
+            // Each node moves at most once a pass, so that the moves stay
+            // as short as the edges they collapse.
+            int shortest = 0;
+            Standard_Real best = -1.0;
+            for (int i = 0; i < 3; i++) {
+                Standard_Real d = (mesh.node(tri[(i + 1) % 3]) -
+                                   mesh.node(tri[i])).SquareModulus();
+                if (best < 0.0 || d < best) {
+                    best = d;
+                    shortest = i;
+                }
+            }
+            int keep = tri[shortest], gone = tri[(shortest + 1) % 3];
+            if (merged[keep] == -1 && merged[gone] == -1) {
+                merged[keep] = keep;
+                merged[gone] = keep;
+                changed = true;
+            }
+        }
+
+        QVector<int> kept;
+        kept.reserve(triangles.size());
+        for (int t = 0; t < count; t++) {
+            if (dropped[t]) {
+                continue;
+            }
+            int a = triangles[3 * t], b = triangles[3 * t + 1];
+            int c = triangles[3 * t + 2];
+            a = merged[a] >= 0 ? merged[a] : a;
+            b = merged[b] >= 0 ? merged[b] : b;
+            c = merged[c] >= 0 ? merged[c] : c;
+            if (a == b || b == c || c == a) {
+                continue;
+            }
+            kept << a << b << c;
+        }
+        triangles = kept;
+        if (!changed) {
+            break;
+        }
+    }
+}
+
+void weldMesh(TriangleMesh& mesh, Standard_Real tolerance)
+{
+    TRACE_SPAN("weldMesh");
+    const int nodeCount = mesh.nodeCount();
+    const Standard_Real tolerance2 = tolerance * tolerance;
+
+    // Map every node onto the first earlier node within tolerance. The grid
+    // cells are as wide as the tolerance, so only the 27 cells around a node
+    // can hold a match.
+    QVector<int> remap(nodeCount);
+    if (tolerance > 0.0) {
+        QMultiHash<CellKey, int> grid;
+        grid.reserve(nodeCount);
+        for (int i = 0; i < nodeCount; i++) {
+            gp_XYZ p = mesh.node(i);
+            CellKey home = cellOf(p, tolerance);
+            int match = i;
+            for (int dx = -1; dx <= 1; dx++) {
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dz = -1; dz <= 1; dz++) {
+                        CellKey k = {home.x + dx, home.y + dy, home.z + dz};
+                        QMultiHash<CellKey, int>::const_iterator it = grid.constFind(k);
+                        for (; it != grid.constEnd() && it.key() == k; ++it) {
+                            if (it.value() < match &&
+                                (mesh.node(it.value()) - p).SquareModulus() <= tolerance2) {
+                                match = it.value();
+                            }
+                        }
+                    }
+                }
+            }
+            remap[i] = match;
+            if (match == i) {
+                grid.insert(home, i);
+            }
+        }
+    } else {
+        for (int i = 0; i < nodeCount; i++) {
+            remap[i] = i;
+        }
+    }
+
+    // Drop the triangles whose short edges welding collapsed, then the
+    // slivers left.
+    QVector<int> triangles;
+    triangles.reserve(mesh.triangles.size());
+    for (int t = 0; t < mesh.triangleCount(); t++) {
+        int a = remap[mesh.triangles[3 * t]];
+        int b = remap[mesh.triangles[3 * t + 1]];
+        int c = remap[mesh.triangles[3 * t + 2]];
+        if (a == b || b == c || c == a) {
+            continue;
+        }
+        triangles.append(a);
+        triangles.append(b);
+        triangles.append(c);
+    }
+    removeSlivers(mesh, triangles, tolerance);
+
+    // Renumber the surviving nodes in order of first appearance.
+    QVector<int> renumber(nodeCount, -1);
+    QVector<double> nodes;
+    nodes.reserve(mesh.nodes.size());
+    for (int j = 0; j < triangles.size(); j++) {
+        int& v = triangles[j];
+        if (renumber[v] < 0) {
+            renumber[v] = nodes.size() / 3;
+            nodes.append(mesh.nodes[3 * v]);
+            nodes.append(mesh.nodes[3 * v + 1]);
+            nodes.append(mesh.nodes[3 * v + 2]);
+        }
+        v = renumber[v];
+    }
+
+    mesh.nodes = nodes;
+    mesh.triangles = triangles;
+}
+
+// Quadric error of the distances to a set of planes. The squared distance
+// of p to plane (n, d) is (n.p + d)^2; the sum over all planes is kept as
+// the upper triangle of the symmetric 4x4 matrix.
+class Quadric
+{
+public:
+    Quadric()
+    {
+        for (int k = 0; k < 10; k++) {
+            q[k] = 0.0;
+        }
+    }
+    void addPlane(const gp_XYZ& n, Standard_Real d)
+    {
+        q[0] += n.X() * n.X();
+        q[1] += n.X() * n.Y();
+        q[2] += n.X() * n.Z();
+        q[3] += n.X() * d;
+        q[4] += n.Y() * n.Y();
+        q[5] += n.Y() * n.Z();
+        q[6] += n.Y() * d;
+        q[7] += n.Z() * n.Z();
+        q[8] += n.Z() * d;
+        q[9] += d * d;
+    }
+    void add(const Quadric& o)
+    {
+        for (int k = 0; k < 10; k++) {
+            q[k] += o.q[k];
+        }
+    }
+    Standard_Real error(const gp_XYZ& p) const
+    {
+        Standard_Real x = p.X(), y = p.Y(), z = p.Z();
+        return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x +
+               q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y +
+               q[7] * z * z + 2 * q[8] * z + q[9];
+    }
+    // The point of least error, if there is a single one.
+    bool minimum(gp_XYZ& p) const
+    {
+        Standard_Real c00 = q[4] * q[7] - q[5] * q[5];
+        Standard_Real c01 = q[2] * q[5] - q[1] * q[7];
+        Standard_Real c02 = q[1] * q[5] - q[2] * q[4];
+        Standard_Real det = q[0] * c00 + q[1] * c01 + q[2] * c02;
+        if (fabs(det) < 1e-12) {
+            return false;
+        }
+        Standard_Real c11 = q[0] * q[7] - q[2] * q[2];
+        Standard_Real c12 = q[1] * q[2] - q[0] * q[5];
+        Standard_Real c22 = q[0] * q[4] - q[1] * q[1];
+        p = gp_XYZ(-(c00 * q[3] + c01 * q[6] + c02 * q[8]) / det,
+                   -(c01 * q[3] + c11 * q[6] + c12 * q[8]) / det,
+                   -(c02 * q[3] + c12 * q[6] + c22 * q[8]) / det);
+        return true;
+    }
+private:
+    Standard_Real q[10];
+};
+
+typedef struct {
+    Standard_Real cost;
+    int a, b;
+    int stampA, stampB;
+} Collapse;
+
+inline bool operator<(const Collapse& x, const Collapse& y)
+{
+    // Cheapest first out of a std::priority_queue.
+    return x.cost > y.cost;
+}
+
+// The edge collapse state of decimateMesh.
+class Decimator
+{
+public:
+    Decimator(TriangleMesh& mesh, Standard_Real tolerance) :
+        mesh(mesh), tolerance2(tolerance * tolerance)
+    {
+        int nodeCount = mesh.nodeCount();
+        int triangleCount = mesh.triangleCount();
+
+        // Work near the origin, where the quadrics keep their precision.
+        for (int i = 0; i < nodeCount; i++) {
+            center += mesh.node(i);
+        }
+        if (nodeCount > 0) {
+            center /= nodeCount;
+        }
+        positions.resize(nodeCount);
+        for (int i = 0; i < nodeCount; i++) {
+            positions[i] = mesh.node(i) - center;
+        }
+
+        quadrics.resize(nodeCount);
+        fans.resize(nodeCount);
+        stamps.fill(0, nodeCount);
+        alive.fill(true, triangleCount);
+        for (int t = 0; t < triangleCount; t++) {
+            const int* tri = &mesh.triangles[3 * t];
+            gp_XYZ n = normal(t);
+            Standard_Real length = n.Modulus();
+            if (length > 0.0) {
+                n /= length;
+            }
+            Standard_Real d = -n.Dot(positions[tri[0]]);
+            for (int k = 0; k < 3; k++) {
+                quadrics[tri[k]].addPlane(n, d);
+                fans[tri[k]].append(t);
+            }
+        }
+
+        // Vertices on edges not shared by exactly two triangles stay put, so
+        // open boundaries and non-manifold seams are left as they are.
+        locked.fill(false, nodeCount);
+        for (int i = 0; i < nodeCount; i++) {
+            QVector<int> around = neighbours(i);
+            for (int j = 0; j < around.size(); j++) {
+                if (shared(i, around[j]) != 2) {
+                    locked[i] = true;
+                }
+            }
+        }
+        for (int i = 0; i < nodeCount; i++) {
+            QVector<int> around = neighbours(i);
+            for (int j = 0; j < around.size(); j++) {
+                if (i < around[j]) {
+                    consider(i, around[j]);
+                }
+            }
+        }
+    }
+
+    void run()
+    {
+        while (!queue.empty()) {
+            Collapse c = queue.top();
+            queue.pop();
+            if (c.stampA != stamps[c.a] || c.stampB != stamps[c.b]) {
+                continue;
+            }
+            gp_XYZ p;
+            if (!bestPosition(c.a, c.b, p) || !canCollapse(c.a, c.b, p)) {
+                continue;
+            }
+            collapse(c.a, c.b, p);
+        }
+
+        // Compact the survivors, in their original order.
+        QVector<int> renumber(positions.size(), -1);
+        QVector<double> nodes;
+        QVector<int> triangles;
+        for (int t = 0; t < alive.size(); t++) {
+            if (!alive[t]) {
+                continue;
+            }
+            for (int k = 0; k < 3; k++) {
+                int v = mesh.triangles[3 * t + k];
+                if (renumber[v] < 0) {
+                    renumber[v] = nodes.size() / 3;
+                    gp_XYZ p = positions[v] + center;
+                    nodes.append(p.X());
+                    nodes.append(p.Y());
+                    nodes.append(p.Z());
+                }
+                triangles.append(renumber[v]);
+            }
+        }
+        mesh.nodes = nodes;
+        mesh.triangles = triangles;
+    }
+private:
+    gp_XYZ normal(int t) const
+    {
+        const int* tri = &mesh.triangles[3 * t];
+        return (positions[tri[1]] - positions[tri[0]]) ^
+               (positions[tri[2]] - positions[tri[0]]);
+    }
+
+    QVector<int> neighbours(int v) const
+    {
+        QVector<int> around;
+        const QVector<int>& fan = fans[v];
+        for (int j = 0; j < fan.size(); j++) {
+            for (int k = 0; k < 3; k++) {
+                int w = mesh.triangles[3 * fan[j] + k];
+                if (w != v && !around.contains(w)) {
+                    around.append(w);
+                }
+            }
+        }
+        return around;
+    }
+
+    // Number of triangles holding both a and b.
+    int shared(int a, int b) const
+    {
+        int count = 0;
+        const QVector<int>& fan = fans[a];
+        for (int j = 0; j < fan.size(); j++) {
+            const int* tri = &mesh.triangles[3 * fan[j]];
+            count += (tri[0] == b || tri[1] == b || tri[2] == b);
+        }
+        return count;
+    }
+
+    bool bestPosition(int a, int b, gp_XYZ& p) const
+    {
+        Quadric q = quadrics[a];
+        q.add(quadrics[b]);
+        gp_XYZ candidates[4] = {positions[a], positions[b],
+                                (positions[a] + positions[b]) / 2, gp_XYZ()
+                               };
+        int count = q.minimum(candidates[3]) ? 4 : 3;
+        Standard_Real best = tolerance2;
+        bool found = false;
+        for (int k = 0; k < count; k++) {
+            Standard_Real error = q.error(candidates[k]);
+            if (error <= best) {
+                best = error;
+                p = candidates[k];
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    void consider(int a, int b)
+    {
+        if (locked[a] || locked[b]) {
+            return;
+        }
+        gp_XYZ p;
+        if (!bestPosition(a, b, p)) {
+            return;
+        }
+        Quadric q = quadrics[a];
+        q.add(quadrics[b]);
+        Collapse c = {q.error(p), a, b, stamps[a], stamps[b]};
+        queue.push(c);
+    }
+
+    bool canCollapse(int a, int b, const gp_XYZ& p) const
+    {
+        // The link condition: a and b may only share the two vertices
+        // opposite their edge, each of which must keep three neighbours.
+        QVector<int> aroundA = neighbours(a);
+        QVector<int> aroundB = neighbours(b);
+        int common = 0;
+        for (int j = 0; j < aroundA.size(); j++) {
+            if (aroundB.contains(aroundA[j])) {
+                if (fans[aroundA[j]].size() <= 3) {
+                    return false;
+                }
+                common++;
+            }
+        }
+        if (common != 2 || shared(a, b) != 2) {
+            return false;
+        }
+
+        // No remaining triangle may fold over or become degenerate.
+        for (int side = 0; side < 2; side++) {
+            int v = side ? b : a;
+            int other = side ? a : b;
+            const QVector<int>& fan = fans[v];
+            for (int j = 0; j < fan.size(); j++) {
+                const int* tri = &mesh.triangles[3 * fan[j]];
+                if (tri[0] == other || tri[1] == other || tri[2] == other) {
+                    continue;
+                }
+                gp_XYZ before = normal(fan[j]);
+                gp_XYZ corner[3];
+                for (int k = 0; k < 3; k++) {
+                    corner[k] = tri[k] == v ? p : positions[tri[k]];
+                }
+                gp_XYZ after = (corner[1] - corner[0]) ^ (corner[2] - corner[0]);
+                Standard_Real length = after.Modulus();
+                if (length <= 1e-12 || before.Dot(after) <= 0.2 * before.Modulus() * length) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    // Merges b into a, which moves to p.
+    void collapse(int a, int b, const gp_XYZ& p)
+    {
+        QVector<int>& fanA = fans[a];
+        for (int j = fanA.size() - 1; j >= 0; j--) {
+            const int* tri = &mesh.triangles[3 * fanA[j]];
+            if (tri[0] == b || tri[1] == b || tri[2] == b) {
+                removeTriangle(fanA[j]);
+            }
+        }
+        const QVector<int> fanB = fans[b];
+        for (int j = 0; j < fanB.size(); j++) {
+            int* tri = &mesh.triangles[3 * fanB[j]];
+            for (int k = 0; k < 3; k++) {
+                if (tri[k] == b) {
+                    tri[k] = a;
+                }
+            }
+            fans[a].append(fanB[j]);
+        }
+        fans[b].clear();
+
+        positions[a] = p;
+        quadrics[a].add(quadrics[b]);
+        stamps[a]++;
+        stamps[b]++;
+
+        QVector<int> around = neighbours(a);
+        for (int j = 0; j < around.size(); j++) {
+            stamps[around[j]]++;
+        }
+        for (int j = 0; j < around.size(); j++) {
+            QVector<int> next = neighbours(around[j]);
+            for (int k = 0; k < next.size(); k++) {
+                consider(around[j], next[k]);
+            }
+        }
+    }
+
+    void removeTriangle(int t)
+    {
+        alive[t] = false;
+        for (int k = 0; k < 3; k++) {
+            fans[mesh.triangles[3 * t + k]].removeOne(t);
+        }
+    }
+
+    TriangleMesh& mesh;
+    const Standard_Real tolerance2;
+    gp_XYZ center;
+    QVector<gp_XYZ> positions;
+    QVector<Quadric> quadrics;
+    QVector<QVector<int> > fans;
+    QVector<int> stamps;
+    QVector<bool> alive;
+    QVector<bool> locked;
+    std::priority_queue<Collapse> queue;
+};
+
+void decimateMesh(TriangleMesh& mesh, Standard_Real tolerance)
+{
+    TRACE_SPAN("decimateMesh");
+    Decimator decimator(mesh, tolerance);
+    decimator.run();
+}
+
+// The deflection and angle match the display defaults of AIS
+// (Prs3d::GetDeflection), so exports look like what the viewer shows.
+MeshOptions::MeshOptions() :
+    weldTolerance(1e-4), deflection(0.004), relative(true), angle(0.5),
+    decimation(0.0), triangleBudget(0)
+{
+}
+
+// Meshing passes fitBudget makes, coarsening between them, before giving
+// up.
+static const int budgetPasses = 8;
+
+static int findRoot(QVector<int>& parent, int i)
+{
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+static void meshPart(const TopoDS_Shape& part, Standard_Real deflection,
+                     bool relative, Standard_Real angle)
+{
+    // Drop any earlier triangulation, such as one the copy kept, which
+    // BRepMesh would otherwise keep if it were fine enough.
+    BRepTools::Clean(part);
+    if (relative) {
+        Bnd_Box box;
+        BRepBndLib::Add(part, box);
+        if (box.IsVoid()) {
+            return;
+        }
+        deflection *= sqrt(box.SquareExtent());
+    }
+    try {
+        BRepMesh_IncrementalMesh(part, deflection, Standard_False, angle);
+    } catch (Standard_Failure&) {
+        qWarning("Meshing failed for a solid; it may be incomplete.");
+    }
+}
+
+QByteArray MeshSet::fingerprint() const
+{
+    return key;
+}
+
+int MeshSet::count() const
+{
+    return meshes.size();
+}
+
+TriangleMesh MeshSet::mesh(int s) const
+{
+    return meshes.at(s);
+}
+
+int MeshSet::undecimatedCount(int s) const
+{
+    return undecimated.at(s);
+}
+
+qint64 MeshSet::size() const
+{
+    qint64 total = 0;
+    for (int s = 0; s < meshes.size(); s++) {
+        total += meshes[s].nodes.size() * qint64(sizeof(double)) +
+                 meshes[s].triangles.size() * qint64(sizeof(int));
+    }
+    return total;
+}
+
+Mesher::Mesher(const Handle(TopTools_HSequenceOfShape)& shapes,
+               const MeshOptions& options) :
+    options(options), locks(NULL), grouped(false), source(NULL),
+    recording(NULL)
+{
+    int count = shapes->Length();
+
+    // Instances of one part share TShapes, so strip the location to mesh
+    // each part only once. Rigidly placed instances also share one mesh in
+    // the part's own frame; the rest have their placement baked in.
+    TopTools_DataMapOfShapeInteger instanced;
+    shapeSolids.resize(count);
+    placements.resize(count);
+    for (int i = 0; i < count; i++) {
+        const TopoDS_Shape& shape = shapes->Value(i + 1);
+        TopoDS_Shape part = shape.Located(TopLoc_Location());
+        int p = parts.Add(part) - 1;
+        if (p == partUses.size()) {
+            partUses.append(0);
+        }
+        partUses[p]++;
+        shapeParts.append(p);
+
+        gp_Trsf trsf = shape.Location().Transformation();
+        bool rigid = fabs(trsf.ScaleFactor() - 1.0) < 1e-9 && !trsf.IsNegative();
+        if (rigid && instanced.IsBound(part) &&
+            solids[instanced.Find(part)].Orientation() == part.Orientation()) {
+            shapeSolids[i] = instanced.Find(part);
+            placements[i] = trsf;
+        } else if (rigid && !instanced.IsBound(part)) {
+            instanced.Bind(part, solids.size());
+            shapeSolids[i] = solids.size();
+            placements[i] = trsf;
+            solids.append(part);
+            partOf.append(p);
+        } else {
+            shapeSolids[i] = solids.size();
+            placements[i] = gp_Trsf();
+            solids.append(shape);
+            partOf.append(p);
+        }
+    }
+
+    partDeflections.fill(0.0, parts.Extent());
+    partAngles.fill(0.0, parts.Extent());
+    partOverrides.fill(0, parts.Extent());
+    coarsening.fill(1.0, parts.Extent());
+    budgetTimes.fill(0, solids.size());
+    undecimated.fill(0, solids.size());
+    copies.resize(solids.size());
+}
+
+void Mesher::setTolerances(int i, Standard_Real deflection,
+                           Standard_Real angle)
+{
+    if (deflection <= 0.0 && angle <= 0.0) {
+        return;
+    }
+    int p = shapeParts.at(i);
+    deflection = deflection > 0.0 ? deflection : options.deflection;
+    angle = angle > 0.0 ? angle : options.angle;
+    if (partOverrides[p]++ == 0) {
+        partDeflections[p] = deflection;
+        partAngles[p] = angle;
+    } else {
+        partDeflections[p] = qMin(partDeflections[p], deflection);
+        partAngles[p] = qMin(partAngles[p], angle);
+    }
+}
+
+void Mesher::groupParts()
+{
+    QMutexLocker locker(&grouping);
+    if (grouped) {
+        return;
+    }
+
+    // BRepMesh stores its results on the faces and edges themselves. Parts
+    // which share any edge must then be meshed under the same lock.
+    QVector<int> parent(parts.Extent());
+    for (int p = 0; p < parent.size(); p++) {
+        parent[p] = p;
+    }
+    TopTools_DataMapOfShapeInteger edgeOwners;
+    for (int p = 0; p < parent.size(); p++) {
+        for (TopExp_Explorer exp(parts.FindKey(p + 1), TopAbs_EDGE); exp.More();
+             exp.Next()) {
+            TopoDS_Shape edge = exp.Current().Located(TopLoc_Location());
+            if (edgeOwners.IsBound(edge)) {
+                parent[findRoot(parent, p)] = findRoot(parent,
+                                                       edgeOwners.Find(edge));
+            } else {
+                edgeOwners.Bind(edge, p);
+            }
+        }
+    }
+
+    QVector<int> rootGroup(parent.size(), -1);
+    groupOf.resize(parent.size());
+    for (int p = 0; p < parent.size(); p++) {
+        int root = findRoot(parent, p);
+        if (rootGroup[root] < 0) {
+            rootGroup[root] = groups.size();
+            groups.append(QVector<int>());
+        }
+        groupOf[p] = rootGroup[root];
+        groups[groupOf[p]].append(p);
+    }
+
+    groupSolids.resize(groups.size());
+    for (int s = 0; s < solids.size(); s++) {
+        groupSolids[groupOf[partOf[s]]].append(s);
+    }
+    locks = new QMutex[groups.size()];
+    meshed.fill(false, groups.size());
+    grouped = true;
+}
+
+Mesher::~Mesher()
+{
+    delete[] locks;
+}
+
+QByteArray Mesher::fingerprint() const
+{
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out << options.weldTolerance << options.deflection << options.relative
+        << options.angle << options.decimation << qint32(options.triangleBudget);
+    out << shapeSolids << partOf;
+    for (int p = 0; p < partUses.size(); p++) {
+        out << qint32(partUses[p]) << qint32(partOverrides[p]);
+        out << partDeflections[p] << partAngles[p];
+    }
+    return QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+}
+
+QVector<QByteArray> Mesher::solidKeys() const
+{
+    QVector<QVector<qint32> > shapesOf(solids.size());
+    for (int i = 0; i < shapeSolids.size(); i++) {
+        shapesOf[shapeSolids[i]].append(i);
+    }
+    QByteArray shared;
+    if (options.triangleBudget > 0) {
+        shared = fingerprint();
+    }
+    QVector<QByteArray> keys(solids.size());
+    for (int s = 0; s < solids.size(); s++) {
+        QByteArray data;
+        QDataStream out(&data, QIODevice::WriteOnly);
+        out << options.weldTolerance << options.deflection << options.relative
+            << options.angle << options.decimation << shared;
+        int p = partOf[s];
+        out << qint32(s) << shapesOf[s] << qint32(p) << qint32(partUses[p])
+            << qint32(partOverrides[p]) << partDeflections[p] << partAngles[p];
+        keys[s] = QCryptographicHash::hash(data, QCryptographicHash::Sha1);
+    }
+    return keys;
+}
+
+bool Mesher::useSource(const MeshSource* meshes)
+{
+    if (!meshes || meshes->count() != solids.size() ||
+        meshes->fingerprint() != fingerprint()) {
+        return false;
+    }
+    source = meshes;
+    return true;
+}
+
+void Mesher::record(MeshSet* set)
+{
+    recording = set;
+    set->key = fingerprint();
+    set->meshes.fill(TriangleMesh(), solids.size());
+    set->undecimated.fill(0, solids.size());
+}
+
+int Mesher::count() const
+{
+    return solids.size();
+}
+
+const TopoDS_Shape& Mesher::solid(int s) const
+{
+    return solids.at(s);
+}
+
+int Mesher::shapeCount() const
+{
+    return shapeSolids.size();
+}
+
+int Mesher::solidOf(int i) const
+{
+    return shapeSolids.at(i);
+}
+
+const gp_Trsf& Mesher::placement(int i) const
+{
+    return placements.at(i);
+}
+
+// Meshing replaces the triangulation of what it meshes, which may be the
+// viewer's, so each group is meshed on a copy made the first time. Copied
+// as one, its solids still share what they shared, so parts are still
+// meshed once. The geometry stays shared; only the topology holds
+// triangulations.
+void Mesher::meshGroup(int g)
+{
+    TRACE_SPAN("meshGroup");
+    const QVector<int>& members = groups.at(g);
+    const QVector<int>& inGroup = groupSolids.at(g);
+    if (!inGroup.isEmpty() && copies.at(inGroup[0]).IsNull()) {
+        BRep_Builder builder;
+        TopoDS_Compound compound;
+        builder.MakeCompound(compound);
+        for (int j = 0; j < inGroup.size(); j++) {
+            builder.Add(compound, solids[inGroup[j]]);
+        }
+        BRepBuilderAPI_Copy copier(compound, Standard_False);
+        TopoDS_Iterator it(copier.Shape());
+        for (int j = 0; it.More(); it.Next(), j++) {
+            // Only this group's slots, under its lock.
+            copies.data()[inGroup[j]] = it.Value();
+        }
+    }
+    // The copy of a part is that of any solid using it, unplaced.
+    QHash<int, TopoDS_Shape> partCopies;
+    for (int j = 0; j < inGroup.size(); j++) {
+        int s = inGroup[j];
+        if (!partCopies.contains(partOf[s])) {
+            partCopies.insert(partOf[s], copies[s].Located(TopLoc_Location()));
+        }
+    }
+    for (int j = 0; j < members.size(); j++) {
+        int p = members[j];
+        Standard_Real deflection = options.deflection;
+        Standard_Real angle = options.angle;
+        if (partOverrides[p] == partUses[p]) {
+            deflection = partDeflections[p];
+            angle = partAngles[p];
+        } else if (partOverrides[p] > 0) {
+            deflection = qMin(deflection, partDeflections[p]);
+            angle = qMin(angle, partAngles[p]);
+        }
+        meshPart(partCopies.value(p), deflection * coarsening[p],
+                 options.relative, qMin(angle * coarsening[p], M_PI / 2));
+    }
+}
+
+TriangleMesh Mesher::extract(int s)
+{
+    groupParts();
+    int g = groupOf.at(partOf.at(s));
+    {
+        QMutexLocker locker(&locks[g]);
+        if (!meshed.at(g)) {
+            meshGroup(g);
+            // Each flag is only touched under its own lock; the vector
+            // itself is never resized, so this does not race.
+            meshed.data()[g] = true;
+        }
+    }
+
+    // Extraction only reads the triangulations, so needs no lock.
+    TriangleMesh result = triangulateShape(copies.at(s));
+    weldMesh(result, options.weldTolerance);
+    undecimated.data()[s] = result.triangleCount();
+    if (options.decimation > 0.0) {
+        decimateMesh(result, options.decimation);
+        // Its collapses may leave slivers of their own.
+        weldMesh(result, options.weldTolerance);
+    }
+    return result;
+}
+
+int Mesher::undecimatedCount(int s) const
+{
+    if (source) {
+        return source->undecimatedCount(s);
+    }
+    return undecimated.at(s);
+}
+
+qint64 Mesher::budgetTime(int s) const
+{
+    return budgetTimes.at(s);
+}
+
+TriangleMesh Mesher::mesh(int s)
+{
+    TriangleMesh result;
+    if (source) {
+        result = source->mesh(s);
+    } else {
+        result = extract(s);
+    }
+    if (recording) {
+        // Sized up front, so each thread only touches its own slots.
+        recording->meshes.data()[s] = result;
+        recording->undecimated.data()[s] = undecimatedCount(s);
+    }
+    return result;
+}
+
+void Mesher::fitBudget(const QVector<bool>& skip, int threads)
+{
+    // A source's meshes were fitted to the same budget when made.
+    if (options.triangleBudget <= 0 || source) {
+        return;
+    }
+    groupParts();
+
+    QVector<int> todo;
+    for (int s = 0; s < solids.size(); s++) {
+        if (!skip.value(s, false)) {
+            todo.append(s);
+        }
+    }
+    QVector<int> all = todo;
+    QVector<int> counts(solids.size(), 0);
+    qint64 total = 0;
+    for (int round = 0; ; round++) {
+        parallelFor(todo.size(), [&](int k) {
+            int s = todo[k];
+            QElapsedTimer timer;
+            timer.start();
+            counts.data()[s] = extract(s).triangleCount();
+            budgetTimes.data()[s] += timer.nsecsElapsed();
+        }, threads);
+
+        total = 0;
+        QVector<QPair<int, int> > bySize;
+        for (int k = 0; k < all.size(); k++) {
+            int triangles = counts[all[k]];
+            total += triangles;
+            bySize.append(QPair<int, int>(-triangles, all[k]));
+        }
+        qint64 excess = total - options.triangleBudget;
+        if (excess <= 0 || round + 1 == budgetPasses) {
+            break;
+        }
+
+        // Take the largest solids until they hold twice the excess, and
+        // coarsen them enough to shed it, as the triangle count falls
+        // roughly in proportion to the deflection.
+        std::sort(bySize.begin(), bySize.end());
+        qint64 sum = 0;
+        QVector<bool> regroup(groups.size(), false);
+        QVector<bool> coarsened(parts.Extent(), false);
+        for (int k = 0; k < bySize.size() && sum < 2 * excess; k++) {
+            int p = partOf[bySize[k].second];
+            sum += -bySize[k].first;
+            regroup[groupOf[p]] = true;
+            coarsened[p] = true;
+        }
+        Standard_Real factor = double(sum) / double(sum - excess);
+        for (int p = 0; p < coarsened.size(); p++) {
+            if (coarsened[p]) {
+                coarsening[p] *= factor;
+            }
+        }
+
+        todo.clear();
+        for (int k = 0; k < all.size(); k++) {
+            int g = groupOf[partOf[all[k]]];
+            if (regroup[g]) {
+                meshed[g] = false;
+                todo.append(all[k]);
+            }
+        }
+    }
+
+    if (total > options.triangleBudget) {
+        qWarning("Could not fit the meshes into %d triangles; %lld remain.",
+                 options.triangleBudget, total);
+    }
 }
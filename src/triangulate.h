@@ -0,0 +1,211 @@
+#ifndef TRIANGULATE_H
+#define TRIANGULATE_H
+
+#include <QVector>
+#include <QByteArray>
+#include <QMutex>
+
+#include <Standard.hxx>
+#include <gp_XYZ.hxx>
+#include <gp_Trsf.hxx>
+#include <TopoDS_Shape.hxx>
+#include <TopTools_HSequenceOfShape.hxx>
+#include <TopTools_IndexedMapOfShape.hxx>
+
+// A flat triangle mesh: node i sits at nodes[3i .. 3i+2] (in mm), and
+// triangle t joins the 0-based nodes triangles[3t .. 3t+2].
+class TriangleMesh
+{
+public:
+    int nodeCount() const
+    {
+        return nodes.size() / 3;
+    }
+    int triangleCount() const
+    {
+        return triangles.size() / 3;
+    }
+    gp_XYZ node(int i) const
+    {
+        return gp_XYZ(nodes[3 * i], nodes[3 * i + 1], nodes[3 * i + 2]);
+    }
+    void setNode(int i, const gp_XYZ& p)
+    {
+        nodes[3 * i] = p.X();
+        nodes[3 * i + 1] = p.Y();
+        nodes[3 * i + 2] = p.Z();
+    }
+
+    QVector<double> nodes;
+    QVector<int> triangles;
+};
+
+class MeshOptions
+{
+public:
+    MeshOptions();
+
+    // Nodes closer than this (in mm) are merged, and triangles no wider
+    // than it are removed. Zero merges nothing and only removes flat
+    // triangles.
+    Standard_Real weldTolerance;
+    // Largest distance between a facet and the surface it stands for. In
+    // mm, or with relative set, as a fraction of the diagonal of each
+    // part's bounding box.
+    Standard_Real deflection;
+    bool relative;
+    // Largest angle between the normals of adjacent facets, in radians.
+    Standard_Real angle;
+    // When above 0, meshes are simplified as long as the quadric error of
+    // each vertex, the root of its summed squared distances to the planes
+    // of the facets it replaces, stays below this (in mm).
+    Standard_Real decimation;
+    // Most triangles to write over all solids; 0 for no limit. Solids with
+    // the most triangles are meshed more coarsely until the total fits.
+    int triangleBudget;
+};
+
+// Collects the existing face triangulations of a shape into one mesh,
+// transformed by the shape's location. Nodes on face boundaries appear
+// once per face.
+TriangleMesh triangulateShape(TopoDS_Shape shape);
+
+// Merges coincident nodes of the mesh, then removes the triangles this
+// collapsed, those no wider than tolerance (flipping or collapsing edges
+// around them, so that closed meshes stay closed), and the nodes no longer
+// used by any triangle.
+void weldMesh(TriangleMesh&, Standard_Real tolerance);
+
+// Collapses edges, cheapest first by quadric error, while every moved
+// vertex stays within tolerance of all the original facet planes it has
+// absorbed. Closed manifold regions stay closed and manifold; vertices on
+// open or non-manifold edges never move.
+void decimateMesh(TriangleMesh&, Standard_Real tolerance);
+
+// Finished meshes for the solids of a Mesher, which a later Mesher of the
+// same shapes can use instead of meshing them again.
+class MeshSource
+{
+public:
+    virtual ~MeshSource() {}
+    // The Mesher::fingerprint() the meshes were made with.
+    virtual QByteArray fingerprint() const = 0;
+    virtual int count() const = 0;
+    // Both thread safe.
+    virtual TriangleMesh mesh(int s) const = 0;
+    virtual int undecimatedCount(int s) const = 0;
+};
+
+// Meshes held in memory, as recorded by Mesher::record().
+class MeshSet : public MeshSource
+{
+public:
+    virtual QByteArray fingerprint() const;
+    virtual int count() const;
+    virtual TriangleMesh mesh(int s) const;
+    virtual int undecimatedCount(int s) const;
+    // Memory taken by the meshes.
+    qint64 size() const;
+
+    QByteArray key;
+    QVector<TriangleMesh> meshes;
+    QVector<int> undecimated;
+};
+
+// Meshes the shapes of a sequence on demand, from any number of threads.
+// Shapes which are rigidly placed instances of one part share a single
+// solid, meshed in the part's own frame; every other shape gets a solid of
+// its own. Parts which share edges are never meshed concurrently. The
+// shapes are copied on construction, and only the copies are meshed.
+class Mesher
+{
+public:
+    Mesher(const Handle(TopTools_HSequenceOfShape)&, const MeshOptions&);
+    ~Mesher();
+
+    // Meshes shape i (0-based) with its own deflection and angle, in the
+    // units of the options; values <= 0 keep those of the options. A part
+    // shared by several shapes is meshed as finely as any of them asks.
+    // Call before meshing anything.
+    void setTolerances(int i, Standard_Real deflection, Standard_Real angle);
+    // Meshes all solids not skipped up front, then coarsens those with the
+    // most triangles until the total fits the triangle budget of the
+    // options. Only the triangle counts are kept; mesh() extracts the
+    // meshes again from what is left on the shapes. Does nothing without a
+    // budget.
+    void fitBudget(const QVector<bool>& skip, int threads = 0);
+
+    // Sums up the options, tolerances and the way shapes map to solids.
+    // Meshers of the same shapes with equal fingerprints make equal meshes.
+    // Call after setTolerances.
+    QByteArray fingerprint() const;
+    // The same per solid: what its mesh depends on, so that a solid whose
+    // key is unchanged meshes as before. With a triangle budget, that is
+    // every solid's settings.
+    QVector<QByteArray> solidKeys() const;
+    // Hands out the meshes of source rather than meshing, if they were made
+    // with this fingerprint; returns whether they were.
+    bool useSource(const MeshSource* source);
+    // Keeps a copy in set of each mesh handed out from now on.
+    void record(MeshSet* set);
+
+    // Number of distinct solids.
+    int count() const;
+    // Returns the welded (and decimated) mesh of solid s (0-based). Thread
+    // safe. Asking again gives the same mesh, extracted anew from the
+    // triangulation left on the shape the first time.
+    TriangleMesh mesh(int s);
+    // Triangles of solid s before decimation, once it has been meshed.
+    int undecimatedCount(int s) const;
+    // Time spent meshing solid s in fitBudget, in ns.
+    qint64 budgetTime(int s) const;
+    // The shape of solid s, as given; meshing only touches copies, made a
+    // group of solids sharing edges at a time.
+    const TopoDS_Shape& solid(int s) const;
+
+    // Number of shapes in the sequence.
+    int shapeCount() const;
+    // The solid used by shape i (0-based) ...
+    int solidOf(int i) const;
+    // ... and where it is placed; identity for solids not shared.
+    const gp_Trsf& placement(int i) const;
+private:
+    Mesher(const Mesher&);
+    void operator=(const Mesher&);
+    void groupParts();
+    void meshGroup(int g);
+    TriangleMesh extract(int s);
+
+    MeshOptions options;
+    QVector<TopoDS_Shape> solids;
+    QVector<int> shapeSolids;
+    QVector<int> shapeParts;
+    QVector<gp_Trsf> placements;
+    TopTools_IndexedMapOfShape parts;
+    QVector<int> partOf;
+    QVector<int> groupOf;
+    QVector<QVector<int> > groups;
+    QVector<QVector<int> > groupSolids;
+    QVector<bool> meshed;
+    QMutex* locks;
+    // Parts are only grouped once something is meshed.
+    QMutex grouping;
+    bool grouped;
+    // What is meshed and extracted, per solid.
+    QVector<TopoDS_Shape> copies;
+    // Per part: the tolerances asked for by the shapes overriding them, how
+    // many shapes use the part and how many of them override, and the
+    // factor by which fitBudget coarsened it.
+    QVector<Standard_Real> partDeflections;
+    QVector<Standard_Real> partAngles;
+    QVector<int> partUses;
+    QVector<int> partOverrides;
+    QVector<Standard_Real> coarsening;
+    // Time fitBudget spent meshing each solid.
+    QVector<qint64> budgetTimes;
+    QVector<int> undecimated;
+    const MeshSource* source;
+    MeshSet* recording;
+};
+
+#endif // TRIANGULATE_H
@@ -30,6 +30,63 @@
 
 #include <Xw_Window.hxx>
 
+#include <AIS_ListOfInteractive.hxx>
+#include <AIS_ListIteratorOfListOfInteractive.hxx>
+#include <Graphic3d_ArrayOfSegments.hxx>
+#include <Graphic3d_AspectLine3d.hxx>
+#include <Graphic3d_Group.hxx>
+#include <Prs3d_Presentation.hxx>
+#include <Prs3d_Root.hxx>
+
+// The edges of a box around each solid, as one array of segments.
+class BoxProxy : public AIS_InteractiveObject
+{
+public:
+    explicit BoxProxy(const QVector<Bnd_Box>& boxes) : boxes(boxes) {}
+protected:
+    virtual void Compute(const Handle(PrsMgr_PresentationManager3d)&,
+                         const Handle(Prs3d_Presentation)& prs,
+                         const Standard_Integer)
+    {
+        Handle(Graphic3d_ArrayOfSegments) array =
+            new Graphic3d_ArrayOfSegments(24 * boxes.size());
+        for (int i = 0; i < boxes.size(); i++) {
+            if (boxes[i].IsVoid()) {
+                continue;
+            }
+            Standard_Real x[2], y[2], z[2];
+            boxes[i].Get(x[0], y[0], z[0], x[1], y[1], z[1]);
+            // Each edge joins two corners differing in one coordinate.
+            for (int c = 0; c < 8; c++) {
+                for (int axis = 0; axis < 3; axis++) {
+                    int other = c | (1 << axis);
+                    if (other == c) {
+                        continue;
+                    }
+                    array->AddVertex(x[c & 1], y[(c >> 1) & 1], z[c >> 2]);
+                    array->AddVertex(x[other & 1], y[(other >> 1) & 1],
+                                     z[other >> 2]);
+                }
+            }
+        }
+#if OCC_VERSION_HEX >= 0x070000
+        Handle(Graphic3d_Group) group = prs->NewGroup();
+#else
+        Handle(Graphic3d_Group) group = Prs3d_Root::CurrentGroup(prs);
+#endif
+        Handle(Graphic3d_AspectLine3d) aspect = new Graphic3d_AspectLine3d(
+            Quantity_NOC_GRAY20, Aspect_TOL_SOLID, 1.0);
+        group->SetGroupPrimitivesAspect(aspect);
+        group->AddPrimitiveArray(array);
+    }
+    virtual void ComputeSelection(const Handle(SelectMgr_Selection)&,
+                                  const Standard_Integer)
+    {
+    }
+private:
+    QVector<Bnd_Box> boxes;
+};
+
 Viewer::Viewer(Handle(AIS_InteractiveContext) v, QWidget* parent) :
     QWidget(parent)
 {
@@ -53,6 +110,11 @@ Viewer::Viewer(Handle(AIS_InteractiveContext) v, QWidget* parent) :
     lastEvt = NULL;
     readyForInteraction = false;
 
+    navigating = false;
+    idleTimer = new QTimer(this);
+    idleTimer->setSingleShot(true);
+    connect(idleTimer, SIGNAL(timeout()), SLOT(showFullDetail()));
+
     QTimer::singleShot(50, this, SLOT(init()));
 }
 
@@ -197,6 +259,9 @@ void Viewer::mouseMoveEvent(QMouseEvent* evt)
 
     lastEvt = evt;
     if (buttonMode) {
+        if (buttonMode->navigates()) {
+            startNavigation();
+        }
         buttonMode->drag(getViewActionData(evt));
         emit selectionMightBeChanged();
     } else {
@@ -215,6 +280,9 @@ void Viewer::wheelEvent(QWheelEvent* evt)
     }
 
     scrollMode = getScrollAction(evt->modifiers());
+    if (scrollMode->navigates()) {
+        startNavigation();
+    }
     scrollMode->scroll(&(*view), evt->delta());
 }
 
@@ -248,3 +316,86 @@ void Viewer::startHover()
     setCursor(buttonMode->getCursor());
     buttonMode->click(getViewActionData(lastEvt));
 }
+
+void Viewer::addProxies(const QVector<Bnd_Box>& boxes)
+{
+    showFullDetail();
+    proxyBoxes += boxes;
+    proxy.Nullify();
+}
+
+void Viewer::clearProxies()
+{
+    showFullDetail();
+    proxyBoxes.clear();
+    proxy.Nullify();
+}
+
+bool Viewer::isNavigating() const
+{
+    return navigating;
+}
+
+QVector<double> Viewer::proxyDistances() const
+{
+    QVector<double> distances(proxyBoxes.size(), 0.0);
+    if (view.IsNull()) {
+        return distances;
+    }
+    Standard_Real x, y, z;
+    view->Eye(x, y, z);
+    gp_Pnt eye(x, y, z);
+    for (int i = 0; i < proxyBoxes.size(); i++) {
+        if (proxyBoxes[i].IsVoid()) {
+            distances[i] = RealLast();
+            continue;
+        }
+        Standard_Real x0, y0, z0, x1, y1, z1;
+        proxyBoxes[i].Get(x0, y0, z0, x1, y1, z1);
+        distances[i] = eye.Distance(gp_Pnt((x0 + x1) / 2, (y0 + y1) / 2,
+                                           (z0 + z1) / 2));
+    }
+    return distances;
+}
+
+// Swaps the displayed objects for the boxes, unless there are too few
+// solids to be worth it, and (re)starts the wait for idle input.
+void Viewer::startNavigation()
+{
+    idleTimer->start(HelpDialog::lodDelay);
+    if (navigating || proxyBoxes.size() < HelpDialog::lodSolids) {
+        return;
+    }
+    navigating = true;
+
+    AIS_ListOfInteractive shown;
+    context->DisplayedObjects(shown);
+    for (AIS_ListIteratorOfListOfInteractive it(shown); it.More(); it.Next()) {
+        context->Erase(it.Value(), Standard_False);
+        hidden.append(it.Value());
+    }
+    if (proxy.IsNull()) {
+        proxy = new BoxProxy(proxyBoxes);
+    }
+    context->Display(proxy, 0, -1, Standard_False);
+}
+
+void Viewer::showFullDetail()
+{
+    idleTimer->stop();
+    if (!navigating) {
+        return;
+    }
+    navigating = false;
+
+    context->Erase(proxy, Standard_False);
+    for (int i = 0; i < hidden.size(); i++) {
+        // Objects removed meanwhile stay removed.
+        if (context->DisplayStatus(hidden[i]) == AIS_DS_Erased) {
+            context->Display(hidden[i], Standard_False);
+        }
+    }
+    hidden.clear();
+    context->UpdateCurrentViewer();
+    emit fullDetailShown();
+}
@@ -2,16 +2,20 @@
 #define VIEWER_H
 
 #include <QRubberBand>
+#include <QVector>
+#include <QList>
 
 #include <Standard.hxx>
 #include <AIS_InteractiveContext.hxx>
 #include <V3d_TypeOfOrientation.hxx>
 #include <V3d_View.hxx>
+#include <Bnd_Box.hxx>
 
 class V3d_Viewer;
 class MouseButtonMode;
 class MouseScrollMode;
 class Viewer;
+class QTimer;
 
 class ViewActionData
 {
@@ -37,18 +41,32 @@ public:
 
     static V3d_Viewer* makeViewer();
 
+    // Boxes drawn in place of the solids while the view moves, once there
+    // are enough of them; see HelpDialog::lodSolids.
+    void addProxies(const QVector<Bnd_Box>& boxes);
+    void clearProxies();
+    bool isNavigating() const;
+    // How far the center of each box is from the eye.
+    QVector<double> proxyDistances() const;
+
 signals:
     void readyToUse();
     void selectionMightBeChanged();
+    // The solids are back after moving the view; their selection may not.
+    void fullDetailShown();
 
 public slots:
     void setOrientation(V3d_TypeOfOrientation);
     void resetView();
 
     void startHover();
+    // Puts the solids back in place of their boxes, if these are shown.
+    void showFullDetail();
 private slots:
     void init();
 private:
+    void startNavigation();
+
     virtual QPaintEngine* paintEngine() const
     {
         return 0;
@@ -73,6 +91,14 @@ private:
     QMouseEvent* lastEvt;
     bool mustResize;
     bool readyForInteraction;
+
+    // While the view moves, the objects hidden and the boxes shown
+    // instead, until input has been idle for a while.
+    QTimer* idleTimer;
+    QVector<Bnd_Box> proxyBoxes;
+    Handle(AIS_InteractiveObject) proxy;
+    QList<Handle(AIS_InteractiveObject)> hidden;
+    bool navigating;
 };
 
 #endif // VIEWER_H
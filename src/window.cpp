@@ -4,6 +4,12 @@
 #include "gdmlwriter.h"
 #include "util.h"
 #include "helpdialog.h"
+#include "project.h"
+#include "importer.h"
+#include "exporter.h"
+#include "mergeddisplay.h"
+#include "refiner.h"
+#include "solidlist.h"
 
 #include <QLabel>
 #include <QMenu>
@@ -13,15 +19,21 @@
 #include <QSignalMapper>
 #include <QStandardItemModel>
 #include <QFileDialog>
+#include <QStatusBar>
+#include <QTimer>
 
 #include <AIS_InteractiveObject.hxx>
+#include <BRepBndLib.hxx>
+#include <Bnd_Box.hxx>
 
 #include <V3d_Viewer.hxx>
 #include <V3d_View.hxx>
 #include <V3d_AmbientLight.hxx>
 #include <V3d_DirectionalLight.hxx>
 
+#include <algorithm>
 #include <cstdio>
+#include <cmath>
 
 QIcon makeIcon(QColor color)
 {
@@ -63,7 +75,9 @@ void GDMLNameValidator::fixup(QString&) const
 }
 
 MainWindow::MainWindow(QString openFile) :
-    QMainWindow(), helpdialog(NULL)
+    QMainWindow(), helpdialog(NULL), project(NULL), lastMeshes(NULL),
+    lastChunks(new SolidChunks()), importer(NULL), opening(NULL),
+    exporter(NULL), merged(NULL), refiner(NULL), syncing(false)
 {
     setWindowTitle("STEP to GDML");
 
@@ -76,10 +90,33 @@ MainWindow::MainWindow(QString openFile) :
                                            Standard_True));
     v->SetLightOn(new V3d_AmbientLight(v, Quantity_NOC_WHITE));
 
+    // Solids are shown coarsely at first, and refined meanwhile.
+#if OCC_VERSION_HEX >= 0x070000
+    refiner = new Refiner(context->DefaultDrawer()->DeviationCoefficient(),
+                          context->DefaultDrawer()->DeviationAngle());
+    refiner->start();
+#endif
+    priorityTimer = new QTimer(this);
+    priorityTimer->setSingleShot(true);
+    connect(priorityTimer, SIGNAL(timeout()), SLOT(prioritizeRefinement()));
+    // Refined solids are swapped in a few times a second, so that each
+    // batch shown is rebuilt once for many of them.
+    refineTimer = new QTimer(this);
+    refineTimer->setSingleShot(true);
+    refineTimer->setInterval(250);
+    connect(refineTimer, SIGNAL(timeout()), SLOT(refinedReady()));
+    if (refiner) {
+        connect(refiner, SIGNAL(refined()), refineTimer, SLOT(start()));
+    }
 
     view = new Viewer(context, this);
     connect(view, SIGNAL(selectionMightBeChanged()),
             SLOT(onViewSelectionChanged()));
+    // Hiding the solids while the view moved may have dropped their
+    // selection; the list still has it.
+    connect(view, SIGNAL(fullDetailShown()), SLOT(reapplySelection()));
+    // Meshes refined meanwhile were held back.
+    connect(view, SIGNAL(fullDetailShown()), SLOT(refinedReady()));
     if (!openFile.isEmpty()) {
         QSignalMapper* sigmap = new QSignalMapper(this);
         sigmap->setMapping(view, openFile);
@@ -87,8 +124,6 @@ MainWindow::MainWindow(QString openFile) :
         connect(sigmap, SIGNAL(mapped(QString)), this, SLOT(importSTEP(QString)));
     }
 
-    translate = new Translator(context);
-
     createMenus();
     createInterface();
 
@@ -97,12 +132,33 @@ MainWindow::MainWindow(QString openFile) :
     current_object = -1;
 }
 
+MainWindow::~MainWindow()
+{
+    stopImport();
+    // Imports given up on may still be reading.
+    QList<Importer*> stopped = findChildren<Importer*>();
+    for (int i = 0; i < stopped.size(); i++) {
+        stopped[i]->wait();
+    }
+    stopExport();
+    delete refiner;
+    delete merged;
+    delete project;
+    delete lastMeshes;
+    delete lastChunks;
+}
+
 void MainWindow::loadSettings()
 {
     QSettings settings;
 
     this->restoreGeometry(settings.value("this-geom").toByteArray());
     splitter->restoreState(settings.value("splitter-state").toByteArray());
+#if MERGED_DISPLAY
+    if (settings.value("merged-display", false).toBool()) {
+        merged = new MergedDisplay(context);
+    }
+#endif
 }
 
 void MainWindow::closeEvent(QCloseEvent* evt)
@@ -110,6 +166,7 @@ void MainWindow::closeEvent(QCloseEvent* evt)
     QSettings settings;
     settings.setValue("this-geom", this->saveGeometry());
     settings.setValue("splitter-state", splitter->saveState());
+    settings.setValue("merged-display", merged != NULL);
     HelpDialog::saveConfig();
 
     QMainWindow::closeEvent(evt);
@@ -117,15 +174,31 @@ void MainWindow::closeEvent(QCloseEvent* evt)
 
 void MainWindow::createInterface()
 {
-    namesList = new QListWidget();
+    solidList = new SolidList(model, this);
+    sortedSolids = new QSortFilterProxyModel(this);
+    sortedSolids->setSourceModel(solidList);
+    sortedSolids->setDynamicSortFilter(true);
+    sortedSolids->setFilterCaseSensitivity(Qt::CaseInsensitive);
+    sortedSolids->sort(0);
+
+    namesList = new QListView();
+    namesList->setModel(sortedSolids);
     namesList->setAlternatingRowColors(true);
-    namesList->setSortingEnabled(true);
+    // Rows of one height spare measuring every name.
+    namesList->setUniformItemSizes(true);
     namesList->setSelectionMode(QAbstractItemView::ExtendedSelection);
     namesList->setSpacing(1);
-    connect(namesList, SIGNAL(itemSelectionChanged()),
-            SLOT(onListSelectionChanged()));
-    connect(namesList, SIGNAL(currentRowChanged(int)),
-            SLOT(changeCurrentObject(int)));
+    connect(namesList->selectionModel(),
+            SIGNAL(selectionChanged(QItemSelection, QItemSelection)),
+            SLOT(onListSelectionChanged(QItemSelection, QItemSelection)));
+    connect(namesList->selectionModel(),
+            SIGNAL(currentChanged(QModelIndex, QModelIndex)),
+            SLOT(changeCurrentObject(QModelIndex)));
+
+    namesFilter = new QLineEdit();
+    namesFilter->setPlaceholderText("Filter");
+    connect(namesFilter, SIGNAL(textChanged(QString)),
+            SLOT(filterSolids(QString)));
 
     objMaterial = new QComboBox();
     objMaterial->addItems(QStringList() << GdmlWriter::defaultMaterial());
@@ -152,6 +225,26 @@ void MainWindow::createInterface()
             SLOT(currentObjectUpdated()));
     QLabel* objTransparencyLabel = new QLabel("Alpha");
 
+    // Zero keeps the export's settings.
+    objDeflection = new QDoubleSpinBox();
+    objDeflection->setDecimals(4);
+    objDeflection->setRange(0.0, 1.0);
+    objDeflection->setSingleStep(0.001);
+    objDeflection->setSpecialValueText("Default");
+    connect(objDeflection, SIGNAL(valueChanged(double)),
+            SLOT(currentObjectUpdated()));
+    QLabel* objDeflectionLabel = new QLabel("Deflection");
+    objDeflectionLabel->setToolTip("Mesh deflection, relative to the size of the part");
+
+    objAngle = new QDoubleSpinBox();
+    objAngle->setDecimals(1);
+    objAngle->setRange(0.0, 90.0);
+    objAngle->setSuffix(" deg");
+    objAngle->setSpecialValueText("Default");
+    connect(objAngle, SIGNAL(valueChanged(double)),
+            SLOT(currentObjectUpdated()));
+    QLabel* objAngleLabel = new QLabel("Angle");
+
     Quantity_Color qcol;
 #if OCC_VERSION_HEX >= 0x070000
     qcol = context->DefaultDrawer()->Color();
@@ -174,6 +267,14 @@ void MainWindow::createInterface()
             SLOT(setEnabled(bool)));
     connect(this, SIGNAL(enableObjectEditor(bool)), objTransparencyLabel,
             SLOT(setEnabled(bool)));
+    connect(this, SIGNAL(enableObjectEditor(bool)), objDeflection,
+            SLOT(setEnabled(bool)));
+    connect(this, SIGNAL(enableObjectEditor(bool)), objDeflectionLabel,
+            SLOT(setEnabled(bool)));
+    connect(this, SIGNAL(enableObjectEditor(bool)), objAngle,
+            SLOT(setEnabled(bool)));
+    connect(this, SIGNAL(enableObjectEditor(bool)), objAngleLabel,
+            SLOT(setEnabled(bool)));
     connect(this, SIGNAL(enableObjectEditor(bool)), objColor,
             SLOT(setEnabled(bool)));
     connect(this, SIGNAL(enableObjectEditor(bool)), objColorLabel,
@@ -204,9 +305,18 @@ void MainWindow::createInterface()
     rtlayout->addWidget(objColorLabel, 6, 0, Qt::AlignRight | Qt::AlignVCenter);
     rtlayout->addWidget(objColor, 6, 2);
 
+    rtlayout->addWidget(objDeflectionLabel, 8, 0,
+                        Qt::AlignRight | Qt::AlignVCenter);
+    rtlayout->addWidget(objDeflection, 8, 2);
+
+    rtlayout->addWidget(objAngleLabel, 10, 0, Qt::AlignRight | Qt::AlignVCenter);
+    rtlayout->addWidget(objAngle, 10, 2);
+
     rtlayout->setRowMinimumHeight(1, 5);
     rtlayout->setRowMinimumHeight(3, 5);
     rtlayout->setRowMinimumHeight(5, 5);
+    rtlayout->setRowMinimumHeight(7, 5);
+    rtlayout->setRowMinimumHeight(9, 5);
     rtlayout->setColumnMinimumWidth(1, 5);
 
     QVBoxLayout* rlayout = new QVBoxLayout();
@@ -218,7 +328,13 @@ void MainWindow::createInterface()
     splitter = new QSplitter(Qt::Horizontal);
     splitter->setChildrenCollapsible(false);
 
-    splitter->addWidget(namesList);
+    QVBoxLayout* llayout = new QVBoxLayout();
+    llayout->setContentsMargins(0, 0, 0, 0);
+    llayout->addWidget(namesFilter, 0);
+    llayout->addWidget(namesList, 1);
+    QWidget* l = new QWidget();
+    l->setLayout(llayout);
+    splitter->addWidget(l);
     splitter->setStretchFactor(0, 1);
 
     splitter->addWidget(view);
@@ -230,6 +346,16 @@ void MainWindow::createInterface()
     splitter->setStretchFactor(2, 1);
 
     this->setCentralWidget(splitter);
+
+    // Shown while an import or export runs.
+    progressBar = new QProgressBar();
+    progressBar->setRange(0, 100);
+    cancelButton = new QPushButton("Cancel");
+    connect(cancelButton, SIGNAL(clicked()), SLOT(cancelTask()));
+    statusBar()->addPermanentWidget(progressBar);
+    statusBar()->addPermanentWidget(cancelButton);
+    progressBar->hide();
+    cancelButton->hide();
 }
 
 
@@ -240,22 +366,47 @@ void MainWindow::createMenus()
                              SLOT(raiseSTEP()));
     QAction* expo = mkAction(this, "Export GDML file", "Ctrl+E", SLOT(raiseGDML()));
     QAction* help = mkAction(this, "Help", "", SLOT(raiseHelp()));
+    QAction* open = mkAction(this, "Open project...", "Ctrl+Shift+O",
+                             SLOT(raiseOpenProject()));
+    QAction* save = mkAction(this, "Save project...", "Ctrl+S",
+                             SLOT(raiseSaveProject()));
+    QAction* shut = mkAction(this, "Close", "Ctrl+W", SLOT(closeModel()));
 
     QMenu* fileMenu = new QMenu("File", this);
     fileMenu->addAction(load);
     fileMenu->addAction(expo);
     fileMenu->addSeparator();
+    fileMenu->addAction(open);
+    fileMenu->addAction(save);
+    fileMenu->addAction(shut);
+    fileMenu->addSeparator();
     fileMenu->addAction(quit);
     this->menuBar()->addMenu(fileMenu);
 
+#if MERGED_DISPLAY
+    QAction* merge = new QAction("Merge solids by color", this);
+    merge->setCheckable(true);
+    merge->setChecked(QSettings().value("merged-display", false).toBool());
+    merge->setToolTip("Faster for many solids; each color is drawn at once");
+    connect(merge, SIGNAL(toggled(bool)), SLOT(setMergedDisplay(bool)));
+
+    QMenu* viewMenu = new QMenu("View", this);
+    viewMenu->addAction(merge);
+    this->menuBar()->addMenu(viewMenu);
+#endif
+
     QMenu* helpMenu = new QMenu("Help", this);
     helpMenu->addAction(help);
     this->menuBar()->addMenu(helpMenu);
 }
 
+// Past this, the meshes and text of the last export are dropped rather
+// than kept for the next one.
+static const qint64 keptLimit = qint64(512) << 20;
+
 QList<QString> ensureUniqueness(const QList<QString>& input)
 {
-    QMap<QString, int> nameIndex;
+    QHash<QString, int> nameIndex;
     QVector<int> nameFreqs;
     for (int i = 0; i < input.length(); i++) {
         QString name = input[i];
@@ -285,71 +436,345 @@ QList<QString> ensureUniqueness(const QList<QString>& input)
     return output;
 }
 
-void MainWindow::importSTEP(QString path)
+void MainWindow::clearSolids()
 {
-    qDebug("Importing file %s", path.toUtf8().data());
-
+    if (refiner) {
+        refiner->clear();
+    }
+    view->clearProxies();
+#if MERGED_DISPLAY
+    if (merged) {
+        merged->clear();
+    }
+#endif
     context->RemoveAll(true);
-    metadata.clear();
-    itemsToIndices.clear();
+    delete project;
+    project = NULL;
+    delete lastMeshes;
+    lastMeshes = NULL;
+    *lastChunks = SolidChunks();
+    solidList->clear();
+    model.clear();
+    objects.clear();
     objectsToIndices.clear();
-    namesList->clear();
+    selection.clear();
+    // Resetting the list says nothing of its current row.
+    changeCurrentObject(QModelIndex());
     names.clear();
+}
 
-    QList<QPair<QString, QColor> > objectData;
-    QList<AIS_InteractiveObject*>  objects = translate->importSTEP(path,
-            objectData);
-    if (objects.isEmpty()) {
-        qDebug("Failure");
-    } else {
-        qDebug("Success");
-        importedName = path;
+void MainWindow::closeModel()
+{
+    stopImport();
+    stopExport();
+    clearSolids();
+    context->UpdateCurrentViewer();
+}
+
+void MainWindow::importSTEP(QString path)
+{
+    qDebug("Importing file %s", path.toUtf8().data());
+
+    stopImport();
+    stopExport();
+    clearSolids();
+
+    importer = new Importer(path);
+    connect(importer, SIGNAL(solidsReady()), SLOT(importSolidsReady()));
+    connect(importer, SIGNAL(finished()), SLOT(importFinished()));
+    startProgress(importer);
+}
+
+void MainWindow::startProgress(QThread* task)
+{
+    connect(task, SIGNAL(progressed(QString, int)),
+            SLOT(showProgress(QString, int)));
+    progressBar->setValue(0);
+    progressBar->show();
+    cancelButton->show();
+    task->start();
+}
+
+void MainWindow::endProgress()
+{
+    progressBar->hide();
+    cancelButton->hide();
+    statusBar()->clearMessage();
+}
+
+// Drops an import under way. Reading the file cannot be interrupted, so
+// rather than wait for that, it is left to give up on its own.
+void MainWindow::stopImport()
+{
+    if (!importer) {
+        return;
     }
-    QList<QString> objectNames;
-    QList<QColor> objectColors;
-    for (int i = 0; i < objectData.length(); i++) {
-        objectNames.append(objectData[i].first);
-        objectColors.append(objectData[i].second);
+    importer->cancel();
+    // Its signals may still be queued.
+    disconnect(importer, 0, this, 0);
+    connect(importer, SIGNAL(finished()), importer, SLOT(deleteLater()));
+    if (importer->isFinished()) {
+        importer->deleteLater();
     }
-    objectNames = ensureUniqueness(objectNames);
+    // Only so that closing the window can wait for it.
+    importer->setParent(this);
+    importer = NULL;
+    delete opening;
+    opening = NULL;
+    endProgress();
+}
+
+// Waits for an export under way to give up, leaving the file as it was.
+void MainWindow::stopExport()
+{
+    if (!exporter) {
+        return;
+    }
+    exporter->cancel();
+    exporter->wait();
+    exporter->deleteLater();
+    exporter = NULL;
+    // Its chunks may be half refilled.
+    *lastChunks = SolidChunks();
+    endProgress();
+}
+
+void MainWindow::cancelTask()
+{
+    if (importer) {
+        importer->cancel();
+    }
+    if (exporter) {
+        exporter->cancel();
+    }
+}
+
+void MainWindow::showProgress(QString stage, int percent)
+{
+    if (!sender() || (sender() != importer && sender() != exporter)) {
+        return;
+    }
+    statusBar()->showMessage(stage);
+    progressBar->setValue(percent);
+}
 
+void MainWindow::importSolidsReady()
+{
+    if (!importer || sender() != importer) {
+        return;
+    }
+    int first = model.count();
+    importer->takeSolids(model);
+    if (model.count() == first) {
+        return;
+    }
 
-    for (int i = 0; i < objects.length(); i++) {
-        SolidMetadata sm;
+    // Names are made unique once all are known.
+    solidList->grow();
+    showSolids(first);
+    if (refiner) {
+        for (int i = first; i < model.count(); i++) {
+            refiner->add(i, model.shape(i));
+        }
+        scheduleRefinement();
+    }
 
-        sm.name = objectNames[i];
-        sm.item = new QListWidgetItem(sm.name);
-        sm.object = objects[i];
-        sm.material = "ALUMINUM";
-        QColor c = objectColors[i];
-        sm.color = Quantity_Color(c.redF(), c.greenF(), c.blueF(), Quantity_TOC_RGB);
-        sm.transp = 0.0;
+    if (first == 0) {
+        view->resetView();
+    } else {
+        context->UpdateCurrentViewer();
+    }
+}
 
-        metadata.append(sm);
-        itemsToIndices[sm.item] = i;
-        objectsToIndices[sm.object] = i;
-        namesList->blockSignals(true);
-        namesList->addItem(sm.item);
-        namesList->blockSignals(false);
-        names.insert(sm.name);
+void MainWindow::importFinished()
+{
+    if (!importer || sender() != importer) {
+        return;
+    }
+    importSolidsReady();
+    importer->wait();
+    bool success = importer->succeeded();
+    QString path = importer->fileName();
+    QByteArray key = importer->sourceKey();
+    model.assemblies = importer->assemblies();
+    importer->deleteLater();
+    importer = NULL;
+    endProgress();
+
+    Project* opened = opening;
+    opening = NULL;
+    if (!success) {
+        qDebug("Failure");
+        delete opened;
+        clearSolids();
+        return;
     }
+    qDebug("Success");
+    model.source = path;
+    model.sourceKey = key;
 
-    for (int i = 0; i < metadata.size(); i++) {
-        SolidMetadata& m = metadata[i];
-        context->SetColor(m.object, m.color, false);
-        context->SetTransparency(m.object, m.transp, false);
+    QList<QString> objectNames;
+    for (int i = 0; i < model.count(); i++) {
+        objectNames.append(model.metadata[i].name);
+    }
+    objectNames = ensureUniqueness(objectNames);
+    names.clear();
+    for (int i = 0; i < model.count(); i++) {
+        model.metadata[i].name = objectNames[i];
+        names.insert(objectNames[i]);
     }
+    solidList->rename();
 
+#if MERGED_DISPLAY
+    // The solids came in pieces, each batched on its own.
+    if (merged) {
+        merged->compact(model);
+    }
+#endif
     view->resetView();
+    if (opened) {
+        applyProject(opened);
+    }
 }
 
 void MainWindow::exportGDML(QString path)
 {
+    if (importer || exporter) {
+        qWarning("Wait for the import or export under way to finish.");
+        return;
+    }
     qDebug("Exporting file %s", path.toUtf8().data());
-    bool success = translate->exportGDML(path, metadata);
+    ExportOptions options;
+    if (lastMeshes) {
+        options.reuse = lastMeshes;
+    } else {
+        options.reuse = project;
+    }
+    options.keep = new MeshSet();
+    options.chunks = lastChunks;
+    exporter = new Exporter(path, model, options);
+    connect(exporter, SIGNAL(finished()), SLOT(exportFinished()));
+    connect(exporter, SIGNAL(shapesReleased()), SLOT(refinedReady()));
+    startProgress(exporter);
+}
+
+void MainWindow::exportFinished()
+{
+    if (!exporter || sender() != exporter) {
+        return;
+    }
+    exporter->wait();
+    bool success = exporter->succeeded();
+    // Nothing is recorded when the last export's chunks were spliced in.
+    MeshSet* kept = exporter->takeKept();
+    exporter->deleteLater();
+    exporter = NULL;
+    endProgress();
+    qDebug("Success %c", success ? 'Y' : 'N');
+    if (kept) {
+        delete lastMeshes;
+        lastMeshes = kept;
+    }
+    if (!success) {
+        *lastChunks = SolidChunks();
+    }
+    // Only worth keeping while they are small next to the model.
+    qint64 held = lastChunks->size() + (lastMeshes ? lastMeshes->size() : 0);
+    if (held > keptLimit) {
+        qDebug("Dropping %lld MB kept from the export", (long long)(held >> 20));
+        delete lastMeshes;
+        lastMeshes = NULL;
+        *lastChunks = SolidChunks();
+    }
+}
+
+void MainWindow::openProject(QString path)
+{
+    qDebug("Opening project %s", path.toUtf8().data());
+    Project* opened = new Project();
+    if (!opened->open(path)) {
+        qWarning("%s is not a project file.", path.toUtf8().data());
+        delete opened;
+        return;
+    }
+    // The project is applied once its STEP file has been imported, if
+    // that is still the file it was saved for.
+    importSTEP(opened->source());
+    opening = opened;
+}
+
+void MainWindow::applyProject(Project* opened)
+{
+    if (model.sourceKey != opened->sourceKey()) {
+        qWarning("%s has changed since the project was saved.",
+                 model.source.toUtf8().data());
+        delete opened;
+        return;
+    }
+    if (!opened->restore(model.metadata)) {
+        qWarning("The project does not match its STEP file.");
+        delete opened;
+        return;
+    }
+    project = opened;
+
+    names.clear();
+    for (int i = 0; i < model.count(); i++) {
+        names.insert(model.metadata[i].name);
+    }
+#if MERGED_DISPLAY
+    // Moving solids one by one would rebuild their batches each time.
+    if (merged) {
+        merged->clear();
+        merged->display(model);
+        reapplySelection();
+    } else
+#endif
+    {
+        for (int i = 0; i < model.count(); i++) {
+            showAppearance(i, false);
+        }
+    }
+    solidList->rename();
+    context->UpdateCurrentViewer();
+}
+
+void MainWindow::saveProject(QString path)
+{
+    if (model.source.isEmpty() || importer || exporter) {
+        return;
+    }
+    qDebug("Saving project %s", path.toUtf8().data());
+    const MeshSource* meshes = lastMeshes;
+    if (!meshes) {
+        meshes = project;
+    }
+    bool success = Project::save(path, model.source, model.sourceKey,
+                                 model.metadata, meshes);
     qDebug("Success %c", success ? 'Y' : 'N');
 }
 
+void MainWindow::raiseOpenProject()
+{
+    QString filters = "Projects (*.sgp);;All Files (*.*)";
+    QString name = QFileDialog::getOpenFileName(this, "Open project",
+                   QDir::currentPath(), filters);
+    if (!name.isEmpty()) {
+        openProject(name);
+    }
+}
+
+void MainWindow::raiseSaveProject()
+{
+    QString filters = "Projects (*.sgp);;All Files (*.*)";
+    QString name = QFileDialog::getSaveFileName(this, "Save project",
+                   QDir::currentPath() + QDir::separator() + "project.sgp",
+                   filters);
+    if (!name.isEmpty()) {
+        saveProject(name);
+    }
+}
+
 void MainWindow::raiseSTEP()
 {
     QString filters = "All Files (*.*);;Step Files (*.stp *.step)";
@@ -363,7 +788,7 @@ void MainWindow::raiseSTEP()
 void MainWindow::raiseGDML()
 {
     QString filters = "GDML Files (*.gdml);;All Files (*.*)";
-    QString adv_name = importedName.isEmpty() ? "output.gdml" : importedName.split(QDir::separator()).last();
+    QString adv_name = model.source.isEmpty() ? "output.gdml" : model.source.split(QDir::separator()).last();
     QString name = QFileDialog::getSaveFileName(this, "Export GDML file",
                                  QDir::currentPath() + QDir::separator() + adv_name, filters);
     if (!name.isEmpty()) {
@@ -380,54 +805,108 @@ void MainWindow::raiseHelp()
     helpdialog->raise();
 }
 
+// Brings the list in line with the context, which mouse events may have
+// changed; most change nothing.
 void MainWindow::onViewSelectionChanged()
 {
-    namesList->blockSignals(true);
-
-    namesList->clearSelection();
+    // Also called as the view is dragged around.
+    scheduleRefinement();
+    // The solids are hidden then, and their selection in the context may be
+    // dropped; the list keeps it.
+    if (view->isNavigating()) {
+        return;
+    }
 
-    QListWidgetItem* current = 0;//namesList->currentItem();
+    QSet<int> now;
+    QList<int> added;
     for (context->InitSelected(); context->MoreSelected();
          context->NextSelected()) {
-        int idx = objectsToIndices[&(*context->Current())];
-        if (!metadata[idx].item->isSelected()) {
-            current = metadata[idx].item;
+        int idx = selectedSolid();
+        if (idx < 0 || now.contains(idx)) {
+            continue;
+        }
+        now.insert(idx);
+        if (!selection.contains(idx)) {
+            added.append(idx);
         }
-        metadata[idx].item->setSelected(true);
     }
-    namesList->blockSignals(false);
-
-    if (current != 0) {
-        namesList->setCurrentItem(current);
-    } else {
-        int row = namesList->currentRow();
-        if (row >= 0) {
-            int idx = itemsToIndices[namesList->item(row)];
-            if (!context->IsSelected(metadata[idx].object)) {
-                namesList->setCurrentRow(-1);
-            }
+    if (added.isEmpty() && now.size() == selection.size()) {
+        return;
+    }
+    QList<int> removed;
+    QSet<int>::const_iterator it;
+    for (it = selection.constBegin(); it != selection.constEnd(); ++it) {
+        if (!now.contains(*it)) {
+            removed.append(*it);
         }
     }
+    selection = now;
+
+    syncing = true;
+    QItemSelectionModel* sm = namesList->selectionModel();
+    sm->select(rowsOf(removed), QItemSelectionModel::Deselect);
+    sm->select(rowsOf(added), QItemSelectionModel::Select);
+    syncing = false;
+
+    if (!added.isEmpty()) {
+        QModelIndex last = sortedSolids->mapFromSource(
+                               solidList->index(added.last()));
+        sm->setCurrentIndex(last, QItemSelectionModel::NoUpdate);
+    } else if (!selection.contains(currentIndex())) {
+        sm->setCurrentIndex(QModelIndex(), QItemSelectionModel::NoUpdate);
+    }
 }
-void MainWindow::onListSelectionChanged()
-{
-    context->ClearSelected(false);
 
-    QList<QListWidgetItem*> items = namesList->selectedItems();
-    for (int i = 0; i < items.length(); i++) {
-        Handle(AIS_InteractiveObject) obj = metadata[itemsToIndices[items[i]]].object;
-        context->AddOrRemoveSelected(obj, false);
+// Applies what changed in the list to the context.
+void MainWindow::onListSelectionChanged(const QItemSelection& selected,
+                                        const QItemSelection& deselected)
+{
+    if (syncing) {
+        return;
+    }
+    QModelIndexList off = deselected.indexes();
+    for (int i = 0; i < off.size(); i++) {
+        setSolidSelected(solidAt(off[i]), false);
+    }
+    QModelIndexList on = selected.indexes();
+    for (int i = 0; i < on.size(); i++) {
+        setSolidSelected(solidAt(on[i]), true);
     }
     context->UpdateCurrentViewer();
 
-    if (items.length() == 0) {
-        namesList->setCurrentRow(-1);
+    if (selection.isEmpty()) {
+        namesList->selectionModel()->setCurrentIndex(
+            QModelIndex(), QItemSelectionModel::NoUpdate);
     }
+    scheduleRefinement();
 }
 
-void MainWindow::changeCurrentObject(int row)
+// Rows filtered out leave the list's selection, and rows filtered back in
+// come without it; the selection itself stays as it was.
+void MainWindow::filterSolids(const QString& text)
 {
-    if (row < 0) {
+    syncing = true;
+    sortedSolids->setFilterFixedString(text);
+    namesList->selectionModel()->select(rowsOf(selection.values()),
+                                        QItemSelectionModel::ClearAndSelect);
+    syncing = false;
+}
+
+// Selects the solids of the list in the context again, after they were
+// shown anew.
+void MainWindow::reapplySelection()
+{
+    QList<int> solids = selection.values();
+    for (int i = 0; i < solids.size(); i++) {
+        setSolidSelected(solids[i], true);
+    }
+    context->UpdateCurrentViewer();
+}
+
+void MainWindow::changeCurrentObject(const QModelIndex& current)
+{
+    int idx = solidAt(current);
+    if (idx < 0) {
         if (current_object >= 0) {
             emit enableObjectEditor(false);
             current_object = -1;
@@ -439,7 +918,6 @@ void MainWindow::changeCurrentObject(int row)
         emit enableObjectEditor(true);
     }
 
-    int idx = itemsToIndices[namesList->item(row)];
     if (current_object == idx) {
         return;
     }
@@ -460,6 +938,13 @@ void MainWindow::changeCurrentObject(int row)
 
     objColor->setIcon(makeIcon(meta.color));
 
+    objDeflection->blockSignals(true);
+    objDeflection->setValue(meta.deflection);
+    objDeflection->blockSignals(false);
+    objAngle->blockSignals(true);
+    objAngle->setValue(meta.angle * 180.0 / M_PI);
+    objAngle->blockSignals(false);
+
     QString mat = meta.material;
     int mats = objMaterial->count();
     int found = 0;
@@ -484,17 +969,18 @@ void MainWindow::currentObjectUpdated()
     objName->setStyleSheet("");
     QString next = objName->text();
     SolidMetadata& meta = currentMetadata();
-    QListWidgetItem* item = meta.item;
     meta.name = next;
-    item->setText(next);
+    solidList->rename(currentIndex());
 
     meta.material = objMaterial->currentText();
+    meta.deflection = objDeflection->value();
+    meta.angle = objAngle->value() * M_PI / 180.0;
 
     double transp = 1.0 - ((double)objTransparency->value() /
                            (double)objTransparency->maximum());
     if (transp != meta.transp) {
         meta.transp = transp;
-        context->SetTransparency(meta.object, meta.transp, true);
+        showAppearance(currentIndex(), true);
     }
 }
 
@@ -513,13 +999,221 @@ void MainWindow::getColor()
 
     Quantity_Color nco(next.redF(), next.greenF(), next.blueF(), Quantity_TOC_RGB);
     meta.color = nco;
-    context->SetColor(meta.object, nco, true);
+    showAppearance(currentIndex(), true);
+}
+
+// Shows the solids from first on, one way or the other.
+void MainWindow::showSolids(int first)
+{
+#if MERGED_DISPLAY
+    if (merged) {
+        merged->display(model, first);
+    } else
+#endif
+    {
+        QList<AIS_InteractiveObject*> shown = Translator::displayShapes(
+                context, model, first, refiner != NULL);
+        for (int i = first; i < model.count(); i++) {
+            AIS_InteractiveObject* object = shown[i - first];
+            objects.append(object);
+            objectsToIndices[object] = i;
+            showAppearance(i, false);
+        }
+    }
+
+    // Displaying meshed the solids, so their boxes are quick to find.
+    QVector<Bnd_Box> boxes(model.count() - first);
+    for (int i = first; i < model.count(); i++) {
+        BRepBndLib::Add(model.shape(i), boxes[i - first]);
+    }
+    view->addProxies(boxes);
+}
+
+void MainWindow::showAppearance(int solid, bool update)
+{
+#if MERGED_DISPLAY
+    if (merged) {
+        merged->update(model, solid);
+        if (update) {
+            context->UpdateCurrentViewer();
+        }
+        return;
+    }
+#endif
+    const SolidMetadata& m = model.metadata[solid];
+    context->SetColor(objects[solid], m.color, false);
+    context->SetTransparency(objects[solid], m.transp, update);
+}
+
+// The solid at the selection iterator of the context, or -1.
+int MainWindow::selectedSolid()
+{
+#if MERGED_DISPLAY
+    if (merged) {
+        return merged->solidOf(context->SelectedOwner());
+    }
+#endif
+    return objectsToIndices.value(&(*context->Current()), -1);
+}
+
+bool MainWindow::isSolidSelected(int solid)
+{
+#if MERGED_DISPLAY
+    if (merged) {
+        Handle(SelectMgr_EntityOwner) owner = merged->ownerOf(solid);
+        return !owner.IsNull() && context->IsSelected(owner);
+    }
+#endif
+    return context->IsSelected(objects[solid]);
+}
+
+// Records the solid as selected or not, and selects it so in the context
+// unless it already is.
+void MainWindow::setSolidSelected(int solid, bool on)
+{
+    if (solid < 0) {
+        return;
+    }
+    if (on) {
+        selection.insert(solid);
+    } else {
+        selection.remove(solid);
+    }
+    if (isSolidSelected(solid) == on) {
+        return;
+    }
+#if MERGED_DISPLAY
+    if (merged) {
+        Handle(SelectMgr_EntityOwner) owner = merged->ownerOf(solid);
+        if (!owner.IsNull()) {
+            context->AddOrRemoveSelected(owner, false);
+        }
+        return;
+    }
+#endif
+    context->AddOrRemoveSelected(objects[solid], false);
+}
+
+// The solid on a row of the list, or -1.
+int MainWindow::solidAt(const QModelIndex& index) const
+{
+    if (!index.isValid()) {
+        return -1;
+    }
+    return sortedSolids->mapToSource(index).row();
+}
+
+// The rows of the list showing the solids, in as few ranges as may be.
+QItemSelection MainWindow::rowsOf(const QList<int>& solids) const
+{
+    QList<int> rows;
+    for (int i = 0; i < solids.size(); i++) {
+        QModelIndex index = sortedSolids->mapFromSource(
+                                solidList->index(solids[i]));
+        // Filtered out.
+        if (index.isValid()) {
+            rows.append(index.row());
+        }
+    }
+    std::sort(rows.begin(), rows.end());
+    QItemSelection ranges;
+    for (int i = 0; i < rows.size();) {
+        int j = i;
+        while (j + 1 < rows.size() && rows[j + 1] == rows[j] + 1) {
+            j++;
+        }
+        ranges.select(sortedSolids->index(rows[i], 0),
+                      sortedSolids->index(rows[j], 0));
+        i = j + 1;
+    }
+    return ranges;
+}
+
+// Shows the solids again, merged or one by one, keeping the selection of
+// the list.
+void MainWindow::setMergedDisplay(bool on)
+{
+#if MERGED_DISPLAY
+    if (on == (merged != NULL)) {
+        return;
+    }
+    view->clearProxies();
+    if (merged) {
+        merged->clear();
+    }
+    context->RemoveAll(false);
+    delete merged;
+    merged = on ? new MergedDisplay(context) : NULL;
+    objects.clear();
+    objectsToIndices.clear();
+    if (model.count() > 0) {
+        showSolids(0);
+        reapplySelection();
+    }
+#else
+    Q_UNUSED(on);
+#endif
+}
+
+// Swaps in the meshes refined so far, keeping the objects shown.
+void MainWindow::refinedReady()
+{
+    // Until the view rests, as the solids are hidden while it moves, and
+    // until an export is done reading the shapes these meshes go into.
+    if (!refiner || view->isNavigating() ||
+            (exporter && exporter->holdsShapes())) {
+        return;
+    }
+    QVector<int> solids = refiner->apply(model);
+    if (solids.isEmpty()) {
+        return;
+    }
+#if MERGED_DISPLAY
+    if (merged) {
+        merged->remesh(model, solids);
+    } else
+#endif
+    {
+        for (int i = 0; i < solids.size(); i++) {
+            if (solids[i] < objects.size()) {
+                context->Redisplay(objects[solids[i]], false);
+                context->RecomputeSelectionOnly(objects[solids[i]]);
+            }
+        }
+    }
+    context->UpdateCurrentViewer();
+}
+
+void MainWindow::scheduleRefinement()
+{
+    if (refiner && !priorityTimer->isActive()) {
+        priorityTimer->start(200);
+    }
+}
+
+void MainWindow::prioritizeRefinement()
+{
+    if (!refiner || refiner->isIdle()) {
+        return;
+    }
+    QVector<double> priorities = view->proxyDistances();
+    // Distances are positive, so selected solids come first.
+    QSet<int>::const_iterator it;
+    for (it = selection.constBegin(); it != selection.constEnd(); ++it) {
+        if (*it < priorities.size()) {
+            priorities[*it] = -1.0;
+        }
+    }
+    refiner->setPriorities(priorities);
+}
+
+int MainWindow::currentIndex()
+{
+    return solidAt(namesList->currentIndex());
 }
 
 SolidMetadata& MainWindow::currentMetadata()
 {
-    int row = namesList->currentRow();
-    int idx = itemsToIndices[namesList->item(row)];
-    return metadata[idx];
+    return model.metadata[currentIndex()];
 }
 
@@ -1,22 +1,37 @@
 #ifndef WINDOW_H
 #define WINDOW_H
 
-#include "metadata.h"
+#include "model.h"
 
 #include <QSplitter>
-#include <QListWidget>
+#include <QListView>
+#include <QSortFilterProxyModel>
+#include <QItemSelection>
 #include <QLineEdit>
 #include <QComboBox>
 #include <QSlider>
+#include <QDoubleSpinBox>
 #include <QPushButton>
+#include <QProgressBar>
 #include <QMainWindow>
 #include <QSettings>
+#include <QHash>
+#include <QSet>
 
 class AIS_InteractiveContext;
 class AIS_InteractiveObject;
 class Viewer;
-class Translator;
 class HelpDialog;
+class Project;
+class MeshSet;
+class SolidChunks;
+class QThread;
+class Importer;
+class Exporter;
+class MergedDisplay;
+class Refiner;
+class SolidList;
+class QTimer;
 
 class GDMLNameValidator : public QValidator
 {
@@ -37,6 +52,7 @@ class MainWindow : public QMainWindow
     Q_OBJECT
 public:
     explicit MainWindow(QString openFile);
+    virtual ~MainWindow();
     virtual void closeEvent(QCloseEvent* event);
 
 signals:
@@ -45,44 +61,109 @@ signals:
 public slots:
     void importSTEP(QString);
     void exportGDML(QString);
+    void openProject(QString);
+    void saveProject(QString);
 
     void raiseSTEP();
     void raiseGDML();
+    void raiseOpenProject();
+    void raiseSaveProject();
     void raiseHelp();
+    void closeModel();
 
 private slots:
     void onViewSelectionChanged();
-    void onListSelectionChanged();
+    void onListSelectionChanged(const QItemSelection& selected,
+                                const QItemSelection& deselected);
+    void reapplySelection();
+    void filterSolids(const QString& text);
 
-    void changeCurrentObject(int);
+    void changeCurrentObject(const QModelIndex& current);
     void currentObjectUpdated();
 
     void getColor();
+
+    void showProgress(QString stage, int percent);
+    void importSolidsReady();
+    void importFinished();
+    void exportFinished();
+    void cancelTask();
+    void setMergedDisplay(bool);
+    void refinedReady();
+    void scheduleRefinement();
+    void prioritizeRefinement();
 private:
     void loadSettings();
     void createInterface();
     void createMenus();
+    int currentIndex();
     SolidMetadata& currentMetadata();
+    void clearSolids();
+    void stopImport();
+    void stopExport();
+    void startProgress(QThread* task);
+    void endProgress();
+    void applyProject(Project* opened);
+    void showSolids(int first);
+    void showAppearance(int solid, bool update);
+    int selectedSolid();
+    bool isSolidSelected(int solid);
+    void setSolidSelected(int solid, bool on);
+    int solidAt(const QModelIndex& index) const;
+    QItemSelection rowsOf(const QList<int>& solids) const;
 
     Viewer* view;
     AIS_InteractiveContext* context;
-    Translator* translate;
     HelpDialog* helpdialog;
 
     GDMLNameValidator* validator;
     QSplitter* splitter;
-    QListWidget* namesList;
+    QLineEdit* namesFilter;
+    QListView* namesList;
     QLineEdit* objName;
     QComboBox* objMaterial;
     QSlider* objTransparency;
+    QDoubleSpinBox* objDeflection;
+    QDoubleSpinBox* objAngle;
     QPushButton* objColor;
-
-    QVector<SolidMetadata> metadata;
-    QMap<QListWidgetItem*, int> itemsToIndices;
-    QMap<AIS_InteractiveObject*, int> objectsToIndices;
+    QProgressBar* progressBar;
+    QPushButton* cancelButton;
+
+    // What the list and the viewer show, with the viewer's object for
+    // each solid; the list shows it sorted and filtered.
+    Model model;
+    SolidList* solidList;
+    QSortFilterProxyModel* sortedSolids;
+    QVector<AIS_InteractiveObject*> objects;
+    QHash<AIS_InteractiveObject*, int> objectsToIndices;
+    // Shows the solids in batches of one color instead, when set; objects
+    // is then empty.
+    MergedDisplay* merged;
+    // Meshes the coarsely shown solids at display quality, those selected
+    // and nearest the eye first, as ordered a little after each change;
+    // NULL where solids are meshed at display quality right away.
+    Refiner* refiner;
+    QTimer* priorityTimer;
+    QTimer* refineTimer;
+    // The solids selected, as last synced between the list and the
+    // context; only the difference is applied to the other side. Set while
+    // the list is being changed to match the context.
+    QSet<int> selection;
+    bool syncing;
     QSet<QString> names;
-    QString importedName;
     int current_object;
+    // The project last opened, and the meshes of the last export; both
+    // let exports skip meshing while the solids' settings are unchanged.
+    Project* project;
+    MeshSet* lastMeshes;
+    // The formatted solids of the last export, for quick re-exports.
+    SolidChunks* lastChunks;
+    // The import under way, if any, and the project to apply once it is
+    // done.
+    Importer* importer;
+    Project* opening;
+    // The export under way, if any.
+    Exporter* exporter;
 };
 
 
@@ -34,7 +34,22 @@ HEADERS = src/util.h \
     src/gdmlwriter.h \
     src/metadata.h \
     src/helpdialog.h \
-    src/viewer.h
+    src/viewer.h \
+    src/triangulate.h \
+    src/parallel.h \
+    src/emitter.h \
+    src/primitives.h \
+    src/importcache.h \
+    src/project.h \
+    src/batch.h \
+    src/stats.h \
+    src/trace.h \
+    src/importer.h \
+    src/exporter.h \
+    src/model.h \
+    src/mergeddisplay.h \
+    src/refiner.h \
+    src/solidlist.h
 SOURCES = src/main.cpp \
     src/util.cpp \
     src/window.cpp \
@@ -42,7 +57,21 @@ SOURCES = src/main.cpp \
     src/gdmlwriter.cpp \
     src/helpdialog.cpp \
     src/viewer.cpp \
-    src/triangulate.cpp
+    src/triangulate.cpp \
+    src/parallel.cpp \
+    src/emitter.cpp \
+    src/primitives.cpp \
+    src/importcache.cpp \
+    src/project.cpp \
+    src/batch.cpp \
+    src/stats.cpp \
+    src/trace.cpp \
+    src/importer.cpp \
+    src/exporter.cpp \
+    src/model.cpp \
+    src/mergeddisplay.cpp \
+    src/refiner.cpp \
+    src/solidlist.cpp
 
 OTHER_FILES=.astylerc
 
@@ -95,6 +124,19 @@ LIBS += -lTKCAF -lTKLCAF -lTKXCAF -lTKXDESTEP
 #LIBS += -lTKGeomBase -lTKPShape -lTKBool -lTKBO -lTKXSBase -lTKStdLSchema -lTKSTEPAttr -lTKXmlTObj -lTKXSDRAW -lTKSTEP -lTKPrim -lTKAdvTools -lTKFillet -lTKXmlL -lTKTObj -lTKCAF -lTKCDF -lTKViewerTest -lTKService -lTKG2d -lTKG3d -lTKBin -lTKTopAlgo -lTKHLR -lTKXDEIGES -lTKVoxel -lTKDraw -lTKXMesh -lTKXCAFSchema -lTKNIS -lTKPCAF -lTKBinTObj -lTKXmlXCAF -lTKMath -lTKFeat -lTKIGES -lTKSTL -lTKV3d -lTKMesh -lTKVRML -lTKOpenGl -lTKXml -lTKXCAF -lTKBRep -lTKDCAF -lTKTObjDRAW -lTKernel -lTKQADraw -lTKMeshVS -lTKOffset -lTKXDEDRAW -lTKBinXCAF -lTKLCAF -lTKPLCAF -lTKShHealing -lPTKernel -lTKBinL -lTKSTEPBase -lTKShapeSchema -lTKXDESTEP -lTKStdSchema -lFWOSPlugin -lTKSTEP209 -lTKTopTest -lTKGeomAlgo
 
 
+# Compressed output: gzip always, zstd where available.
+LIBS += -lz
+packagesExist(libzstd) {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += libzstd
+    DEFINES += HAVE_ZSTD
+}
+
+# Spans for --trace, with qmake CONFIG+=trace; left out otherwise.
+trace {
+    DEFINES += STEPGDML_TRACE
+}
+
 LIBS += -L$$QMAKE_LIBDIR_X11 $$QMAKE_LIBS_X11
 LIBS += -L$$QMAKE_LIBDIR_OPENGL $$QMAKE_LIBS_OPENGL $$QMAKE_LIBS_THREAD
 